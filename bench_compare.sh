@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Compare "@bench" results against a saved baseline.
+#
+#   ./bench_compare.sh <baseline> <results> [slack percent, default 25]
+#
+# Lines with ops= and ticks= are compared on ticks per op, the rest
+# (failed=, largest-free=, ...) are just shown when they change. A case
+# that got slower by more than the slack is reported as a regression and
+# makes the script exit with status 1.
+
+BASE="$1"
+NEW="$2"
+SLACK="${3:-25}"
+
+if [ ! -f "$BASE" ] || [ ! -f "$NEW" ]; then
+  echo "usage: $0 <baseline> <results> [slack percent]"
+  exit 2
+fi
+
+awk -v slack="$SLACK" '
+  # key is test, case and cores= if present; value is ticks/op or the metric
+  function parse(line,   n, f, i, key, ops, ticks, kv) {
+    n = split(line, f, " ")
+    key = f[2] " " f[3]
+    ops = ""; ticks = ""; metric = ""
+    for (i = 4; i <= n; i++) {
+      split(f[i], kv, "=")
+      if (kv[1] == "cores") key = key " " f[i]
+      else if (kv[1] == "ops") ops = kv[2]
+      else if (kv[1] == "ticks") ticks = kv[2]
+      else { key = key " " kv[1]; metric = kv[2] }
+    }
+    if (ops != "" && ticks != "" && ops > 0) { rate = 1; value = ticks / ops }
+    else { rate = 0; value = metric }
+    return key
+  }
+  FNR == NR { k = parse($0); base[k] = value; next }
+  {
+    k = parse($0)
+    if (!(k in base)) { printf("bench: %s: new\n", k); next }
+    if (rate) {
+      change = (base[k] > 0) ? 100 * (value - base[k]) / base[k] : 0
+      if (change > slack) {
+        printf("bench: %s: %.1f -> %.1f ticks/op (+%d%%) REGRESSION\n", k, base[k], value, change)
+        regressions++
+      }
+    } else if (value != base[k]) {
+      printf("bench: %s: %s -> %s\n", k, base[k], value)
+    }
+  }
+  END {
+    printf("bench: %d regression(s) over %d%%\n", regressions, slack)
+    exit regressions > 0
+  }
+' "$BASE" "$NEW"
@@ -0,0 +1,86 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "stdint.h"
+
+/*
+ * Region allocator
+ *
+ * Bump-allocates out of big chunks taken from the page allocator (or the
+ * heap when pages aren't wanted or available) and only gives memory back
+ * in bulk: everything since a mark(), or everything at once. Destructors
+ * of objects placed in an arena never run, so keep it to plain data.
+ *
+ * An Arena isn't locked; use it from one core at a time. Its destructor
+ * releases everything, so give it automatic or heap storage rather than
+ * making it a global (global destructors are never registered here).
+ */
+class Arena {
+    struct Chunk {
+        Chunk* prev;
+        char* end;
+        bool fromPages;
+    };
+
+    Chunk* chunk;           // newest chunk, older ones hang off prev
+    char* top;              // next free byte in chunk
+    char* limit;            // end of chunk
+    size_t chunkBytes;
+    bool usePages;
+
+    void* grow(size_t bytes, size_t align);
+
+public:
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+
+    struct Mark {
+        Chunk* chunk;
+        char* top;
+    };
+
+    constexpr Arena(size_t chunkBytes = CHUNK_BYTES, bool usePages = true) :
+        chunk(nullptr), top(nullptr), limit(nullptr), chunkBytes(chunkBytes), usePages(usePages) {}
+    Arena(const Arena&) = delete;
+    ~Arena() {
+        reset();
+    }
+
+    // align must be a power of two
+    inline void* alloc(size_t bytes, size_t align = 16) {
+        uintptr_t p = ((uintptr_t) top + align - 1) & ~(uintptr_t) (align - 1);
+        if (chunk == nullptr || p + bytes > (uintptr_t) limit) {
+            return grow(bytes, align);
+        }
+        top = (char*) (p + bytes);
+        return (void*) p;
+    }
+
+    Mark mark() const {
+        return Mark{chunk, top};
+    }
+
+    // free everything allocated since m was taken
+    void release(Mark m);
+
+    void reset() {
+        release(Mark{nullptr, nullptr});
+    }
+
+    // everything allocated while a Scope is alive goes away with it
+    class Scope {
+        Arena& arena;
+        Mark m;
+    public:
+        inline Scope(Arena& arena) : arena(arena), m(arena.mark()) {}
+        Scope(const Scope&) = delete;
+        inline ~Scope() {
+            arena.release(m);
+        }
+    };
+};
+
+// new (arena) T(...), panics when out of memory like plain new
+extern void* operator new(size_t size, Arena& arena);
+extern void* operator new[](size_t size, Arena& arena);
+
+#endif
@@ -39,4 +39,11 @@
 #define SPSR_EL1h (5 << 0)
 #define SPSR_VALUE (SPSR_MASK_ALL | SPSR_EL1h)
 
+// ***************************************
+// CPACR_EL1, Architectural Feature Access Control Register (EL1)
+// ***************************************
+
+#define CPACR_FPEN_SHIFT 20
+#define CPACR_FPEN (3 << CPACR_FPEN_SHIFT)	// FP/SIMD without trapping; 0 traps EL1 too
+
 #endif
\ No newline at end of file
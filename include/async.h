@@ -0,0 +1,417 @@
+#ifndef _ASYNC_H_
+#define _ASYNC_H_
+
+#include "stdint.h"
+#include "coroutine.h"
+#include "atomic.h"
+#include "heap.h"
+#include "timer.h"
+#include "timeout.h"
+#include "utils.h"
+
+/*
+ * Stackless coroutines for I/O paths
+ *
+ * A function returning Async<T> is a coroutine: calling it only allocates
+ * its frame (from the heap, a few hundred bytes at most, instead of the
+ * stack a thread would need). It starts when it is awaited, with
+ * co_await, by another coroutine, whose result that is, or when it is
+ * handed to async_spawn, which queues it on a core's executor to run on
+ * its own.
+ *
+ * Every core has an executor: a ready queue of suspended coroutines that
+ * can go on, and a list of those waiting for a device. It only runs while
+ * a thread on the core is in async_run or async_run_until, which take
+ * coroutines off the queue and resume them one after another, each up to
+ * its next co_await that can't complete at once. A coroutine runs with
+ * preemption disabled, so it must not block (sleep, join, take a lock
+ * that sleeps); it awaits instead. When the queue is empty, the runner
+ * tests the device waiters, and yields if none is ready yet; when there
+ * are none, it sleeps until something is posted to the queue.
+ *
+ * What a coroutine can wait for:
+ *
+ *   async_until(f)       a device: f() true. None of the devices here has
+ *                        its interrupt wired up, so f is tested by the
+ *                        executor whenever it has nothing else to run,
+ *                        one busy loop for all of the waiters
+ *   async_sleep_until    a time, on the core's timeout wheel
+ *   async_on_core(n)     core n: the coroutine carries on there, posted
+ *                        to n's ready queue, which wakes its runner with
+ *                        an IPI if n is asleep
+ *   AsyncEvent::wait     set() from another core, a timeout or an IPI
+ *                        handler (smp_call_function)
+ *   co_await f()         another coroutine
+ *
+ * async_post and async_wake can be called from any core, in interrupt
+ * context too; the rest only from a thread.
+ */
+
+template <typename T = void>
+class Async;
+
+// One suspended coroutine, kept in whatever it is waiting on (the
+// awaiter, in its frame) until it is posted back to its core
+struct AsyncWait {
+    AsyncWait* next;
+    std::coroutine_handle<> h;
+    bool (*ready)(void* arg);       // async_until's test
+    void* arg;
+    uint32_t core;                  // whose executor resumes it
+};
+
+// Make w.h runnable on core w.core
+extern void async_post(AsyncWait& w);
+
+// Have this core's executor test w.ready(w.arg) whenever it is out of
+// other work, and post w once it holds
+extern void async_poll(AsyncWait& w);
+
+// Queue a to start on `core` (this one by default). False if a has no
+// frame (the heap was out of memory)
+extern bool async_spawn(Async<void>&& a, int32_t core = -1);
+
+// Run this core's executor until every coroutine spawned on it has
+// finished, wherever they went on to
+extern void async_run();
+
+// Run this core's executor until cond(arg), which is checked between
+// coroutines. Whoever makes cond true from outside a coroutine on this
+// core calls async_wake(core) after, in case the runner is asleep
+extern void async_run_until(bool (*cond)(void* arg), void* arg);
+
+template <typename Cond>
+inline void async_run_until(Cond cond) {
+    async_run_until([](void* c) { return (*(Cond*) c)(); }, &cond);
+}
+
+extern void async_wake(uint32_t core);
+
+namespace async_detail {
+
+// a spawned coroutine has finished; its frame is gone
+extern void finished(uint32_t home);
+
+struct PromiseBase {
+    std::coroutine_handle<> waiter;     // who awaits us, if anyone
+    int32_t home = -1;                  // spawned from there, -1 if awaited
+    uint8_t handoff = 0;                // first of us and the waiter to get here, see below
+    AsyncWait start{};                  // to queue it when spawned
+
+    static void* operator new(decltype(sizeof(0)) size) noexcept {
+        return malloc(size);
+    }
+
+    static void operator delete(void* p) {
+        free(p);
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    /*
+     * A coroutine that is awaited may finish before the await_suspend
+     * that started it has returned, if it never had to wait, or after,
+     * from the executor or another core. Whoever of the two gets to
+     * handoff second carries on with the waiter; this way that doesn't
+     * nest a resume on the stack per await (there is no guaranteed tail
+     * call without -O).
+     */
+    struct Final {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename P>
+        void await_suspend(std::coroutine_handle<P> h) noexcept {
+            PromiseBase& p = h.promise();
+            if (p.home >= 0) {
+                uint32_t home = p.home;
+                h.destroy();
+                finished(home);
+                return;
+            }
+            if (__atomic_exchange_n(&p.handoff, 1, __ATOMIC_ACQ_REL) != 0) p.waiter.resume();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    Final final_suspend() noexcept {
+        return {};
+    }
+
+    // -fno-exceptions
+    void unhandled_exception() {}
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    T value{};
+
+    Async<T> get_return_object();
+
+    static Async<T> get_return_object_on_allocation_failure() {
+        return Async<T>();
+    }
+
+    void return_value(T v) {
+        value = v;
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Async<void> get_return_object();
+
+    static Async<void> get_return_object_on_allocation_failure();
+
+    void return_void() {}
+};
+
+}
+
+/*
+ * The result of a coroutine, owning its frame until it has been awaited
+ * or spawned. One that couldn't get a frame is empty; awaiting it gives
+ * T{} straight away.
+ */
+template <typename T>
+class Async {
+public:
+    using promise_type = async_detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Async() = default;
+
+    explicit Async(Handle h) : h(h) {}
+
+    Async(Async&& other) : h(other.h) {
+        other.h = Handle();
+    }
+
+    Async(const Async&) = delete;
+    Async& operator=(const Async&) = delete;
+
+    ~Async() {
+        if (h) h.destroy();
+    }
+
+    bool valid() const {
+        return (bool) h;
+    }
+
+    // for async_spawn
+    Handle release() {
+        Handle r = h;
+        h = Handle();
+        return r;
+    }
+
+    bool await_ready() {
+        return !h;
+    }
+
+    bool await_suspend(std::coroutine_handle<> waiter) {
+        promise_type& p = h.promise();
+        p.waiter = waiter;
+        h.resume();
+        // done already, so the waiter carries on without suspending
+        return __atomic_exchange_n(&p.handoff, 1, __ATOMIC_ACQ_REL) == 0;
+    }
+
+    T await_resume() {
+        if constexpr (__is_same(T, void)) {
+            return;
+        } else {
+            return h ? h.promise().value : T{};
+        }
+    }
+
+private:
+    Handle h;
+};
+
+template <typename T>
+inline Async<T> async_detail::Promise<T>::get_return_object() {
+    return Async<T>(Async<T>::Handle::from_promise(*this));
+}
+
+inline Async<void> async_detail::Promise<void>::get_return_object() {
+    return Async<void>(Async<void>::Handle::from_promise(*this));
+}
+
+inline Async<void> async_detail::Promise<void>::get_return_object_on_allocation_failure() {
+    return Async<void>();
+}
+
+/* What to co_await */
+
+template <typename F>
+class AsyncUntil {
+    F f;
+    AsyncWait w;
+
+    static bool test(void* self) {
+        return ((AsyncUntil*) self)->f();
+    }
+
+public:
+    explicit AsyncUntil(F f) : f(f), w() {}
+
+    bool await_ready() {
+        return f();
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        w.h = h;
+        w.ready = test;
+        w.arg = this;
+        async_poll(w);
+    }
+
+    void await_resume() {}
+};
+
+template <typename F>
+inline AsyncUntil<F> async_until(F f) {
+    return AsyncUntil<F>(f);
+}
+
+class AsyncSleep {
+    uint64_t when;
+    Timeout to;
+    AsyncWait w;
+
+    static void fire(void* self) {
+        async_post(((AsyncSleep*) self)->w);
+    }
+
+public:
+    explicit AsyncSleep(uint64_t when) : when(when), to(), w() {}
+
+    ~AsyncSleep() {
+        // only if the coroutine is destroyed while it sleeps
+        if (timeout_pending(to)) timeout_cancel(to);
+    }
+
+    bool await_ready() {
+        return timer_now() >= when;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        w.h = h;
+        w.core = getCoreID();
+        timeout_init(to, fire, this);
+        timeout_add(to, when);
+    }
+
+    void await_resume() {}
+};
+
+inline AsyncSleep async_sleep_until(uint64_t when) {
+    return AsyncSleep(when);
+}
+
+inline AsyncSleep async_sleep_us(uint64_t us) {
+    return AsyncSleep(timer_now() + timer_us(us));
+}
+
+class AsyncHop {
+    AsyncWait w;
+
+public:
+    explicit AsyncHop(uint32_t core) : w() {
+        w.core = core;
+    }
+
+    bool await_ready() {
+        return w.core == getCoreID();
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        w.h = h;
+        async_post(w);
+    }
+
+    void await_resume() {}
+};
+
+inline AsyncHop async_on_core(uint32_t core) {
+    return AsyncHop(core);
+}
+
+// Set once, wakes every coroutine waiting for it, each on its own core;
+// reset() to use it again
+class AsyncEvent {
+    RawSpinLock lock;
+    AsyncWait* waiters;
+    volatile bool isSet;
+
+    bool enqueue(AsyncWait& w);
+
+public:
+    constexpr AsyncEvent() : lock(), waiters(nullptr), isSet(false) {}
+    AsyncEvent(const AsyncEvent&) = delete;
+
+    void set();
+
+    void reset() {
+        isSet = false;
+    }
+
+    bool is_set() const {
+        return isSet;
+    }
+
+    class Wait {
+        AsyncEvent& e;
+        AsyncWait w;
+
+    public:
+        explicit Wait(AsyncEvent& e) : e(e), w() {}
+
+        bool await_ready() {
+            return e.is_set();
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            w.h = h;
+            w.core = getCoreID();
+            return e.enqueue(w);
+        }
+
+        void await_resume() {}
+    };
+
+    Wait wait() {
+        return Wait(*this);
+    }
+};
+
+/* Devices */
+
+// Write n bytes to the UART, waiting for room in its transmit FIFO
+extern Async<void> uart_write_async(const char* s, uint32_t n);
+
+// Send a property message (mailbox channel 8) and wait for the answer.
+// msg is the whole message, 16-byte aligned, size in msg[0]; true if the
+// firmware answered it. One at a time, with mailbox_tag_message too: the
+// calls take turns at mailbox_claim
+extern Async<bool> mailbox_call_async(uint32_t* msg);
+
+struct AsyncStats {
+    uint64_t spawned;       // onto this core
+    uint64_t finished;      // of those
+    uint64_t resumes;       // coroutines resumed here
+    uint64_t posted;        // to here from another core
+    uint64_t polls;         // device tests
+    uint64_t sleeps;        // times the runner slept with nothing to do
+};
+
+// approximate while the core is running
+extern void async_stats(uint32_t core, AsyncStats& st);
+extern void async_stats_print();
+
+#endif
@@ -4,7 +4,41 @@
 #include "utils.h"
 #include "printf.h"
 #include "loop.h"
+#include "lockprof.h"
+#include "sched.h"
 
+/*
+ * Memory orders for the Atomic operations. Everything defaults to
+ * MO_SEQ_CST; ask for a weaker order where the code only needs it, e.g.
+ * counter.fetch_add<MO_RELAXED>(1). The order is a template argument
+ * because GCC quietly treats a memory order that isn't a compile-time
+ * constant as seq_cst, and we build without optimization.
+ *
+ *   MO_RELAXED  atomicity only, for counters and statistics
+ *   MO_ACQUIRE  on a load (or the load half of an RMW) that takes
+ *               ownership: later accesses can't move above it
+ *   MO_RELEASE  on a store (or store half) that hands ownership over:
+ *               earlier accesses can't move below it
+ *   MO_ACQ_REL  both, for RMWs like a barrier arrival
+ *
+ * On the A53 a relaxed RMW is a plain LDXR/STXR loop, acquire/release use
+ * LDAXR/STLXR (or LDAR/STLR), and seq_cst adds nothing on top of those
+ * for loads and stores. -mno-outline-atomics keeps them all inline.
+ */
+enum MemoryOrder {
+    MO_RELAXED = __ATOMIC_RELAXED,
+    MO_ACQUIRE = __ATOMIC_ACQUIRE,
+    MO_RELEASE = __ATOMIC_RELEASE,
+    MO_ACQ_REL = __ATOMIC_ACQ_REL,
+    MO_SEQ_CST = __ATOMIC_SEQ_CST,
+};
+
+// the strongest order a failed compare_exchange may use
+constexpr MemoryOrder failureOrder(MemoryOrder mo) {
+    return mo == MO_ACQ_REL ? MO_ACQUIRE : (mo == MO_RELEASE ? MO_RELAXED : mo);
+}
+
+// Atomic operations on a T that lives somewhere else
 template <typename T>
 class AtomicPtr {
     volatile T *ptr;
@@ -18,30 +52,56 @@ public:
     operator T () const {
         return __atomic_load_n(ptr,__ATOMIC_SEQ_CST);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     T fetch_add(T inc) {
-        return __atomic_fetch_add(ptr,inc,__ATOMIC_SEQ_CST);
+        return __atomic_fetch_add(ptr,inc,mo);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     T add_fetch(T inc) {
-        return __atomic_add_fetch(ptr,inc,__ATOMIC_SEQ_CST);
+        return __atomic_add_fetch(ptr,inc,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T fetch_sub(T dec) {
+        return __atomic_fetch_sub(ptr,dec,mo);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T fetch_or(T bits) {
+        return __atomic_fetch_or(ptr,bits,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T fetch_and(T bits) {
+        return __atomic_fetch_and(ptr,bits,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
     void set(T inc) {
-        return __atomic_store_n(ptr,inc,__ATOMIC_SEQ_CST);
+        return __atomic_store_n(ptr,inc,mo);
     }
-    T get(void) {
-        return __atomic_load_n(ptr,__ATOMIC_SEQ_CST);
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T get() {
+        return __atomic_load_n(ptr,mo);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     T exchange(T v) {
         T ret;
-        __atomic_exchange(ptr,&v,&ret,__ATOMIC_SEQ_CST);
+        __atomic_exchange(ptr,&v,&ret,mo);
         return ret;
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    bool compare_exchange(T& expected, T desired) {
+        return __atomic_compare_exchange_n(ptr,&expected,desired,false,mo,failureOrder(mo));
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    bool compare_exchange_weak(T& expected, T desired) {
+        return __atomic_compare_exchange_n(ptr,&expected,desired,true,mo,failureOrder(mo));
+    }
 };
 
 template <typename T>
 class Atomic {
+    static_assert(__atomic_always_lock_free(sizeof(T), 0), "no lock-free atomics for this size");
     volatile T value;
 public:
-    Atomic(T x) : value(x) {}
+    constexpr Atomic(T x) : value(x) {}
     Atomic<T>& operator= (T v) {
         __atomic_store_n(&value,v,__ATOMIC_SEQ_CST);
         return *this;
@@ -49,48 +109,89 @@ public:
     operator T () const {
         return __atomic_load_n(&value,__ATOMIC_SEQ_CST);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     T fetch_add(T inc) {
-        return __atomic_fetch_add(&value,inc,__ATOMIC_SEQ_CST);
+        return __atomic_fetch_add(&value,inc,mo);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     T add_fetch(T inc) {
-        return __atomic_add_fetch(&value,inc,__ATOMIC_SEQ_CST);
+        return __atomic_add_fetch(&value,inc,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T fetch_sub(T dec) {
+        return __atomic_fetch_sub(&value,dec,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T sub_fetch(T dec) {
+        return __atomic_sub_fetch(&value,dec,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T fetch_or(T bits) {
+        return __atomic_fetch_or(&value,bits,mo);
+    }
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T fetch_and(T bits) {
+        return __atomic_fetch_and(&value,bits,mo);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     void set(T inc) {
-        return __atomic_store_n(&value,inc,__ATOMIC_SEQ_CST);
+        return __atomic_store_n(&value,inc,mo);
     }
-    T get(void) {
-        return __atomic_load_n(&value,__ATOMIC_SEQ_CST);
+    template <MemoryOrder mo = MO_SEQ_CST>
+    T get() {
+        return __atomic_load_n(&value,mo);
     }
+    template <MemoryOrder mo = MO_SEQ_CST>
     T exchange(T v) {
         T ret;
-        // printf_no_lock("thing\n");
-        __atomic_exchange(&value,&v,&ret,__ATOMIC_SEQ_CST);
+        __atomic_exchange(&value,&v,&ret,mo);
         return ret;
     }
+    // on failure `expected` is updated to the current value
+    template <MemoryOrder mo = MO_SEQ_CST>
+    bool compare_exchange(T& expected, T desired) {
+        return __atomic_compare_exchange_n(&value,&expected,desired,false,mo,failureOrder(mo));
+    }
+    // may fail spuriously, for use in a retry loop
+    template <MemoryOrder mo = MO_SEQ_CST>
+    bool compare_exchange_weak(T& expected, T desired) {
+        return __atomic_compare_exchange_n(&value,&expected,desired,true,mo,failureOrder(mo));
+    }
     void monitor_value() {
         monitor(reinterpret_cast<uintptr_t>(&value));
     }
-};
-
-template <>
-class Atomic<uint64_t> {
-public:
-    Atomic() = delete;
-    Atomic(uint64_t) = delete;
-};
-
-template <>
-class Atomic<int64_t> {
-public:
-    Atomic() = delete;
-    Atomic(int64_t) = delete;
+    // Wait in WFE until the value is no longer `old` and return it. The
+    // exclusive load arms the monitor, so the store that changes the value
+    // is also the event that wakes us. Needs the MMU on, like all the
+    // exclusives. Has acquire semantics.
+    T wait_while(T old) {
+        T v;
+        while ((v = load_exclusive()) == old) {
+            asm volatile("wfe" ::: "memory");
+        }
+        return v;
+    }
+private:
+    T load_exclusive() {
+        uint64_t v;
+        if constexpr (sizeof(T) == 1) {
+            asm volatile("ldaxrb %w0, [%1]" : "=r"(v) : "r"(&value) : "memory");
+        } else if constexpr (sizeof(T) == 2) {
+            asm volatile("ldaxrh %w0, [%1]" : "=r"(v) : "r"(&value) : "memory");
+        } else if constexpr (sizeof(T) == 4) {
+            asm volatile("ldaxr %w0, [%1]" : "=r"(v) : "r"(&value) : "memory");
+        } else {
+            asm volatile("ldaxr %0, [%1]" : "=r"(v) : "r"(&value) : "memory");
+        }
+        return (T) v;
+    }
 };
 
 template <typename T>
 class LockGuard {
     T& it;
 public:
-    inline LockGuard(T& it): it(it) {
+    LOCK_GUARD_INLINE inline LockGuard(T& it): it(it) {
         it.lock();
     }
     inline ~LockGuard() {
@@ -102,7 +203,7 @@ template <typename T>
 class LockGuardP {
     T* it;
 public:
-    inline LockGuardP(T* it): it(it) {
+    LOCK_GUARD_INLINE inline LockGuardP(T* it): it(it) {
         if (it) it->lock();
     }
     inline ~LockGuardP() {
@@ -110,10 +211,36 @@ public:
     }
 };
 
+// LockGuard for the read side of an RWSpinLock
+template <typename T>
+class ReadGuard {
+    T& it;
+public:
+    LOCK_GUARD_INLINE inline ReadGuard(T& it): it(it) {
+        it.lock_shared();
+    }
+    inline ~ReadGuard() {
+        it.unlock_shared();
+    }
+};
+
+/*
+ * The locks below all keep the holder from being preempted (see sched.h),
+ * so a task never gets switched out with a lock that the next task on its
+ * core might spin on.
+ */
 class SpinLock {
     Atomic<bool> taken;
+#ifdef LOCK_PROFILE
+    LockProfile prof;
+#endif
 public:
-    SpinLock() : taken(false) {}
+    // the name is only kept with LOCK_PROFILE, see lockprof.h
+    constexpr SpinLock([[maybe_unused]] const char* name = nullptr) : taken(false)
+#ifdef LOCK_PROFILE
+        , prof(name)
+#endif
+    {}
 
     SpinLock(const SpinLock&) = delete;
 
@@ -122,31 +249,280 @@ public:
         return taken.get();
     }
 
-    void lock(void) {
+    LOCK_PROFILED void lock(void) {
+        LOCK_PROFILE_START();
+        preempt_disable();
         taken.monitor_value();
-        while (taken.exchange(true)) {
+        while (taken.exchange<MO_ACQUIRE>(true)) {
+            LOCK_PROFILE_CONTENDED();
             iAmStuckInALoop(true);
             taken.monitor_value();
         }
+        LOCK_PROFILE_ACQUIRED(prof);
     }
     
     void unlock(void) {
-        taken.set(false);
+        LOCK_PROFILE_RELEASE(prof);
+        taken.set<MO_RELEASE>(false);
+        preempt_enable();
+    }
+
+#ifdef LOCK_PROFILE
+    const LockProfile& profile() {
+        return prof;
+    }
+#endif
+};
+
+// SpinLock without the preemption and profiling hooks, for the scheduler,
+// which takes its locks with IRQs masked and preemption already off
+class RawSpinLock {
+    Atomic<bool> taken;
+public:
+    constexpr RawSpinLock() : taken(false) {}
+    RawSpinLock(const RawSpinLock&) = delete;
+
+    void lock() {
+        while (taken.exchange<MO_ACQUIRE>(true)) {
+            taken.wait_while(true);
+        }
+    }
+
+    void unlock() {
+        taken.set<MO_RELEASE>(false);
     }
 };
 
+/*
+ * Reader-writer spin lock. Any number of readers or one writer. A writer
+ * first claims WRITER, which keeps new readers out, then waits for the
+ * readers already inside to leave, so a steady stream of readers can't
+ * starve it. lock()/unlock() are the write side, so LockGuard works;
+ * ReadGuard takes the read side.
+ */
+class RWSpinLock {
+    static constexpr uint32_t WRITER = 1u << 31;
+    Atomic<uint32_t> state;     // WRITER | number of readers
+public:
+    constexpr RWSpinLock() : state(0) {}
+    RWSpinLock(const RWSpinLock&) = delete;
+
+    void lock_shared() {
+        preempt_disable();
+        while (true) {
+            uint32_t s = state.get<MO_RELAXED>();
+            if ((s & WRITER) == 0) {
+                if (state.compare_exchange_weak<MO_ACQUIRE>(s, s + 1)) return;
+            } else {
+                state.wait_while(s);
+            }
+        }
+    }
+
+    void unlock_shared() {
+        state.fetch_sub<MO_RELEASE>(1);
+        preempt_enable();
+    }
+
+    void lock() {
+        preempt_disable();
+        while (true) {
+            uint32_t s = state.get<MO_RELAXED>();
+            if ((s & WRITER) == 0) {
+                if (state.compare_exchange_weak<MO_ACQUIRE>(s, s | WRITER)) break;
+            } else {
+                state.wait_while(s);
+            }
+        }
+        uint32_t s;
+        while ((s = state.get<MO_ACQUIRE>()) != WRITER) {
+            state.wait_while(s);
+        }
+    }
+
+    // readers can't get in while WRITER is set, so nothing else changed
+    void unlock() {
+        state.set<MO_RELEASE>(0);
+        preempt_enable();
+    }
+};
+
+/*
+ * Sequence lock. Writers bump the sequence to odd, write, and bump it back
+ * to even; readers take no lock at all, they read the sequence, copy the
+ * data and retry if a writer was in there meanwhile. Good for small data
+ * that is read far more often than written. Readers can see torn data
+ * before read_retry() says so, so they should only copy, not follow
+ * pointers.
+ *
+ *     uint32_t s;
+ *     do {
+ *         s = lock.read_begin();
+ *         copy = data;
+ *     } while (lock.read_retry(s));
+ *
+ * lock()/unlock() are the write side, so LockGuard works.
+ */
+class SeqLock {
+    Atomic<uint32_t> seq;
+public:
+    constexpr SeqLock() : seq(0) {}
+    SeqLock(const SeqLock&) = delete;
+
+    uint32_t read_begin() {
+        uint32_t s = seq.get<MO_ACQUIRE>();
+        while (s & 1) {
+            s = seq.wait_while(s);
+        }
+        return s;
+    }
+
+    bool read_retry(uint32_t s) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);   // data reads before the re-check
+        return seq.get<MO_RELAXED>() != s;
+    }
+
+    template <typename Work>
+    void read(Work work) {
+        uint32_t s;
+        do {
+            s = read_begin();
+            work();
+        } while (read_retry(s));
+    }
+
+    void lock() {
+        preempt_disable();
+        while (true) {
+            uint32_t s = seq.get<MO_RELAXED>();
+            if ((s & 1) == 0) {
+                if (seq.compare_exchange_weak<MO_ACQUIRE>(s, s + 1)) break;
+            } else {
+                seq.wait_while(s);
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_RELEASE);   // odd sequence before the data writes
+    }
+
+    void unlock() {
+        seq.set<MO_RELEASE>(seq.get<MO_RELAXED>() + 1);
+        preempt_enable();
+    }
+};
+
+// One-shot: counts down once and can't be reused, see SenseBarrier
 class Barrier {
     Atomic<uint32_t> counter;
 public:
     Barrier(uint32_t counter): counter(counter) {}
+    Barrier(): counter(0) {}
     Barrier(const Barrier&) = delete;
 
+    // for a default constructed (e.g. pooled) Barrier, before anyone syncs
+    void arm(uint32_t n) {
+        counter.set<MO_RELEASE>(n);
+    }
+
     void sync() {
-        counter.add_fetch(-1);
-	while (counter.get() != 0) {
+        counter.add_fetch<MO_ACQ_REL>(-1);
+        while (counter.get<MO_ACQUIRE>() != 0) {
             iAmStuckInALoop(false);
         }
     }
 };
 
+/*
+ * Reusable barrier for any `count` cores. Arrivals count down `remaining`;
+ * the last one re-arms it and then bumps `generation`, whose low bit is
+ * the sense the others are waiting to see flip. Because the waiters only
+ * compare against the generation they arrived in, nobody needs per-core
+ * state, so any subset of the cores can use it and the same core can come
+ * back for the next phase straight away. Waiters sleep in WFE; the store
+ * to `generation` clears their exclusive monitors, which is the event
+ * that wakes them, so no explicit SEV is needed.
+ */
+class SenseBarrier {
+    Atomic<uint32_t> remaining;
+    Atomic<uint32_t> generation;
+    uint32_t count;
+public:
+    constexpr SenseBarrier(uint32_t count) : remaining(count), generation(0), count(count) {}
+    SenseBarrier(const SenseBarrier&) = delete;
+
+    void sync() {
+        uint32_t gen = generation.get<MO_ACQUIRE>();
+        if (remaining.sub_fetch<MO_ACQ_REL>(1) == 0) {
+            remaining.set<MO_RELAXED>(count);
+            generation.set<MO_RELEASE>(gen + 1);
+            return;
+        }
+        while (generation.get<MO_ACQUIRE>() == gen) {
+            generation.wait_while(gen);
+        }
+    }
+};
+
+/*
+ * Combining-tree barrier for the cores in `mask`. Participants pair up at
+ * leaf nodes, each on its own cache line; the last arrival at a node
+ * carries on to the root and the last arrival at the root releases
+ * everyone through `generation`, as in SenseBarrier. With four cores at
+ * most two arrivals ever touch the same counter, instead of all of them
+ * queueing on one line.
+ */
+class TreeBarrier {
+    struct alignas(64) Node {
+        Atomic<uint32_t> arrived;
+        uint32_t fanin;
+        constexpr Node(uint32_t fanin) : arrived(0), fanin(fanin) {}
+    };
+
+    // participants at leaf `leaf`, 0 if there is no such leaf
+    static constexpr uint32_t leafFanin(uint32_t n, uint32_t leaf) {
+        return (2 * leaf >= n) ? 0 : ((n - 2 * leaf >= 2) ? 2 : 1);
+    }
+
+    static constexpr uint32_t bits(uint32_t mask) {
+        return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+    }
+
+    Node leaf0;
+    Node leaf1;
+    Node root;
+    Atomic<uint32_t> generation;
+    uint32_t mask;
+    uint32_t nLeaves;
+
+    // true if this arrival was the last one at the node (which is then reset)
+    static bool arrive(Node& node) {
+        if (node.arrived.add_fetch<MO_ACQ_REL>(1) < node.fanin) return false;
+        node.arrived.set<MO_RELAXED>(0);
+        return true;
+    }
+
+public:
+    constexpr TreeBarrier(uint32_t mask = 0xf)
+        : leaf0(leafFanin(bits(mask), 0)), leaf1(leafFanin(bits(mask), 1)),
+          root(bits(mask) > 2 ? 2 : 1), generation(0), mask(mask),
+          nLeaves(bits(mask) > 2 ? 2 : 1) {}
+    TreeBarrier(const TreeBarrier&) = delete;
+
+    // must be called from one of the cores in the mask
+    void sync() {
+        uint32_t core = getCoreID();
+        uint32_t rank = bits(mask & ((1u << core) - 1));
+        uint32_t gen = generation.get<MO_ACQUIRE>();
+
+        bool last = arrive(rank < 2 ? leaf0 : leaf1);
+        if (last && nLeaves > 1) last = arrive(root);
+        if (last) {
+            generation.set<MO_RELEASE>(gen + 1);
+            return;
+        }
+        while (generation.get<MO_ACQUIRE>() == gen) {
+            generation.wait_while(gen);
+        }
+    }
+};
+
 #endif
@@ -0,0 +1,94 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "stdint.h"
+#include "printf.h"
+#include "atomic.h"
+#include "heap.h"
+
+// Benchmark helpers for the tests/ images.
+//
+// Results go out over the UART as single lines starting with "@bench".
+// `make test` drops those lines before diffing against tests/*.ok and
+// collects them in tests/*.bench instead, so timings never break a test.
+
+// Virtual counter, ticks at CNTFRQ_EL0 Hz on every core
+inline uint64_t bench_ticks() {
+    uint64_t t;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(t) :: "memory");
+    return t;
+}
+
+inline uint64_t bench_freq() {
+    uint64_t f;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+}
+
+// @bench <test> <case> cores=<n> ops=<n> ticks=<n>
+inline void bench_report(const char* test, const char* what, uint32_t cores, uint64_t ops, uint64_t ticks) {
+    printf("@bench %s %s cores=%d ops=%u ticks=%u\n", test, what, cores, (uint32_t) ops, (uint32_t) ticks);
+}
+
+// @bench <test> <case> <key>=<value>, for results that aren't a rate
+inline void bench_metric(const char* test, const char* what, const char* key, uint64_t value) {
+    printf("@bench %s %s %s=%u\n", test, what, key, (uint32_t) value);
+}
+
+// Small LCG so a workload makes the same requests every run. Give each
+// core its own, seeded differently.
+class BenchRng {
+    uint32_t seed;
+public:
+    constexpr BenchRng(uint32_t seed) : seed(seed) {}
+
+    uint32_t next() {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 8;
+    }
+
+    // uniform in [lo, hi]
+    uint32_t range(uint32_t lo, uint32_t hi) {
+        return lo + next() % (hi - lo + 1);
+    }
+
+    // log-uniform: a power of two from 2^lo to 2^hi, plus up to that much again
+    size_t logRange(uint32_t lo, uint32_t hi) {
+        uint32_t shift = range(lo, hi);
+        return (size_t(1) << shift) + next() % (1u << shift);
+    }
+};
+
+// A malloc'd block tagged in its first and last byte so a workload can
+// tell when the heap hands out overlapping memory.
+struct BenchBlock {
+    uint8_t* p;
+    size_t bytes;
+
+    bool fill(size_t n) {
+        bytes = n;
+        p = (uint8_t*) malloc(n);
+        if (p == nullptr) return false;
+        p[0] = uint8_t(n);
+        p[n - 1] = uint8_t(n);
+        return true;
+    }
+
+    // frees the block, false if its tags were overwritten
+    bool release() {
+        if (p == nullptr) return true;
+        bool ok = p[0] == uint8_t(bytes) && p[bytes - 1] == uint8_t(bytes);
+        free(p);
+        p = nullptr;
+        return ok;
+    }
+};
+
+// All-core rendezvous for the benchmark phases. Every core in kernelMain
+// must call sync() the same number of times.
+class BenchSync : public SenseBarrier {
+public:
+    constexpr BenchSync() : SenseBarrier(4) {}
+};
+
+#endif
@@ -9,7 +9,7 @@ extern "C" {
 void wake_up_cores();
 
 // this is to enable and disable the use of atomic operations in things like printf and malloc
-static bool coresAwoken = false;
+extern bool coresAwoken;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,89 @@
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+/*
+ * What g++ -fcoroutines needs from <coroutine>, which a freestanding
+ * build doesn't have: the compiler looks these up by name in std and
+ * lowers co_await and co_return onto the __builtin_coro_* calls below.
+ * Only the parts async.h uses; no noop_coroutine, no hashing.
+ */
+
+namespace std {
+
+template <typename R, typename... Args>
+struct coroutine_traits {
+    using promise_type = typename R::promise_type;
+};
+
+template <typename P = void>
+struct coroutine_handle;
+
+template <>
+struct coroutine_handle<void> {
+    void* frame = nullptr;
+
+    constexpr coroutine_handle() = default;
+
+    static coroutine_handle from_address(void* p) {
+        coroutine_handle h;
+        h.frame = p;
+        return h;
+    }
+
+    void* address() const {
+        return frame;
+    }
+
+    explicit operator bool() const {
+        return frame != nullptr;
+    }
+
+    bool done() const {
+        return __builtin_coro_done(frame);
+    }
+
+    void resume() const {
+        __builtin_coro_resume(frame);
+    }
+
+    void operator()() const {
+        resume();
+    }
+
+    void destroy() const {
+        __builtin_coro_destroy(frame);
+    }
+};
+
+template <typename P>
+struct coroutine_handle : coroutine_handle<> {
+    static coroutine_handle from_address(void* p) {
+        coroutine_handle h;
+        h.frame = p;
+        return h;
+    }
+
+    static coroutine_handle from_promise(P& p) {
+        return from_address(__builtin_coro_promise((char*) &p, __alignof(P), true));
+    }
+
+    P& promise() const {
+        return *(P*) __builtin_coro_promise(frame, __alignof(P), false);
+    }
+};
+
+struct suspend_always {
+    constexpr bool await_ready() const noexcept { return false; }
+    constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+    constexpr void await_resume() const noexcept {}
+};
+
+struct suspend_never {
+    constexpr bool await_ready() const noexcept { return true; }
+    constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+    constexpr void await_resume() const noexcept {}
+};
+
+}
+
+#endif
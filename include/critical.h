@@ -11,7 +11,7 @@ extern Atomic<uint32_t> critical_owner;
 extern SpinLock critical_section_lock;
 
 template <typename Work>
-inline void critical(Work work) {
+LOCK_GUARD_INLINE inline void critical(Work work) {
     // uint32_t cpu_id = getCoreID();
     // if (critical_owner == cpu_id) {
     //     critical_depth.fetch_add(1);
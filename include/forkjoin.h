@@ -0,0 +1,153 @@
+#ifndef _FORKJOIN_H_
+#define _FORKJOIN_H_
+
+#include "stdint.h"
+#include "atomic.h"
+
+/*
+ * Fork/join tasks with work stealing
+ *
+ * All four cores call fj_run(cores, root) together, the way they call
+ * BenchSync::sync(). Core 0 runs root(); cores 1 .. cores-1 steal the
+ * tasks it (and they) spawn until root() returns, and the rest just wait
+ * for the end. So fj_run(1, ...) is the sequential baseline for the same
+ * code.
+ *
+ * A task is spawned into a TaskGroup and sync() waits for every task
+ * spawned into the group. Spawning pushes onto this core's Chase-Lev
+ * deque (ring.h), with no locks. Other cores steal the oldest tasks, which
+ * are the biggest pieces of a divide-and-conquer split. While sync()
+ * waits it runs tasks itself: its own newest first, then stolen ones. A
+ * core with nothing to run sleeps in WFE, and a spawn wakes it with SEV,
+ * but only if someone is asleep.
+ *
+ * Tasks live in the spawner's stack frame, so spawn and sync in the same
+ * frame. ~TaskGroup syncs in case you forget:
+ *
+ *     TaskGroup g;
+ *     auto left = fj_job([&] { sort(a, mid); });
+ *     g.spawn(left);
+ *     sort(a + mid, n - mid);
+ *     g.sync();
+ *
+ * parallel_for and parallel_reduce below split a range in halves that
+ * way. Tasks run in whatever task context the core is in, with
+ * preemption enabled; they must not sleep or yield.
+ */
+
+class TaskGroup;
+
+struct FjTask {
+    void (*run)(FjTask* self);
+    TaskGroup* group;
+};
+
+template <typename F>
+struct FjJob : FjTask {
+    F body;
+    FjJob(F body) : FjTask{call, nullptr}, body(body) {}
+    static void call(FjTask* self) {
+        static_cast<FjJob*>(self)->body();
+    }
+};
+
+// a task that calls body(), to spawn from this frame
+template <typename F>
+inline FjJob<F> fj_job(F body) {
+    return FjJob<F>(body);
+}
+
+// onto this core's deque, or run right away if it is full
+extern void fj_push(FjTask* task);
+
+// run tasks until g has none left
+extern void fj_wait(TaskGroup& g);
+
+class TaskGroup {
+    Atomic<uint32_t> pending;       // spawned and not finished yet
+public:
+    constexpr TaskGroup() : pending(0) {}
+    TaskGroup(const TaskGroup&) = delete;
+    ~TaskGroup() {
+        sync();
+    }
+
+    void spawn(FjTask& task) {
+        task.group = this;
+        pending.fetch_add<MO_RELAXED>(1);
+        fj_push(&task);
+    }
+
+    void sync() {
+        if (pending.get<MO_ACQUIRE>() != 0) fj_wait(*this);
+    }
+
+    // for the runtime
+    bool finished() {
+        return pending.get<MO_ACQUIRE>() == 0;
+    }
+    void finish() {
+        pending.sub_fetch<MO_RELEASE>(1);
+    }
+};
+
+// for fj_run: true on core 0, which then runs the root and calls fj_stop
+extern bool fj_start(uint32_t cores);
+extern void fj_stop();
+extern void fj_end();
+
+// called by every core, see above
+template <typename F>
+inline void fj_run(uint32_t cores, F root) {
+    if (fj_start(cores)) {
+        root();
+        fj_stop();
+    }
+    fj_end();
+}
+
+// body(begin, end) on disjoint pieces of [lo, hi), each at most `grain` long
+template <typename Body>
+void parallel_for(int64_t lo, int64_t hi, int64_t grain, const Body& body) {
+    if (hi - lo <= grain || grain < 1) {
+        if (hi > lo) body(lo, hi);
+        return;
+    }
+    int64_t mid = lo + (hi - lo) / 2;
+    TaskGroup g;
+    auto right = fj_job([&] { parallel_for(mid, hi, grain, body); });
+    g.spawn(right);
+    parallel_for(lo, mid, grain, body);
+    g.sync();
+}
+
+// combine() of map(begin, end) over pieces of [lo, hi) as in parallel_for;
+// combine must be associative, identity is the result for an empty range
+template <typename T, typename Map, typename Combine>
+T parallel_reduce(int64_t lo, int64_t hi, int64_t grain, T identity, const Map& map, const Combine& combine) {
+    if (hi <= lo) return identity;
+    if (hi - lo <= grain || grain < 1) return map(lo, hi);
+    int64_t mid = lo + (hi - lo) / 2;
+    T right = identity;
+    TaskGroup g;
+    auto job = fj_job([&] { right = parallel_reduce(mid, hi, grain, identity, map, combine); });
+    g.spawn(job);
+    T left = parallel_reduce(lo, mid, grain, identity, map, combine);
+    g.sync();
+    return combine(left, right);
+}
+
+struct FjStats {
+    uint64_t spawned;       // pushed onto this core's deque
+    uint64_t inlined;       // run at spawn because the deque was full
+    uint64_t executed;      // tasks run on this core, stolen ones included
+    uint64_t stolen;        // ... taken from other cores
+    uint64_t failedSteals;  // steal attempts that came back empty
+    uint64_t sleeps;        // times this core went into WFE for want of work
+};
+
+// approximate while the cores are busy
+extern void fj_stats(uint32_t core, FjStats& st);
+extern void fj_stats_print();
+
+#endif
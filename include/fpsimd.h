@@ -0,0 +1,71 @@
+#ifndef _FPSIMD_H_
+#define _FPSIMD_H_
+
+#include "stdint.h"
+#include "sched.h"
+
+/*
+ * Lazy FP/SIMD context switching
+ *
+ * The compiler uses the V registers wherever it likes (printf's varargs
+ * prologue, struct copies), so each task's FP state has to survive a
+ * switch, but most switches are between tasks that never touch it.
+ * Instead of saving 512 bytes of registers on every switch, each core
+ * has an FP owner: the task whose state is in the registers. The FP unit
+ * is only enabled (CPACR_EL1.FPEN) while the owner runs. Anyone else
+ * traps on their first FP instruction, and fpsimd_trap() saves the
+ * owner's registers into its task_struct, loads the new task's (zeros
+ * the first time) and makes it the owner. A task that never uses FP
+ * never pays for it, and one that runs alternately with non-FP tasks
+ * keeps its registers in place across the switches.
+ *
+ * IRQs: irq_entry only saves the caller-saved V registers when the FP
+ * unit is on, that is when they belong to the interrupted task. A
+ * handler that uses FP while it is off borrows the unit: the owner's
+ * state is saved, the core has no owner, and the unit goes back off on
+ * the way out. schedule() and what it calls must not use FP at all (no
+ * floating point, no struct copies), since they run in between.
+ *
+ * The owner is per core, and a task's state is either in its task_struct
+ * or in the registers of the core it is on. The scheduler keeps it that
+ * way when it moves tasks: a queued task whose registers are live where
+ * it is stays put (fpsimd_loaded), and one pushed away from the core it
+ * was just switched out on is flushed first (fpsimd_flush).
+ */
+
+// per core, from sched_init: current (the boot task) owns the registers
+extern void fpsimd_init();
+
+// schedule(), IRQs masked, just before switching to next
+extern void fpsimd_switch(task_struct* next);
+
+// the FP access trap (ESR_EL1.EC 0x07), IRQs masked
+extern void fpsimd_trap();
+
+// t is exiting on this core and won't need its registers again
+extern void fpsimd_release(task_struct* t);
+
+// t isn't running and is leaving this core: save its registers if they
+// are the ones loaded, IRQs masked
+extern void fpsimd_flush(task_struct* t);
+
+// t's registers are the ones loaded on core, racy unless t is queued
+// there and that queue is locked
+extern bool fpsimd_loaded(uint32_t core, task_struct* t);
+
+// cpu_context-like helpers in fpsimd.S; the FP unit must be on
+extern "C" void fpsimd_save(struct fpsimd_state* st);
+extern "C" void fpsimd_load(const struct fpsimd_state* st);
+
+struct FpStats {
+    uint64_t traps;         // FP access traps taken
+    uint64_t saves;         // register files written back to their owner
+    uint64_t restores;      // ... and loaded for a new owner
+    uint64_t borrows;       // traps in IRQ handlers
+};
+
+// approximate while the core is running
+extern void fpsimd_stats(uint32_t core, FpStats& st);
+extern void fpsimd_stats_print();
+
+#endif
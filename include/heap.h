@@ -7,5 +7,46 @@
 extern void heapInit(void* start, size_t bytes);
 extern "C" void* malloc(size_t size);
 extern "C" void free(void* p);
+// payload aligned to `align` (a power of two), e.g. CACHE_LINE; free() as usual
+extern "C" void* aligned_alloc(size_t align, size_t size);
+extern "C" void* memalign(size_t align, size_t size);
+
+// placement new, there's no <new>
+inline void* operator new(decltype(sizeof(0)), void* where) noexcept {
+    return where;
+}
+
+// what the compiler passes to operator new for alignas(> 16) types
+namespace std {
+    enum class align_val_t : decltype(sizeof(0)) {};
+}
+
+constexpr int HEAP_HIST_BUCKETS = 16;
+
+struct HeapStats {
+    size_t heapBytes;           // usable bytes between the sentinels
+    int64_t liveBytes;          // payload bytes malloc'd and not yet freed
+    size_t takenBytes;          // bytes off the free lists, magazines included
+    size_t peakBytes;           // high-water mark of takenBytes
+    size_t cachedBytes;         // payload bytes parked in per-core magazines
+    size_t remoteBytes;         // payload bytes freed on other cores, not yet reclaimed
+    size_t freeBytes;
+    size_t largestFree;
+    uint32_t freeBlocks;
+    uint32_t takenBlocks;
+    uint32_t freeHistogram[HEAP_HIST_BUCKETS];  // bucket b: 16 << b bytes and up
+    uint32_t mallocs;
+    uint32_t frees;
+    uint32_t failed;
+};
+
+// snapshot of the heap, walks every block so keep it off hot paths
+extern void heap_stats(HeapStats& stats);
+// heap_stats() through printf, with per-site counts if they're being tracked
+extern void heap_stats_print();
+// record malloc/new call sites (off by default)
+extern void heap_track_sites(bool on);
+// verify boundary tags on every block access (off by default)
+extern void heap_checks(bool on);
 
 #endif
@@ -0,0 +1,104 @@
+#ifndef _IPI_H_
+#define _IPI_H_
+
+#include "stdint.h"
+#include "utils.h"
+
+/*
+ * Inter-processor interrupts over the BCM2836 core mailboxes
+ *
+ * The local peripheral block at 0x40000000 gives every core four 32-bit
+ * mailboxes. Writing bits to a core's set register raises them, and the
+ * core clears them by writing the same bits to its clear register. Each
+ * core uses its mailbox 0, one bit per IpiKind, routed to its IRQ line,
+ * so a core sleeping in WFI is woken within microseconds of a send.
+ *
+ * ipiInit() runs on every core in kernel_init, after which IRQs are
+ * unmasked. Handlers (including smp_call_function callbacks) run in
+ * interrupt context on the target core, in the middle of whatever it was
+ * doing. They must not take a lock the interrupted code might hold (the
+ * printf lock, say), must not use the heap or a Pool, which assume
+ * nothing else runs on the core while they update its caches, and must
+ * not send synchronous calls themselves.
+ */
+
+enum IpiKind : uint32_t {
+    IPI_CALL = 0,           // run the queued smp_call_function requests
+    IPI_RESCHEDULE = 1,     // call the reschedule hook
+    IPI_TLB = 2,            // tlb_shootdown doorbell
+    IPI_WAKE = 3,           // nothing to do, just leave WFI
+    IPI_KINDS
+};
+
+typedef void (*IpiFunc)(void* arg);
+
+// per core, with the MMU on: route mailbox 0 to IRQ and unmask IRQs
+extern void ipiInit();
+
+// raise `kind` on every core in `mask` (bit n = core n)
+extern void ipi_send_mask(uint32_t mask, IpiKind kind);
+
+inline void ipi_send(uint32_t core, IpiKind kind) {
+    ipi_send_mask(1u << core, kind);
+}
+
+// Run func(arg) on `core`. With wait, return once it has run there;
+// without, as soon as it is queued (arg must outlive the call). On the
+// calling core it runs directly.
+extern void smp_call_function_single(uint32_t core, IpiFunc func, void* arg, bool wait);
+
+// smp_call_function_single on every core in `mask` except the caller
+extern void smp_call_function_mask(uint32_t mask, IpiFunc func, void* arg, bool wait);
+
+// ... on every other core
+inline void smp_call_function(IpiFunc func, void* arg, bool wait) {
+    smp_call_function_mask(0xf, func, arg, wait);
+}
+
+// The scheduler installs this; it runs on a core that gets IPI_RESCHEDULE
+extern void ipi_set_reschedule_hook(void (*hook)());
+
+inline void smp_send_reschedule(uint32_t core) {
+    ipi_send(core, IPI_RESCHEDULE);
+}
+
+// Invalidate this core's TLB entries for `va` (all of them for TLB_ALL)
+// and have every other core in `mask` do the same, returning once they
+// have. The inner-shareable TLBIs already broadcast in hardware; this is
+// for maintenance only a local TLBI does, and for callers that must know
+// every core has let go of the old translation (before reusing a table).
+constexpr uint64_t TLB_ALL = ~0ull;
+extern void tlb_shootdown(uint32_t mask, uint64_t va);
+
+// One WFI. Returns after the next interrupt has been handled.
+inline void cpu_idle() {
+    asm volatile("wfi" ::: "memory");
+}
+
+// Sleep in WFI until cond() holds. IRQs are masked between the check and
+// the WFI, so an IPI that makes cond() true can't slip in between and
+// leave us asleep; WFI still wakes for it, and it is handled as soon as
+// IRQs come back on. Call with IRQs enabled.
+template <typename Cond>
+inline void cpu_idle_until(Cond cond) {
+    while (true) {
+        irq_disable();
+        if (cond()) break;
+        asm volatile("wfi" ::: "memory");
+        irq_enable();
+    }
+    irq_enable();
+}
+
+struct IpiStats {
+    uint32_t sent[IPI_KINDS];       // by this core
+    uint32_t received[IPI_KINDS];   // by this core
+    uint32_t calls;                 // callbacks run on this core
+    uint32_t spurious;              // IRQs with neither a mailbox bit nor the timer
+};
+
+// approximate while the cores are busy
+extern void ipi_stats(uint32_t core, IpiStats& st);
+extern void ipi_stats_print();
+
+#endif
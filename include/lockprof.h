@@ -0,0 +1,124 @@
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+#include "stdint.h"
+
+/*
+ * Lock contention profiling
+ *
+ * Build with LOCK_PROFILE defined (make LOCK_PROFILE=1) and every *named*
+ * SpinLock, Spinlock and TicketLock keeps statistics: acquisitions, how
+ * many had to wait, spin time (total and worst), hold time (total and
+ * worst), and the same counts for the first LOCK_PROFILE_SITES call
+ * sites that took it. Times are CNTVCT_EL0 ticks. lock_profile_report()
+ * prints them all over the UART; sites are return addresses, for
+ * addr2line against the kernel ELF.
+ *
+ * Name a lock where it is defined, e.g. `SpinLock lock{"pages"}`. Unnamed
+ * locks (stack temporaries, per-object locks) aren't profiled, because a
+ * profiled lock stays on the report list forever.
+ *
+ * The statistics are only written by the core holding the lock, so they
+ * need no atomics of their own. Without LOCK_PROFILE the hooks below
+ * expand to nothing and the locks compile exactly as before.
+ */
+
+#ifdef LOCK_PROFILE
+
+constexpr int LOCK_PROFILE_SITES = 4;
+
+inline uint64_t lockprof_ticks() {
+    uint64_t t;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(t) :: "memory");
+    return t;
+}
+
+struct LockSiteStats {
+    void* site;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t spinTicks;
+};
+
+struct LockProfile {
+    const char* name;
+    LockProfile* next;          // on the report list once registered
+    bool registered;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t spinTicks;
+    uint64_t maxSpin;
+    uint64_t holdTicks;
+    uint64_t maxHold;
+    uint64_t otherSites;        // acquisitions from sites past the table
+    uint64_t acquiredAt;
+    LockSiteStats sites[LOCK_PROFILE_SITES];
+
+    constexpr LockProfile(const char* name) : name(name), next(nullptr), registered(false),
+        acquired(0), contended(0), spinTicks(0), maxSpin(0), holdTicks(0), maxHold(0),
+        otherSites(0), acquiredAt(0), sites() {}
+
+    // with the lock just taken; `start` is when lock() was called
+    void acquire(void* site, uint64_t start, bool waited) {
+        if (name == nullptr) return;
+        if (!registered) add();
+        acquiredAt = lockprof_ticks();
+        uint64_t spin = waited ? acquiredAt - start : 0;
+        acquired++;
+        if (waited) contended++;
+        spinTicks += spin;
+        if (spin > maxSpin) maxSpin = spin;
+
+        for (int i = 0; i < LOCK_PROFILE_SITES; i++) {
+            LockSiteStats& s = sites[i];
+            if (s.site == nullptr) s.site = site;
+            if (s.site == site) {
+                s.acquired++;
+                if (waited) s.contended++;
+                s.spinTicks += spin;
+                return;
+            }
+        }
+        otherSites++;
+    }
+
+    // with the lock still held
+    void release() {
+        if (name == nullptr) return;
+        uint64_t hold = lockprof_ticks() - acquiredAt;
+        holdTicks += hold;
+        if (hold > maxHold) maxHold = hold;
+    }
+
+private:
+    void add();
+};
+
+// lock() is kept out of line so its return address is the call site, and
+// the guards are forced inline so that call site is the guard's user
+#define LOCK_PROFILED __attribute__((noinline))
+#define LOCK_GUARD_INLINE __attribute__((always_inline))
+#define LOCK_PROFILE_START() uint64_t lockStart_ = lockprof_ticks(); bool lockWaited_ = false
+#define LOCK_PROFILE_CONTENDED() (lockWaited_ = true)
+#define LOCK_PROFILE_ACQUIRED(p) (p).acquire(__builtin_return_address(0), lockStart_, lockWaited_)
+#define LOCK_PROFILE_RELEASE(p) (p).release()
+
+#else
+
+#define LOCK_PROFILED
+#define LOCK_GUARD_INLINE
+#define LOCK_PROFILE_START() ((void) 0)
+#define LOCK_PROFILE_CONTENDED() ((void) 0)
+#define LOCK_PROFILE_ACQUIRED(p) ((void) 0)
+#define LOCK_PROFILE_RELEASE(p) ((void) 0)
+
+#endif
+
+// every profiled lock that has been taken so far, or a note that
+// profiling isn't compiled in
+extern void lock_profile_report();
+
+// zero the statistics (racy against cores holding the locks)
+extern void lock_profile_reset();
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _PAGES_H_
+#define _PAGES_H_
+
+#include "stdint.h"
+
+/*
+ * Physical page allocator (binary buddy)
+ *
+ * Hands out naturally aligned blocks of 2^order 4 KB pages, order 0
+ * (4 KB) up to PAGE_MAX_ORDER (2 MB), from the RAM the firmware gives the
+ * ARM above the kernel image and heap. Use it for big or page aligned
+ * buffers instead of the small linker heap behind malloc.
+ */
+
+constexpr int PAGE_MAX_ORDER = 9;
+
+// manage RAM from firstFree up to the end of ARM memory (mailbox query)
+extern void pageInit(void* firstFree);
+
+// 2^order contiguous pages, nullptr when none are left
+extern void* pageAlloc(int order);
+
+// give back a block from pageAlloc, the order is remembered
+extern void pageFree(void* p);
+
+// smallest order that holds `bytes`, -1 if more than 2^PAGE_MAX_ORDER pages
+extern int pageOrder(size_t bytes);
+
+// pages currently on the buddy free lists (per-core hot lists not included)
+extern size_t pageFreeCount();
+
+#endif
@@ -1,4 +1,12 @@
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+#include "stdint.h"
 #include "utils.h"
+#include "sched.h"
+
+// Cortex-A53 L1/L2 line size
+constexpr int CACHE_LINE = 64;
 
 template<class T>
 class PerCPU {
@@ -12,4 +20,62 @@ public:
     inline T& mine() {
         return forCPU(getCoreID());
     }
-};
\ No newline at end of file
+};
+
+// PerCPU with every slot on its own cache line(s), so a core writing its
+// slot never invalidates the line another core is using. Costs up to
+// CACHE_LINE - 1 bytes of padding per slot; use it for anything written
+// on a hot path.
+template<class T>
+class PaddedPerCPU {
+private:
+    struct alignas(CACHE_LINE) Slot {
+        T value;
+    };
+    Slot data[4];
+public:
+    inline T& forCPU(int id) {
+        return data[id].value;
+    }
+
+    inline T& mine() {
+        return forCPU(getCoreID());
+    }
+};
+
+// A counter that only ever writes the calling core's slot. add() is a
+// plain load and store with preemption off, so that it can't be moved
+// to another core half way and race that core's owner; read() sums all
+// the slots and may miss adds that are still in flight on other cores.
+class PerCPUCounter {
+private:
+    PaddedPerCPU<int64_t> counts;
+public:
+    PerCPUCounter() = default;
+    PerCPUCounter(const PerCPUCounter&) = delete;
+
+    inline void add(int64_t n) {
+        PreemptGuard pg;
+        int64_t& c = counts.mine();
+        __atomic_store_n(&c, __atomic_load_n(&c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+    }
+
+    inline void inc() {
+        add(1);
+    }
+
+    inline int64_t read() {
+        int64_t sum = 0;
+        for (int i = 0; i < 4; i++) {
+            sum += __atomic_load_n(&counts.forCPU(i), __ATOMIC_RELAXED);
+        }
+        return sum;
+    }
+
+    // the caller's slot only, exact if no one else is adding
+    inline int64_t mine() {
+        return counts.mine();
+    }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "percpu.h"
+#include "heap.h"
+#include "printf.h"
+
+/*
+ * Typed pool of fixed-size objects
+ *
+ * Objects live in cache-line aligned slots carved from the heap a slab at
+ * a time and constructed once, with T(), when their slab is carved. After
+ * that alloc() and free() only move slots between lists: an object comes
+ * back out of the pool in whatever state it was freed in, so types with
+ * state to clear should clear it before free() or after alloc().
+ *
+ * Every slot belongs to the core that carved it. Each core pops and pushes
+ * its own free list without locks or atomics. A slot freed by some other
+ * core is pushed onto its owner's remote list with a CAS, and the owner
+ * takes the whole remote list with one exchange when its own list runs
+ * dry. Only the owner ever takes from a remote list, so there is no ABA.
+ *
+ * Slabs are never given back to the heap. alloc() and free() keep the
+ * task from being preempted, so nothing else can run on this core between
+ * getCoreID() and the list update.
+ *
+ * The constructor is constexpr, so a Pool can be a global.
+ */
+
+struct PoolStats {
+    uint32_t slabs;
+    uint32_t capacity;      // objects constructed so far
+    uint32_t inUse;         // handed out and not yet freed
+    uint32_t cached;        // on the per-core free lists
+    uint32_t remote;        // freed by other cores, waiting for their owner
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t remoteFrees;
+    uint32_t failed;
+};
+
+template <typename T>
+class Pool {
+    struct alignas(CACHE_LINE) Slot {
+        T object;           // first, so a T* is a Slot*
+        Slot* next;
+        uint32_t owner;
+    };
+
+    struct Local {
+        Slot* top = nullptr;
+        uint32_t count = 0;
+        uint32_t slabs = 0;
+        uint32_t allocs = 0;
+        uint32_t frees = 0;
+        uint32_t remoteFrees = 0;
+        uint32_t failed = 0;
+    };
+
+    struct Remote {
+        Atomic<Slot*> head;
+        Atomic<uint32_t> count;
+        constexpr Remote() : head(nullptr), count(0) {}
+    };
+
+    PaddedPerCPU<Local> local;
+    PaddedPerCPU<Remote> remotes;   // apart from Local so pushes don't hit the owner's line
+    uint32_t perSlab;
+
+    void carve(Local& me, uint32_t core) {
+        Slot* slab = (Slot*) aligned_alloc(CACHE_LINE, perSlab * sizeof(Slot));
+        if (slab == nullptr) return;
+        for (uint32_t i = 0; i < perSlab; i++) {
+            Slot* s = &slab[i];
+            new (&s->object) T();
+            s->owner = core;
+            s->next = me.top;
+            me.top = s;
+        }
+        me.count += perSlab;
+        me.slabs++;
+    }
+
+    void reclaim(Local& me, uint32_t core) {
+        Remote& r = remotes.forCPU(core);
+        if (r.head.get() == nullptr) return;
+        Slot* list = r.head.exchange(nullptr);
+        while (list != nullptr) {
+            Slot* s = list;
+            list = s->next;
+            s->next = me.top;
+            me.top = s;
+            me.count++;
+            r.count.add_fetch(-1);
+        }
+    }
+
+public:
+    static constexpr uint32_t SLAB_BYTES = 4096;
+
+    constexpr Pool(uint32_t perSlab = 0) : local(), remotes(),
+        perSlab(perSlab != 0 ? perSlab : (sizeof(Slot) < SLAB_BYTES ? SLAB_BYTES / sizeof(Slot) : 1)) {}
+    Pool(const Pool&) = delete;
+
+    // nullptr if the pool is empty and the heap can't give it another slab
+    T* alloc() {
+        PreemptGuard pg;
+        uint32_t core = getCoreID();
+        Local& me = local.forCPU(core);
+        if (me.top == nullptr) {
+            reclaim(me, core);
+            if (me.top == nullptr) carve(me, core);
+            if (me.top == nullptr) {
+                me.failed++;
+                return nullptr;
+            }
+        }
+        Slot* s = me.top;
+        me.top = s->next;
+        me.count--;
+        me.allocs++;
+        return &s->object;
+    }
+
+    void free(T* object) {
+        if (object == nullptr) return;
+        Slot* s = (Slot*) object;
+        PreemptGuard pg;
+        uint32_t core = getCoreID();
+        Local& me = local.forCPU(core);
+        me.frees++;
+        if (s->owner == core) {
+            s->next = me.top;
+            me.top = s;
+            me.count++;
+            return;
+        }
+
+        me.remoteFrees++;
+        Remote& r = remotes.forCPU(s->owner);
+        r.count.add_fetch(1);
+        Slot* head = r.head.get();
+        do {
+            s->next = head;
+        } while (!r.head.compare_exchange(head, s));
+    }
+
+    // approximate while other cores are using the pool
+    void stats(PoolStats& st) {
+        st = PoolStats{};
+        for (int i = 0; i < 4; i++) {
+            Local& l = local.forCPU(i);
+            st.slabs += l.slabs;
+            st.cached += l.count;
+            st.allocs += l.allocs;
+            st.frees += l.frees;
+            st.remoteFrees += l.remoteFrees;
+            st.failed += l.failed;
+            st.remote += remotes.forCPU(i).count.get();
+        }
+        st.capacity = st.slabs * perSlab;
+        st.inUse = st.allocs - st.frees;
+    }
+
+    void print(const char* name) {
+        PoolStats st;
+        stats(st);
+        printf("| pool %s: %d/%d in use, %d slabs of %d, %d cached, %d remote\n",
+            name, st.inUse, st.capacity, st.slabs, perSlab, st.cached, st.remote);
+        printf("| pool %s: %d allocs, %d frees (%d cross-core), %d failed\n",
+            name, st.allocs, st.frees, st.remoteFrees, st.failed);
+    }
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef _QUEUELOCK_H_
+#define _QUEUELOCK_H_
+
+#include "atomic.h"
+#include "percpu.h"
+
+/*
+ * Fair spin locks
+ *
+ * Both have the same lock()/unlock() as SpinLock, so a use site picks
+ * one by changing the type of its lock; LockGuard and LockGuardP work
+ * with all of them. SpinLock is cheapest uncontended. TicketLock is FIFO
+ * but all waiters watch one word. MCSLock is FIFO and every waiter
+ * watches its own cache line, so a handoff only disturbs the next core
+ * in line.
+ */
+
+// FIFO by ticket number; waiters sleep in WFE until `serving` moves
+class TicketLock {
+    Atomic<uint32_t> next;
+    Atomic<uint32_t> serving;
+#ifdef LOCK_PROFILE
+    LockProfile prof;
+#endif
+public:
+    // the name is only kept with LOCK_PROFILE, see lockprof.h
+    constexpr TicketLock([[maybe_unused]] const char* name = nullptr) : next(0), serving(0)
+#ifdef LOCK_PROFILE
+        , prof(name)
+#endif
+    {}
+    TicketLock(const TicketLock&) = delete;
+
+    LOCK_PROFILED void lock() {
+        LOCK_PROFILE_START();
+        preempt_disable();
+        uint32_t ticket = next.fetch_add<MO_RELAXED>(1);
+        uint32_t now = serving.get<MO_ACQUIRE>();
+        while (now != ticket) {
+            LOCK_PROFILE_CONTENDED();
+            now = serving.wait_while(now);
+        }
+        LOCK_PROFILE_ACQUIRED(prof);
+    }
+
+    LOCK_PROFILED bool try_lock() {
+        LOCK_PROFILE_START();
+        preempt_disable();
+        uint32_t now = serving.get<MO_ACQUIRE>();
+        uint32_t expected = now;
+        if (!next.compare_exchange<MO_ACQUIRE>(expected, now + 1)) {
+            preempt_enable();
+            return false;
+        }
+        LOCK_PROFILE_ACQUIRED(prof);
+        return true;
+    }
+
+    // only the holder writes `serving`
+    void unlock() {
+        LOCK_PROFILE_RELEASE(prof);
+        serving.set<MO_RELEASE>(serving.get<MO_RELAXED>() + 1);
+        preempt_enable();
+    }
+
+#ifdef LOCK_PROFILE
+    const LockProfile& profile() {
+        return prof;
+    }
+#endif
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return next.get() != serving.get();
+    }
+};
+
+// Mellor-Crummey/Scott queue lock. The queue nodes live in the lock, one
+// per core, so lock() and unlock() must happen on the same core (holding
+// it keeps the task from being preempted, so it can't move) and a core
+// can't wait for the same lock twice (it couldn't anyway).
+class MCSLock {
+    struct Node {
+        Atomic<Node*> next;
+        Atomic<bool> waiting;
+        constexpr Node() : next(nullptr), waiting(false) {}
+    };
+
+    Atomic<Node*> tail;
+    PaddedPerCPU<Node> nodes;
+public:
+    constexpr MCSLock() : tail(nullptr), nodes() {}
+    MCSLock(const MCSLock&) = delete;
+
+    void lock() {
+        preempt_disable();
+        Node* me = &nodes.mine();
+        me->next.set<MO_RELAXED>(nullptr);
+        me->waiting.set<MO_RELAXED>(true);
+        Node* prev = tail.exchange<MO_ACQ_REL>(me);
+        if (prev == nullptr) return;
+
+        prev->next.set<MO_RELEASE>(me);
+        while (me->waiting.get<MO_ACQUIRE>()) {
+            me->waiting.wait_while(true);
+        }
+    }
+
+    bool try_lock() {
+        preempt_disable();
+        Node* me = &nodes.mine();
+        me->next.set<MO_RELAXED>(nullptr);
+        Node* expected = nullptr;
+        if (tail.compare_exchange<MO_ACQ_REL>(expected, me)) return true;
+        preempt_enable();
+        return false;
+    }
+
+    void unlock() {
+        Node* me = &nodes.mine();
+        Node* succ = me->next.get<MO_ACQUIRE>();
+        if (succ == nullptr) {
+            Node* expected = me;
+            if (tail.compare_exchange<MO_RELEASE>(expected, nullptr)) {
+                preempt_enable();
+                return;
+            }
+            // someone swapped in behind us but hasn't linked up yet
+            while ((succ = me->next.get<MO_ACQUIRE>()) == nullptr) {
+                me->next.wait_while(nullptr);
+            }
+        }
+        succ->waiting.set<MO_RELEASE>(false);
+        preempt_enable();
+    }
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return tail.get() != nullptr;
+    }
+};
+
+#endif
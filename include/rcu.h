@@ -0,0 +1,110 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#include "stdint.h"
+#include "atomic.h"
+
+/*
+ * Epoch-based reclamation for lock-free readers (quiescent-state RCU)
+ *
+ * A reader just follows pointers, loading them with rcu_dereference: no
+ * locks, no atomic RMWs, no barriers. What it may not do is keep a
+ * pointer across a quiescent state, a point where the core announces
+ * (rcu_quiescent) that it holds no references into any RCU structure.
+ * Loops that read should call rcu_quiescent() every so often, between
+ * reads. The announcement is per core, so a reader must also not be
+ * preempted in the middle of a read, or the next task on its core could
+ * announce on its behalf: bracket reads with rcu_read_lock() and
+ * rcu_read_unlock(), which just keep the task on the core. That makes
+ * every context switch a quiescent state, and the scheduler announces
+ * one there (rcu_note_switch). The idle loop also takes its core offline
+ * while it sleeps (rcu_idle_enter/exit).
+ *
+ * A writer (serialized against other writers by whatever lock suits)
+ * publishes with rcu_assign, unlinks what it replaces, and hands that to
+ * call_rcu. The object is reclaimed once every online core has passed a
+ * quiescent state after the unlink, which takes the global epoch two
+ * steps: objects retired in epoch e go once the epoch reaches e + 2.
+ *
+ * Each core keeps its retired objects in three bags, one per live epoch,
+ * and reclaims a bag at a time from rcu_quiescent(), so frees reach the
+ * heap in batches and from the core that retired them.
+ *
+ * Every core starts out offline, and must call rcu_online() before its
+ * first read. A core that will go a long time without announcing
+ * (sleeping in WFI, spinning on a barrier) should go offline again first
+ * so it doesn't hold up everyone else's reclamation, and come back online
+ * before reading. Offline cores may still retire objects and
+ * rcu_synchronize; neither brings them online.
+ *
+ * IRQ handlers may read, since the interrupted code can't announce
+ * until they return, but must not call anything here other than
+ * rcu_dereference.
+ */
+
+// Embed in an RCU-managed object. rcu_free assumes it comes first.
+struct RcuHead {
+    RcuHead* next;
+    void (*reclaim)(RcuHead* head);
+};
+
+// a read-side critical section: no preemption, no quiescent states
+inline void rcu_read_lock() {
+    preempt_disable();
+}
+
+inline void rcu_read_unlock() {
+    preempt_enable();
+}
+
+template <typename T>
+inline T rcu_dereference(T& p) {
+    // a plain load; the address dependency orders what we read through it
+    return __atomic_load_n(&p, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+inline void rcu_assign(T& p, T v) {
+    // everything written to *v is visible before v is
+    __atomic_store_n(&p, v, __ATOMIC_RELEASE);
+}
+
+// run reclaim(head) once no reader can still hold it
+extern void call_rcu(RcuHead* head, void (*reclaim)(RcuHead* head));
+
+// call_rcu for an object from malloc or new whose first member (or base) is its RcuHead
+extern void rcu_free(RcuHead* head);
+
+// this core holds no references; also where its bags get reclaimed
+// (which an offline core may call for, too)
+extern void rcu_quiescent();
+
+// wait for a grace period (call outside a read), then reclaim what this
+// core retired before the call
+extern void rcu_synchronize();
+
+// stop / resume taking part, see above
+extern void rcu_offline();
+extern void rcu_online();
+
+// The scheduler's, from finish_switch with IRQs masked: the task that
+// was switched out can't be inside a read. Only announces, if online
+extern void rcu_note_switch();
+
+// The idle task brackets its sleep with these: offline for the sleep if
+// the core was online, and back online after
+extern void rcu_idle_enter();
+extern void rcu_idle_exit();
+
+struct RcuStats {
+    uint64_t epoch;
+    uint64_t retired;       // objects passed to call_rcu
+    uint64_t reclaimed;     // ... and reclaimed so far
+    uint64_t batches;       // bags reclaimed
+};
+
+// approximate while the cores are busy
+extern void rcu_stats(RcuStats& st);
+extern void rcu_stats_print();
+
+#endif
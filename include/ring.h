@@ -0,0 +1,316 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "percpu.h"
+
+/*
+ * Bounded ring buffers for handing data between cores, and a
+ * work-stealing deque built the same way
+ *
+ * N must be a power of two. Both rings are all zeros when empty, so they
+ * can be globals (no constructors run at boot) or come from new. The
+ * try_ operations never wait; push() and pop() wait in WFE until they
+ * can go ahead. The batch operations move as many items as they can, up
+ * to n, and return how many that was.
+ *
+ * Indices are free-running uint32_t counters, reduced mod N to find a
+ * slot, so they wrap harmlessly.
+ */
+
+/*
+ * Single producer, single consumer. Each side owns one index and keeps a
+ * cached copy of the other's, so in the common case a push or pop reads
+ * nothing the other core is writing. Producer and consumer state sit on
+ * separate cache lines.
+ */
+template <typename T, uint32_t N>
+class SPSCRing {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "ring size must be a power of two");
+
+    struct alignas(CACHE_LINE) Side {
+        Atomic<uint32_t> index;     // the next slot this side will use
+        uint32_t other;             // last value seen of the other side's index
+        constexpr Side() : index(0), other(0) {}
+    };
+
+    Side producer;
+    Side consumer;
+    T slots[N];
+
+public:
+    constexpr SPSCRing() : producer(), consumer(), slots() {}
+    SPSCRing(const SPSCRing&) = delete;
+
+    /* producer side */
+
+    uint32_t push_batch(const T* items, uint32_t n) {
+        uint32_t tail = producer.index.template get<MO_RELAXED>();
+        uint32_t space = N - (tail - producer.other);
+        if (space < n) {
+            producer.other = consumer.index.template get<MO_ACQUIRE>();
+            space = N - (tail - producer.other);
+        }
+        if (n > space) n = space;
+        for (uint32_t i = 0; i < n; i++) {
+            slots[(tail + i) & (N - 1)] = items[i];
+        }
+        if (n != 0) producer.index.template set<MO_RELEASE>(tail + n);
+        return n;
+    }
+
+    bool try_push(const T& item) {
+        return push_batch(&item, 1) == 1;
+    }
+
+    void push(const T& item) {
+        while (!try_push(item)) {
+            uint32_t seen = producer.other;
+            consumer.index.wait_while(seen);
+        }
+    }
+
+    /* consumer side */
+
+    uint32_t pop_batch(T* items, uint32_t n) {
+        uint32_t head = consumer.index.template get<MO_RELAXED>();
+        uint32_t ready = consumer.other - head;
+        if (ready < n) {
+            consumer.other = producer.index.template get<MO_ACQUIRE>();
+            ready = consumer.other - head;
+        }
+        if (n > ready) n = ready;
+        for (uint32_t i = 0; i < n; i++) {
+            items[i] = slots[(head + i) & (N - 1)];
+        }
+        if (n != 0) consumer.index.template set<MO_RELEASE>(head + n);
+        return n;
+    }
+
+    bool try_pop(T& item) {
+        return pop_batch(&item, 1) == 1;
+    }
+
+    T pop() {
+        T item;
+        while (!try_pop(item)) {
+            uint32_t seen = consumer.other;
+            producer.index.wait_while(seen);
+        }
+        return item;
+    }
+
+    // approximate unless called by one of the two sides
+    uint32_t size() {
+        return producer.index.template get<MO_ACQUIRE>() - consumer.index.template get<MO_ACQUIRE>();
+    }
+};
+
+/*
+ * Multiple producers, multiple consumers (Vyukov's bounded queue). Every
+ * slot carries a sequence number saying whose turn it is: a producer at
+ * position p may fill the slot when its sequence is p, a consumer may
+ * empty it when it is p + 1. Producers claim positions with a CAS on
+ * `enqueuePos` and consumers on `dequeuePos`, after which each works on
+ * its own slots without further contention. A batch checks how many of
+ * the following slots are ready and claims them all with one CAS.
+ *
+ * Slots store their sequence minus their index, so a zeroed ring is an
+ * empty one.
+ */
+template <typename T, uint32_t N>
+class MPMCRing {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "ring size must be a power of two");
+
+    struct Slot {
+        Atomic<uint32_t> stamp;     // sequence - index
+        T item;
+        constexpr Slot() : stamp(0), item() {}
+    };
+
+    struct alignas(CACHE_LINE) Position {
+        Atomic<uint32_t> pos;
+        constexpr Position() : pos(0) {}
+    };
+
+    Position enqueue;
+    Position dequeue;
+    Slot slots[N];
+
+    Slot& slot(uint32_t pos) {
+        return slots[pos & (N - 1)];
+    }
+
+    // how far the slot for `pos` is from being ready at `want` (0 = ready)
+    int32_t lag(uint32_t pos, uint32_t want) {
+        uint32_t seq = slot(pos).stamp.template get<MO_ACQUIRE>() + (pos & (N - 1));
+        return (int32_t) (seq - want);
+    }
+
+public:
+    constexpr MPMCRing() : enqueue(), dequeue(), slots() {}
+    MPMCRing(const MPMCRing&) = delete;
+
+    uint32_t push_batch(const T* items, uint32_t n) {
+        uint32_t pos = enqueue.pos.template get<MO_RELAXED>();
+        uint32_t k;
+        while (true) {
+            k = 0;
+            while (k < n && lag(pos + k, pos + k) == 0) k++;
+            if (k == 0) {
+                if (lag(pos, pos) < 0) return 0;        // full
+                pos = enqueue.pos.template get<MO_RELAXED>();
+                continue;
+            }
+            if (enqueue.pos.template compare_exchange_weak<MO_RELAXED>(pos, pos + k)) break;
+        }
+        for (uint32_t i = 0; i < k; i++) {
+            Slot& s = slot(pos + i);
+            s.item = items[i];
+            s.stamp.template set<MO_RELEASE>(pos + i + 1 - ((pos + i) & (N - 1)));
+        }
+        return k;
+    }
+
+    bool try_push(const T& item) {
+        return push_batch(&item, 1) == 1;
+    }
+
+    void push(const T& item) {
+        while (!try_push(item)) {
+            uint32_t pos = enqueue.pos.template get<MO_RELAXED>();
+            Slot& s = slot(pos);
+            uint32_t stamp = s.stamp.template get<MO_ACQUIRE>();
+            if ((int32_t) (stamp + (pos & (N - 1)) - pos) < 0) s.stamp.wait_while(stamp);
+        }
+    }
+
+    uint32_t pop_batch(T* items, uint32_t n) {
+        uint32_t pos = dequeue.pos.template get<MO_RELAXED>();
+        uint32_t k;
+        while (true) {
+            k = 0;
+            while (k < n && lag(pos + k, pos + k + 1) == 0) k++;
+            if (k == 0) {
+                if (lag(pos, pos + 1) < 0) return 0;    // empty
+                pos = dequeue.pos.template get<MO_RELAXED>();
+                continue;
+            }
+            if (dequeue.pos.template compare_exchange_weak<MO_RELAXED>(pos, pos + k)) break;
+        }
+        for (uint32_t i = 0; i < k; i++) {
+            Slot& s = slot(pos + i);
+            items[i] = s.item;
+            s.stamp.template set<MO_RELEASE>(pos + i + N - ((pos + i) & (N - 1)));
+        }
+        return k;
+    }
+
+    bool try_pop(T& item) {
+        return pop_batch(&item, 1) == 1;
+    }
+
+    T pop() {
+        T item;
+        while (!try_pop(item)) {
+            uint32_t pos = dequeue.pos.template get<MO_RELAXED>();
+            Slot& s = slot(pos);
+            uint32_t stamp = s.stamp.template get<MO_ACQUIRE>();
+            if ((int32_t) (stamp + (pos & (N - 1)) - (pos + 1)) < 0) s.stamp.wait_while(stamp);
+        }
+        return item;
+    }
+
+    // approximate while anyone is using the ring
+    uint32_t size() {
+        return enqueue.pos.template get<MO_ACQUIRE>() - dequeue.pos.template get<MO_ACQUIRE>();
+    }
+};
+
+/*
+ * Chase-Lev work-stealing deque, bounded, with the C11 orderings of Lê et
+ * al. (PPoPP '13). One owner core pushes and takes at the bottom, LIFO;
+ * any core may steal from the top, FIFO, so thieves get the oldest (and
+ * usually biggest) piece of work. The owner only contends with thieves
+ * over the last item. T should be a pointer or similar: items are copied
+ * with plain word-sized atomics.
+ *
+ * Indices are int64_t and never wrap in practice. A zeroed deque is an
+ * empty one.
+ */
+template <typename T, uint32_t N>
+class WorkStealingDeque {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "deque size must be a power of two");
+
+    struct alignas(CACHE_LINE) End {
+        Atomic<int64_t> index;
+        constexpr End() : index(0) {}
+    };
+
+    End top;                    // thieves' end
+    End bottom;                 // owner's end
+    T slots[N];
+
+    T& slot(int64_t i) {
+        return slots[i & (N - 1)];
+    }
+
+public:
+    constexpr WorkStealingDeque() : top(), bottom(), slots() {}
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+
+    /* owner side */
+
+    // false if full
+    bool push(T item) {
+        int64_t b = bottom.index.template get<MO_RELAXED>();
+        int64_t t = top.index.template get<MO_ACQUIRE>();
+        if (b - t >= (int64_t) N) return false;
+        __atomic_store_n(&slot(b), item, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);    // the item before the new bottom
+        bottom.index.template set<MO_RELAXED>(b + 1);
+        return true;
+    }
+
+    // the newest item, false if empty (or a thief got the last one)
+    bool take(T& item) {
+        int64_t b = bottom.index.template get<MO_RELAXED>() - 1;
+        bottom.index.template set<MO_RELAXED>(b);
+        // the new bottom is visible before we look at the top
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t t = top.index.template get<MO_RELAXED>();
+        if (t > b) {
+            bottom.index.template set<MO_RELAXED>(b + 1);
+            return false;
+        }
+        item = __atomic_load_n(&slot(b), __ATOMIC_RELAXED);
+        if (t == b) {
+            // the last one: race the thieves for it through the top
+            bool won = top.index.compare_exchange(t, t + 1);
+            bottom.index.template set<MO_RELAXED>(b + 1);
+            return won;
+        }
+        return true;
+    }
+
+    /* any core */
+
+    // the oldest item, false if empty or another core got there first
+    bool steal(T& item) {
+        int64_t t = top.index.template get<MO_ACQUIRE>();
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t b = bottom.index.template get<MO_ACQUIRE>();
+        if (t >= b) return false;
+        item = __atomic_load_n(&slot(t), __ATOMIC_RELAXED);
+        return top.index.compare_exchange(t, t + 1);
+    }
+
+    // approximate unless called by the owner
+    int64_t size() {
+        int64_t n = bottom.index.template get<MO_ACQUIRE>() - top.index.template get<MO_ACQUIRE>();
+        return n < 0 ? 0 : n;
+    }
+};
+
+#endif
@@ -411,6 +411,40 @@ bool mailbox_write (MAILBOX_CHANNEL channel, uint32_t message);
 .--------------------------------------------------------------------------*/
 uint32_t mailbox_read (MAILBOX_CHANNEL channel);
 
+/*-[mailbox_claim]----------------------------------------------------------}
+. Property calls share the one mailbox and must not overlap. Take this
+. before the write and keep it until the answer has been read. It is an
+. exclusive access, so only once the MMU is on (coresAwoken).
+. RETURN: True if the mailbox is now ours, False if someone else has it.
+.--------------------------------------------------------------------------*/
+bool mailbox_claim (void);
+
+/*-[mailbox_release]--------------------------------------------------------}
+. Give back the mailbox taken with mailbox_claim.
+.--------------------------------------------------------------------------*/
+void mailbox_release (void);
+
+/*-[mailbox_try_read]-------------------------------------------------------}
+. Reads at most one waiting message, without spinning, under mailbox_claim.
+. Property calls (channel 8) are the only mailbox traffic here, so with the
+. claim held the message is the answer to ours; one for any other channel
+. would be lost and panics instead.
+. RETURN: True with the value set if there was a message.
+.--------------------------------------------------------------------------*/
+bool mailbox_try_read (uint8_t channel, uint32_t* value);
+
+/*-[mailbox_can_write]------------------------------------------------------}
+. For callers that wait some other way than spinning in mailbox_write.
+. RETURN: True if there is room to write, so mailbox_write won't wait.
+.--------------------------------------------------------------------------*/
+bool mailbox_can_write (void);
+
+/*-[mailbox_can_read]-------------------------------------------------------}
+. For callers that wait some other way than spinning in mailbox_read.
+. RETURN: True if a message is waiting to be read.
+.--------------------------------------------------------------------------*/
+bool mailbox_can_read (void);
+
 /*-[mailbox_tag_message]----------------------------------------------------}
 . This will post and execute the given variadic data onto the tags channel
 . on the mailbox system. You must provide the correct number of response
@@ -1,25 +1,34 @@
 #ifndef _SCHED_H
 #define _SCHED_H
 
-#define THREAD_CPU_CONTEXT			0 		// offset of cpu_context in task_struct 
+#define THREAD_CPU_CONTEXT			0 		// offset of cpu_context in task_struct
 
 #ifndef __ASSEMBLER__
 
-#define THREAD_SIZE				4096
+#include "timeout.h"
 
-#define NR_TASKS				64 
-
-#define FIRST_TASK task[0]
-#define LAST_TASK task[NR_TASKS-1]
+#define THREAD_SIZE				16384		// kernel thread stacks, from pageAlloc
 
 #define TASK_RUNNING				0
 #define TASK_ZOMBIE				1
+#define TASK_SLEEPING				2		// off the run queue until wake_up
+
+#define PF_KTHREAD				0x00000002
+#define PF_IDLE					0x00000004
+#define PF_USED_FP				0x00000008	// has FP/SIMD state, see fpsimd.h
+#define PF_DL					0x00000010	// deadline task, see kthread_create_dl
+
+#define DEFAULT_PRIORITY			15		// ticks per time slice
 
-#define PF_KTHREAD				0x00000002	
+#define NR_PRIO					32		// run queue levels, 0 runs first
+#define DEFAULT_PRIO				16
 
+#define DL_BW_SHIFT				20		// deadline bandwidth: 1 << DL_BW_SHIFT is a whole core
+#define DL_BW_MAX				((90 << DL_BW_SHIFT) / 100)	// admitted per core
+#define DL_PERIOD_MAX_US			10000000
+
+#define CPU_MASK_ALL				0xful		// affinity: one bit per core
 
-extern struct task_struct *current;
-extern struct task_struct * task[NR_TASKS];
 extern int nr_tasks;
 
 struct cpu_context {
@@ -38,7 +47,36 @@ struct cpu_context {
 	unsigned long pc;
 };
 
-#define MAX_PROCESS_PAGES			16	
+// v0-v31, FPSR, FPCR: saved only when another task wants the FP unit
+struct fpsimd_state {
+	__uint128_t v[32];
+	unsigned long fpsr;
+	unsigned long fpcr;
+} __attribute__((aligned(16)));
+
+struct DlStats {
+	unsigned long jobs;			// dl_wait_period calls
+	unsigned long misses;			// ... made after the job's deadline
+	unsigned long throttles;		// times the budget ran out
+	unsigned long worstLatency;		// release to running, counter ticks
+	unsigned long totalLatency;
+};
+
+// a deadline task's reservation and its current job, all in counter ticks
+struct sched_dl {
+	unsigned long runtime;			// budget per period
+	unsigned long period;
+	unsigned long bw;			// runtime / period, DL_BW_SHIFT fixed point
+	unsigned long release;			// of the current job
+	unsigned long deadline;			// absolute
+	long budget;				// runtime left before the deadline
+	unsigned long since;			// switched in at
+	bool throttled;				// out of budget, off the queue until the deadline
+	Timeout timer;				// next release, or the replenishment
+	struct DlStats stats;
+};
+
+#define MAX_PROCESS_PAGES			16
 
 struct user_page {
 	unsigned long phys_addr;
@@ -55,23 +93,159 @@ struct mm_struct {
 
 struct task_struct {
 	struct cpu_context cpu_context;
-	long state;	
-	long counter;
-	long priority;
-	long preempt_count;
+	long state;
+	long counter;				// ticks left in this slice
+	long priority;				// ticks per slice
+	long preempt_count;			// > 0: don't switch away from this task
 	unsigned long flags;
 	struct mm_struct mm;
+
+	volatile long need_resched;		// switch at the next chance
+	volatile long on_cpu;			// running, or still being switched out
+	int cpu;				// whose run queue it belongs to
+	int pid;				// unique, never reused
+	int prio;				// run queue level, 0 first
+	unsigned long allowed;			// cores it may run on
+	long on_rq;				// queued; under its run queue's lock
+	struct task_struct* next;		// run queue link
+	struct task_struct* tasks_next;		// all tasks, under tasksLock
+	struct task_struct* tasks_prev;
+	void* stack;				// pageAlloc'd, THREAD_SIZE bytes
+	unsigned long switches;			// times switched in
+	struct sched_dl dl;			// PF_DL only
+	struct fpsimd_state fpsimd;
 };
 
+/*
+ * Every core runs its boot context (kernelMain) as a task once sched_init
+ * has run there, and keeps the running task in TPIDR_EL1. Before that,
+ * current is nullptr and everything below is a no-op.
+ */
+inline struct task_struct* get_current(void) {
+	struct task_struct* t;
+	asm volatile("mrs %0, tpidr_el1" : "=r"(t));
+	return t;
+}
+
+#define current get_current()
+
 extern void sched_init(void);
 extern void schedule(void);
 extern void timer_tick(void);
-extern void preempt_disable(void);
-extern void preempt_enable(void);
-extern void switch_to(struct task_struct* next);
-extern void cpu_switch_to(struct task_struct* prev, struct task_struct* next);
+extern void preempt_schedule(void);
+// returns the task that was running before we were switched back in
+extern "C" struct task_struct* cpu_switch_to(struct task_struct* prev, struct task_struct* next);
+// irq_entry brackets irq_handler with these; irq_exit is where IRQs preempt
+extern "C" void irq_enter(void);
+extern "C" void irq_exit(void);
+// between irq_enter and irq_exit on this core
+extern bool in_irq(void);
 extern void exit_process(void);
 
+/*
+ * Kernel threads. kthread_create starts fn(arg) with a slice of
+ * `priority` ticks at run queue level `prio`, and returns nullptr when
+ * memory is full. Given a `cpu` it stays there (its affinity is just that
+ * core); with -1 it starts on the least loaded core and may be moved by
+ * the load balancer. A thread ends by returning from fn or calling
+ * kthread_exit. Someone must kthread_join every thread to free it; the
+ * joiner waits at the thread's prio if that is less important than its own.
+ */
+extern struct task_struct* kthread_create(void (*fn)(void*), void* arg, int cpu = -1,
+	long priority = DEFAULT_PRIORITY, int prio = DEFAULT_PRIO);
+extern void kthread_exit(void);
+extern void kthread_join(struct task_struct* t);
+// give up the rest of the slice to the next runnable task on this core
+extern void yield(void);
+
+/*
+ * Priority and affinity, for any live task but a deadline one, which
+ * keeps its core and runs before all of these. A lower prio always runs
+ * first on a core; tasks at the same level take turns. A task running,
+ * queued or asleep on a core its new mask excludes moves at its next
+ * switch there.
+ */
+extern void sched_setprio(struct task_struct* t, int prio);
+extern void sched_setaffinity(struct task_struct* t, unsigned long mask);
+
+/*
+ * Deadline tasks: periodic work that must run at a fixed rate, like
+ * sampling GPIOs or framing UART output. kthread_create_dl reserves
+ * `runtime_us` of every `period_us` on one core (`cpu`, or -1 for the one
+ * with the most deadline bandwidth left) and returns nullptr if no core
+ * can take it without going over DL_BW_MAX. Deadline tasks stay on that
+ * core and run before every normal task there, earliest deadline first.
+ * Each job is released at a multiple of the period from its creation,
+ * and has until one period after that. fn ends a job with
+ * dl_wait_period, which sleeps until the next release. A job that runs
+ * out of budget is throttled until its deadline and then carries on with
+ * a fresh budget and the next deadline, so an overrunning task can't take
+ * more than its reservation from the others (a constant bandwidth server).
+ * Budgets are enforced by a timeout, so to within about a wheel unit.
+ */
+extern struct task_struct* kthread_create_dl(void (*fn)(void*), void* arg,
+	unsigned long runtime_us, unsigned long period_us, int cpu = -1);
+extern void dl_wait_period(void);
+// approximate while t is running
+extern void sched_dl_stats(struct task_struct* t, struct DlStats& st);
+
+/*
+ * Blocking. A task sets its state to TASK_SLEEPING, arranges for someone
+ * to wake_up it, and calls schedule(), all with preemption disabled so
+ * it can't be switched out in between and never come back. schedule()
+ * then leaves it off the run queue. wake_up makes it runnable again on
+ * the core it slept on (if still allowed), from any core or IRQ, and is
+ * a no-op unless it sleeps; a wake_up that comes before the schedule()
+ * just makes that return.
+ */
+extern void wake_up(struct task_struct* t);
+
+struct SchedStats {
+	unsigned long switches;
+	unsigned long preemptions;		// switches forced by need_resched at IRQ exit
+	unsigned long ticks;
+	unsigned long pulled;			// tasks the balancer moved here
+	unsigned long pushed;			// tasks that left for a core they're allowed on
+	unsigned int queued;
+	unsigned int dlUtil;			// deadline bandwidth admitted, in 1/1000 of the core
+};
+
+// for one core, approximate while it is running
+extern void sched_stats(int cpu, struct SchedStats& st);
+extern void sched_stats_print(void);
+
+/*
+ * Preemption. A task is only switched away from involuntarily (at IRQ
+ * exit, or when the count drops back to 0 with need_resched set) while
+ * its preempt_count is 0. The locks raise it while held, and so does
+ * anything that works on per-core data, like the heap's magazines. The
+ * count is per task, so a task moved to another core can't unbalance it,
+ * and the load balancer leaves a task alone while it is raised.
+ */
+inline void preempt_disable(void) {
+	struct task_struct* t = get_current();
+	if (t == nullptr) return;
+	t->preempt_count++;
+	asm volatile("" ::: "memory");
+}
+
+inline void preempt_enable(void) {
+	struct task_struct* t = get_current();
+	if (t == nullptr) return;
+	asm volatile("" ::: "memory");
+	if (--t->preempt_count == 0 && t->need_resched) preempt_schedule();
+}
+
+class PreemptGuard {
+public:
+	inline PreemptGuard() {
+		preempt_disable();
+	}
+	inline ~PreemptGuard() {
+		preempt_enable();
+	}
+};
+
 #define INIT_TASK \
 /*cpu_context*/ { { 0,0,0,0,0,0,0,0,0,0,0,0,0}, \
 /* state etc */	 0,0,15, 0, PF_KTHREAD, \
@@ -8,26 +8,52 @@
 class Spinlock {
 private:
     Atomic<int> theLock;
+#ifdef LOCK_PROFILE
+    LockProfile prof;
+#endif
 
 public:
-    // Constructor
-    Spinlock() : theLock(0) {}
+    // Constructor, the name is only kept with LOCK_PROFILE (see lockprof.h)
+    Spinlock([[maybe_unused]] const char* name = nullptr) : theLock(0)
+#ifdef LOCK_PROFILE
+        , prof(name)
+#endif
+    {}
 
     // Acquire the lock
-    void lock() {
+    LOCK_PROFILED void lock() {
+        LOCK_PROFILE_START();
+        preempt_disable();
         while (theLock.exchange(1) != 0) {
+            LOCK_PROFILE_CONTENDED();
         }
+        LOCK_PROFILE_ACQUIRED(prof);
     }
 
     // Release the lock
     void unlock() {
+        LOCK_PROFILE_RELEASE(prof);
         theLock.set(0); // Set the lock to 0, indicating it is free
+        preempt_enable();
     }
 
     // Try to acquire the lock (non-blocking)
-    bool try_acquire() {
-        return theLock.exchange(1) == 0; // Acquire lock if it was free
+    LOCK_PROFILED bool try_acquire() {
+        LOCK_PROFILE_START();
+        preempt_disable();
+        if (theLock.exchange(1) != 0) { // Acquire lock if it was free
+            preempt_enable();
+            return false;
+        }
+        LOCK_PROFILE_ACQUIRED(prof);
+        return true;
     }
+
+#ifdef LOCK_PROFILE
+    const LockProfile& profile() {
+        return prof;
+    }
+#endif
 };
 
 #endif
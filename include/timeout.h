@@ -0,0 +1,98 @@
+#ifndef _TIMEOUT_H_
+#define _TIMEOUT_H_
+
+#include "stdint.h"
+
+/*
+ * Timeouts on per-core hierarchical timing wheels
+ *
+ * A Timeout calls fn(arg) once CNTVCT_EL0 reaches its expiry. Each core
+ * keeps its pending timeouts in TIMEOUT_LEVELS wheels of 64 slots: level
+ * 0 slots are one wheel unit (the first power of two counter ticks of at
+ * least 100 us), and every level up is 64 times coarser. A timeout goes
+ * into the slot for its expiry at the coarsest level it is still within
+ * range of, so adding or cancelling one is a list insert or unlink,
+ * however many there are. Whenever the level 0 wheel comes round, the
+ * next slot of level 1 is spread back over level 0 ("cascaded"), and so
+ * on up.
+ *
+ * The wheel is run from the core's timer deadline (timer_set_deadline),
+ * which is kept at the start of the next nonempty slot, so an idle core
+ * with nothing due in the next second is not woken up to turn the wheel.
+ * Everything that has expired by then is taken off under the lock in one
+ * go and called back after, in no particular order. A timeout never
+ * fires early, and late by about a unit when IRQs are on.
+ *
+ * When a core goes idle, its timeouts move to a core that is not, so the
+ * idle one can stay asleep; TIMEOUT_PINNED ones stay where they were
+ * added. Callbacks run in interrupt context on whichever core the timeout
+ * ended up on, with the same limits as IPI handlers (see ipi.h); waking a
+ * task is fine.
+ *
+ * A Timeout belongs to its owner, who must not free or re-add it from
+ * another core while it may be pending. The fields are the wheel's.
+ */
+
+constexpr uint32_t TIMEOUT_LEVELS = 4;
+constexpr uint32_t TIMEOUT_PINNED = 1;
+
+struct Timeout {
+    Timeout* next;
+    Timeout** pprev;            // nullptr when not pending
+    uint64_t expires;           // CNTVCT_EL0
+    void (*fn)(void* arg);
+    void* arg;
+    volatile int32_t cpu;       // whose wheel it is on, -1 when not pending
+    uint16_t slot;              // level * 64 + index
+    uint16_t flags;
+};
+
+inline void timeout_init(Timeout& t, void (*fn)(void*), void* arg, uint16_t flags = 0) {
+    t = Timeout{};
+    t.fn = fn;
+    t.arg = arg;
+    t.cpu = -1;
+    t.flags = flags;
+}
+
+// per core, after timerInit
+extern void timeoutInit();
+
+// (Re)arm t on this core's wheel to fire at `expires`; a pending t is
+// cancelled first, wherever it is
+extern void timeout_add(Timeout& t, uint64_t expires);
+
+// true if t was pending and now won't fire; false if it wasn't, or its
+// callback has already been taken off the wheel (and may still be running)
+extern bool timeout_cancel(Timeout& t);
+
+inline bool timeout_pending(const Timeout& t) {
+    return t.cpu >= 0;
+}
+
+// The idle task brackets its sleep with these: enter hands this core's
+// unpinned timeouts to a busy core, if there is one
+extern void timeout_idle_enter();
+extern void timeout_idle_exit();
+
+// Block the calling task until timer_now() >= when; before sched_init,
+// busy wait
+extern void sleep_until(uint64_t when);
+extern void sleep_us(uint64_t us);
+
+struct TimeoutStats {
+    uint64_t added;
+    uint64_t cancelled;
+    uint64_t expired;
+    uint64_t cascaded;          // moved down a level
+    uint64_t migrated;          // handed to another core going idle
+    uint64_t runs;              // times the wheel was turned
+    uint64_t maxBatch;          // most callbacks from one run
+    uint64_t pending;
+};
+
+// approximate while the core is running
+extern void timeout_stats(uint32_t core, TimeoutStats& st);
+extern void timeout_stats_print();
+
+#endif
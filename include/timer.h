@@ -0,0 +1,80 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "stdint.h"
+
+/*
+ * ARM generic timer, one per core
+ *
+ * Each core uses its virtual timer (CNTV, which compares against
+ * CNTVCT_EL0; boot.S zeroes the offset) routed to its IRQ line by the
+ * BCM2836 local interrupt controller: bit 3 of core n's timer interrupt
+ * control (0x40000040 + 4n) enables it, and bit 3 of its IRQ source
+ * register says it fired.
+ *
+ * The timer drives two things. One is the scheduler tick: TIMER_HZ
+ * times a second, timer_tick() runs in the IRQ. The other is a single
+ * one-shot deadline per core (timer_set_deadline), which the timeout
+ * wheels in timeout.h run on. The comparator is always set to whichever
+ * comes first.
+ *
+ * Tickless idle: between tick_idle_enter() and tick_idle_exit() the
+ * periodic tick is off. The comparator then holds only the deadline, if
+ * there is one, so an idle core stays in WFI until something actually
+ * needs it instead of waking TIMER_HZ times a second for nothing. The
+ * idle task does this around its WFI. The tick picks up again on exit,
+ * without counting the periods that went by while idle as missed.
+ */
+
+constexpr uint32_t TIMER_HZ = 100;
+constexpr uint64_t TIMER_NEVER = ~0ull;
+
+// CNTVCT_EL0, the same on every core
+inline uint64_t timer_now() {
+    uint64_t t;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(t) :: "memory");
+    return t;
+}
+
+// counter ticks per second
+inline uint64_t timer_freq() {
+    uint64_t f;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+}
+
+inline uint64_t timer_us(uint64_t us) {
+    return timer_freq() * us / 1000000;
+}
+
+// per core, after sched_init: route the timer IRQ and start the tick
+extern void timerInit();
+
+// irq_handler calls this when this core's timer fired
+extern void timer_irq();
+
+// Call the deadline hook on this core once timer_now() >= when, replacing
+// any earlier deadline; TIMER_NEVER cancels it
+extern void timer_set_deadline(uint64_t when);
+
+// runs in interrupt context on the core whose deadline passed, and may
+// set the next one
+extern void timer_set_deadline_hook(void (*hook)());
+
+// the periodic tick off / back on for this core, see above
+extern void tick_idle_enter();
+extern void tick_idle_exit();
+
+struct TimerStats {
+    uint64_t irqs;          // timer interrupts taken
+    uint64_t ticks;         // ... that ran timer_tick
+    uint64_t missedTicks;   // periods that went by without one (IRQs masked too long)
+    uint64_t deadlines;     // deadline hooks run
+    uint64_t idleEnters;    // times the tick was stopped for idle
+};
+
+// approximate while the core is running
+extern void timer_stats(uint32_t core, TimerStats& st);
+extern void timer_stats_print();
+
+#endif
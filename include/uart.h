@@ -3,6 +3,8 @@
 
 void uart_init();
 void uart_putc(char c);
+// the transmit FIFO has room, so uart_putc won't wait
+bool uart_can_putc(void);
 char uart_getc(void);
 void uart_puts(const char* str);
 void uart_hex(unsigned int d);
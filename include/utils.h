@@ -13,6 +13,17 @@ extern "C" unsigned long get_el();
 extern "C" void irq_init_vectors();
 extern "C" void irq_enable();
 extern "C" void irq_disable();
+
+// mask IRQs, returning whether they were (DAIF) for irq_restore
+inline unsigned long irq_save() {
+    unsigned long flags;
+    asm volatile("mrs %0, daif; msr daifset, #2" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+inline void irq_restore(unsigned long flags) {
+    asm volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
 extern "C" void monitor(long addr);
 extern "C" void outb(int port, int val);
 
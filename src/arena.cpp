@@ -0,0 +1,65 @@
+#include "arena.h"
+#include "heap.h"
+#include "pages.h"
+#include "printf.h"
+#include "mm.h"
+
+void* Arena::grow(size_t bytes, size_t align) {
+    size_t want = sizeof(Chunk) + bytes + align;
+    if (want < chunkBytes) want = chunkBytes;
+
+    Chunk* c = nullptr;
+    bool fromPages = false;
+    if (usePages) {
+        int order = pageOrder(want);
+        if (order >= 0) {
+            c = (Chunk*) pageAlloc(order);
+            if (c != nullptr) {
+                fromPages = true;
+                want = size_t(PAGE_SIZE) << order;
+            }
+        }
+    }
+    if (c == nullptr) {
+        c = (Chunk*) malloc(want);
+        if (c == nullptr) return nullptr;
+    }
+
+    c->prev = chunk;
+    c->end = (char*) c + want;
+    c->fromPages = fromPages;
+    chunk = c;
+    top = (char*) (c + 1);
+    limit = c->end;
+    return alloc(bytes, align);
+}
+
+void Arena::release(Mark m) {
+    while (chunk != m.chunk) {
+        if (chunk == nullptr) {
+            panic("Arena::release: mark doesn't belong to this arena\n");
+            return;
+        }
+        Chunk* c = chunk;
+        chunk = c->prev;
+        if (c->fromPages) {
+            pageFree(c);
+        } else {
+            free(c);
+        }
+    }
+    top = m.top;
+    limit = (chunk == nullptr) ? nullptr : chunk->end;
+}
+
+void* operator new(size_t size, Arena& arena) {
+    void* p = arena.alloc(size);
+    if (p == 0) panic("out of memory");
+    return p;
+}
+
+void* operator new[](size_t size, Arena& arena) {
+    void* p = arena.alloc(size);
+    if (p == 0) panic("out of memory");
+    return p;
+}
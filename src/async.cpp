@@ -0,0 +1,290 @@
+#include "async.h"
+#include "sched.h"
+#include "percpu.h"
+#include "uart.h"
+#include "rpi-SmartStart.h"
+#include "printf.h"
+
+namespace {
+
+/*
+ * The ready queue is a FIFO under lock, with IRQs masked, since timeouts
+ * and other cores post to it. The device waiters are only ever touched
+ * by the runner, on this core.
+ */
+struct Executor {
+    RawSpinLock lock;
+    AsyncWait* head;
+    AsyncWait* tail;
+    task_struct* runner;            // in async_run, or nullptr
+    AsyncWait* polling;
+    volatile uint64_t live;         // spawned here and not finished
+    AsyncStats stats;
+    constexpr Executor() : lock(), head(nullptr), tail(nullptr), runner(nullptr), polling(nullptr),
+        live(0), stats() {}
+};
+
+PaddedPerCPU<Executor> executors;
+
+// locked
+AsyncWait* take(Executor& ex) {
+    AsyncWait* w = ex.head;
+    if (w != nullptr) {
+        ex.head = w->next;
+        if (ex.head == nullptr) ex.tail = nullptr;
+    }
+    return w;
+}
+
+void wakeRunner(Executor& ex) {
+    uint64_t flags = irq_save();
+    ex.lock.lock();
+    task_struct* runner = ex.runner;
+    ex.lock.unlock();
+    irq_restore(flags);
+    if (runner != nullptr) wake_up(runner);
+}
+
+// the device waiters that are ready go on the queue; how many did
+uint32_t poll(Executor& ex) {
+    uint32_t ready = 0;
+    AsyncWait** pw = &ex.polling;
+    while (*pw != nullptr) {
+        AsyncWait* w = *pw;
+        ex.stats.polls++;
+        if (w->ready(w->arg)) {
+            *pw = w->next;
+            async_post(*w);
+            ready++;
+        } else {
+            pw = &w->next;
+        }
+    }
+    return ready;
+}
+
+// called on the runner's core, which it is pinned to
+bool noneLive(void*) {
+    return executors.mine().live == 0;
+}
+
+}
+
+void async_post(AsyncWait& w) {
+    uint32_t core = w.core;
+    Executor& ex = executors.forCPU(core);
+    uint64_t flags = irq_save();
+    ex.lock.lock();
+    w.next = nullptr;
+    if (ex.tail != nullptr) {
+        ex.tail->next = &w;
+    } else {
+        ex.head = &w;
+    }
+    ex.tail = &w;
+    if (core != getCoreID()) ex.stats.posted++;
+    task_struct* runner = ex.runner;
+    ex.lock.unlock();
+    irq_restore(flags);
+    // w may be running elsewhere already; it's not ours to touch now
+    if (runner != nullptr) wake_up(runner);
+}
+
+void async_poll(AsyncWait& w) {
+    Executor& ex = executors.mine();
+    w.core = getCoreID();
+    w.next = ex.polling;
+    ex.polling = &w;
+}
+
+void async_wake(uint32_t core) {
+    wakeRunner(executors.forCPU(core));
+}
+
+bool async_spawn(Async<void>&& a, int32_t core) {
+    if (!a.valid()) return false;
+    if (core < 0) core = getCoreID();
+    Async<void>::Handle h = a.release();
+    async_detail::PromiseBase& p = h.promise();
+    Executor& ex = executors.forCPU(core);
+    p.home = core;
+    p.start.h = h;
+    p.start.core = core;
+    __atomic_fetch_add(&ex.live, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ex.stats.spawned, 1, __ATOMIC_RELAXED);
+    async_post(p.start);
+    return true;
+}
+
+void async_detail::finished(uint32_t home) {
+    Executor& ex = executors.forCPU(home);
+    __atomic_fetch_add(&ex.stats.finished, 1, __ATOMIC_RELAXED);
+    if (__atomic_sub_fetch(&ex.live, 1, __ATOMIC_RELEASE) == 0 && home != getCoreID()) wakeRunner(ex);
+}
+
+void async_run_until(bool (*cond)(void* arg), void* arg) {
+    task_struct* t = current;
+    // the executor is this core's, so we stay here until done; not
+    // preemptible in between, or we could be moved before we're pinned
+    preempt_disable();
+    uint32_t me = getCoreID();
+    unsigned long allowed = t->allowed;
+    sched_setaffinity(t, 1ul << me);
+    preempt_enable();
+    Executor& ex = executors.forCPU(me);
+
+    uint64_t flags = irq_save();
+    ex.lock.lock();
+    ex.runner = t;
+    ex.lock.unlock();
+    irq_restore(flags);
+
+    while (!cond(arg)) {
+        flags = irq_save();
+        ex.lock.lock();
+        AsyncWait* w = take(ex);
+        ex.lock.unlock();
+        irq_restore(flags);
+        if (w != nullptr) {
+            ex.stats.resumes++;
+            preempt_disable();
+            w->h.resume();
+            preempt_enable();
+            continue;
+        }
+
+        if (ex.polling != nullptr) {
+            if (poll(ex) == 0) yield();
+            continue;
+        }
+
+        // nothing to do until something is posted; async_post and
+        // async_wake look at our state under the lock, after we set it
+        preempt_disable();
+        t->state = TASK_SLEEPING;
+        flags = irq_save();
+        ex.lock.lock();
+        bool idle = ex.head == nullptr;
+        ex.lock.unlock();
+        irq_restore(flags);
+        if (idle && !cond(arg)) {
+            ex.stats.sleeps++;
+            schedule();
+        } else {
+            t->state = TASK_RUNNING;
+        }
+        preempt_enable();
+    }
+
+    flags = irq_save();
+    ex.lock.lock();
+    ex.runner = nullptr;
+    ex.lock.unlock();
+    irq_restore(flags);
+    sched_setaffinity(t, allowed);
+}
+
+void async_run() {
+    async_run_until(noneLive, nullptr);
+}
+
+/* AsyncEvent */
+
+bool AsyncEvent::enqueue(AsyncWait& w) {
+    uint64_t flags = irq_save();
+    lock.lock();
+    bool wait = !isSet;
+    if (wait) {
+        w.next = waiters;
+        waiters = &w;
+    }
+    lock.unlock();
+    irq_restore(flags);
+    return wait;
+}
+
+void AsyncEvent::set() {
+    uint64_t flags = irq_save();
+    lock.lock();
+    isSet = true;
+    AsyncWait* list = waiters;
+    waiters = nullptr;
+    lock.unlock();
+    irq_restore(flags);
+    while (list != nullptr) {
+        AsyncWait* next = list->next;
+        async_post(*list);
+        list = next;
+    }
+}
+
+/* Devices */
+
+Async<void> uart_write_async(const char* s, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        co_await async_until(uart_can_putc);
+        uart_putc(s[i]);
+    }
+}
+
+namespace {
+
+// out to RAM for the VideoCore, and then our stale copy gone
+void cleanInvalidate(uint32_t* msg) {
+    uintptr_t end = (uintptr_t) msg + msg[0];
+    for (uintptr_t a = (uintptr_t) msg & ~(uintptr_t) (CACHE_LINE - 1); a < end; a += CACHE_LINE) {
+        asm volatile("dc civac, %0" :: "r"(a) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+// The mailbox claim, kept in the frame: a coroutine destroyed before it
+// has its answer gives the mailbox back
+struct MailboxClaim {
+    bool held = false;
+
+    bool take() {
+        held = mailbox_claim();
+        return held;
+    }
+
+    void release() {
+        if (held) mailbox_release();
+        held = false;
+    }
+
+    ~MailboxClaim() {
+        release();
+    }
+};
+
+}
+
+Async<bool> mailbox_call_async(uint32_t* msg) {
+    MailboxClaim claim;
+    co_await async_until([&claim] { return claim.take(); });
+    cleanInvalidate(msg);
+    co_await async_until(mailbox_can_write);
+    mailbox_write(MB_CHANNEL_TAGS, ARMaddrToGPUaddr((uint32_t) (uintptr_t) msg));
+    // one read per test; with the claim we are the only reader, and the
+    // next message is our answer
+    uint32_t answer;
+    co_await async_until([&answer] { return mailbox_try_read(MB_CHANNEL_TAGS, &answer); });
+    claim.release();
+    cleanInvalidate(msg);
+    co_return msg[1] == 0x80000000;
+}
+
+void async_stats(uint32_t core, AsyncStats& st) {
+    st = executors.forCPU(core).stats;
+}
+
+void async_stats_print() {
+    for (uint32_t core = 0; core < 4; core++) {
+        AsyncStats st;
+        async_stats(core, st);
+        printf("| async core %d: %d spawned, %d finished, %d resumes, %d posted, %d polls, %d sleeps\n",
+            core, (uint32_t) st.spawned, (uint32_t) st.finished, (uint32_t) st.resumes,
+            (uint32_t) st.posted, (uint32_t) st.polls, (uint32_t) st.sleeps);
+    }
+}
@@ -2,4 +2,4 @@
 
 Atomic<uint32_t> critical_depth = 0;
 Atomic<uint32_t> critical_owner = uint32_t(-1);
-SpinLock critical_section_lock;
\ No newline at end of file
+SpinLock critical_section_lock{"critical"};
\ No newline at end of file
@@ -12,7 +12,7 @@ void Debug::init(OutputStream<char> *sink) {
     Debug::sink = sink;
 }
 
-static SpinLock lock{};
+static SpinLock lock{"debug"};
 
 void Debug::vprintf(const char* fmt, va_list ap) {
     if (sink) {
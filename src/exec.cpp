@@ -1,6 +1,7 @@
 #include "uart.h"
 #include "printf.h"
 #include "stdint.h"
+#include "fpsimd.h"
 
 /**
  * common exception handler
@@ -71,3 +72,19 @@ extern "C" void exc_handler(unsigned long type, unsigned long esr, unsigned long
     // no return from exception for now
     while(1);
 }
+
+// ESR_EL1.EC of an FP/SIMD instruction trapped by CPACR_EL1.FPEN
+#define ESR_EC_FP_ACCESS 0b000111
+
+/**
+ * synchronous exceptions from EL1h (boot.S sync_entry); returning goes
+ * back to the instruction that trapped
+ */
+extern "C" void sync_handler(unsigned long esr, unsigned long elr, unsigned long spsr, unsigned long far)
+{
+    if ((esr >> 26) == ESR_EC_FP_ACCESS) {
+        fpsimd_trap();
+        return;
+    }
+    exc_handler(0, esr, elr, spsr, far);
+}
@@ -0,0 +1,161 @@
+#include "forkjoin.h"
+#include "percpu.h"
+#include "ring.h"
+#include "printf.h"
+
+namespace {
+
+constexpr uint32_t DEQUE_SIZE = 1024;
+
+struct Worker {
+    WorkStealingDeque<FjTask*, DEQUE_SIZE> deque;
+    FjStats stats;          // written by this core only
+    uint32_t seed;          // picks the first victim
+    constexpr Worker() : deque(), stats(), seed(0) {}
+};
+
+PaddedPerCPU<Worker> workers;
+
+Atomic<uint32_t> active{1};     // cores 0 .. active-1 take part in the current fj_run
+Atomic<uint32_t> done{0};       // its root has returned
+Atomic<uint32_t> sleepers{0};   // cores in WFE waiting for work
+SenseBarrier phase{4};
+
+// the store that made work (or `done`) visible before the event
+void wake() {
+    asm volatile("dsb ishst; sev" ::: "memory");
+}
+
+void execute(FjTask* task, FjStats& st) {
+    TaskGroup* g = task->group;
+    task->run(task);
+    st.executed++;
+    g->finish();
+}
+
+// our newest task, or else the oldest one of some other taking part
+FjTask* findWork(uint32_t me, Worker& w) {
+    FjTask* task;
+    {
+        // the deque is this core's, no other task here may touch it meanwhile
+        PreemptGuard pg;
+        if (w.deque.take(task)) return task;
+    }
+    uint32_t n = active.get<MO_RELAXED>();
+    if (n <= 1) return nullptr;
+    w.seed = w.seed * 1103515245 + 12345;
+    uint32_t first = (w.seed >> 8) % n;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t victim = (first + i) % n;
+        if (victim == me) continue;
+        if (workers.forCPU(victim).deque.steal(task)) {
+            w.stats.stolen++;
+            return task;
+        }
+        w.stats.failedSteals++;
+    }
+    return nullptr;
+}
+
+bool anyWork() {
+    uint32_t n = active.get<MO_RELAXED>();
+    for (uint32_t core = 0; core < n; core++) {
+        if (workers.forCPU(core).deque.size() != 0) return true;
+    }
+    return false;
+}
+
+// WFE unless work or the end showed up after we registered as a sleeper;
+// a spawn that comes later sees us in `sleepers` and sends the event
+void rest(Worker& w) {
+    sleepers.fetch_add(1);
+    if (done.get() == 0 && !anyWork()) {
+        w.stats.sleeps++;
+        asm volatile("wfe" ::: "memory");
+    }
+    sleepers.fetch_sub(1);
+}
+
+}
+
+void fj_push(FjTask* task) {
+    bool pushed;
+    FjStats* st;
+    {
+        PreemptGuard pg;
+        Worker& w = workers.mine();
+        st = &w.stats;
+        pushed = w.deque.push(task);
+        if (pushed) w.stats.spawned++;
+    }
+    if (!pushed) {
+        st->inlined++;
+        execute(task, *st);
+        return;
+    }
+    // the new bottom before we look for sleepers, see rest()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (sleepers.get<MO_RELAXED>() != 0) wake();
+}
+
+void fj_wait(TaskGroup& g) {
+    uint32_t me = getCoreID();
+    Worker& w = workers.forCPU(me);
+    while (!g.finished()) {
+        FjTask* task = findWork(me, w);
+        if (task != nullptr) {
+            execute(task, w.stats);
+        } else {
+            // what's left is running elsewhere
+            iAmStuckInALoop(false);
+        }
+    }
+}
+
+bool fj_start(uint32_t cores) {
+    uint32_t me = getCoreID();
+    if (cores < 1) cores = 1;
+    if (cores > 4) cores = 4;
+    if (me == 0) {
+        active.set(cores);
+        done.set(0);
+    }
+    phase.sync();
+    if (me == 0) return true;
+    if (me >= active.get()) return false;
+
+    Worker& w = workers.forCPU(me);
+    w.seed = me * 7919 + 1;
+    while (done.get<MO_ACQUIRE>() == 0) {
+        FjTask* task = findWork(me, w);
+        if (task != nullptr) {
+            execute(task, w.stats);
+        } else {
+            rest(w);
+        }
+    }
+    return false;
+}
+
+void fj_stop() {
+    done.set(1);
+    wake();
+}
+
+void fj_end() {
+    phase.sync();
+}
+
+void fj_stats(uint32_t core, FjStats& st) {
+    st = workers.forCPU(core).stats;
+}
+
+void fj_stats_print() {
+    for (uint32_t core = 0; core < 4; core++) {
+        FjStats st;
+        fj_stats(core, st);
+        printf("| fj core %d: %d spawned, %d inlined, %d executed, %d stolen, %d failed steals, %d sleeps\n",
+            core, (uint32_t) st.spawned, (uint32_t) st.inlined, (uint32_t) st.executed,
+            (uint32_t) st.stolen, (uint32_t) st.failedSteals, (uint32_t) st.sleeps);
+    }
+}
@@ -0,0 +1,113 @@
+#include "fpsimd.h"
+#include "arm/sysregs.h"
+#include "percpu.h"
+#include "utils.h"
+#include "printf.h"
+
+namespace {
+
+// written by its own core only, with IRQs masked
+struct FpCore {
+    task_struct* owner;     // whose registers are loaded, if anyone's
+    FpStats stats;
+};
+
+PaddedPerCPU<FpCore> fpCores;
+
+// what a task starts with: all zeros, default FPCR
+const fpsimd_state initialState{};
+
+inline bool fpOn() {
+    uint64_t cpacr;
+    asm volatile("mrs %0, cpacr_el1" : "=r"(cpacr));
+    return (cpacr >> CPACR_FPEN_SHIFT) & 1;
+}
+
+inline void fpSet(bool on) {
+    uint64_t cpacr;
+    asm volatile("mrs %0, cpacr_el1" : "=r"(cpacr));
+    cpacr &= ~(uint64_t) CPACR_FPEN;
+    if (on) cpacr |= CPACR_FPEN;
+    asm volatile("msr cpacr_el1, %0; isb" :: "r"(cpacr) : "memory");
+}
+
+}
+
+void fpsimd_init() {
+    FpCore& c = fpCores.mine();
+    task_struct* t = current;
+    t->flags |= PF_USED_FP;
+    c.owner = t;
+    fpSet(true);
+}
+
+void fpsimd_switch(task_struct* next) {
+    bool on = fpCores.mine().owner == next;
+    if (on != fpOn()) fpSet(on);
+}
+
+void fpsimd_trap() {
+    FpCore& c = fpCores.mine();
+    task_struct* t = current;
+    c.stats.traps++;
+    fpSet(true);
+    if (t == nullptr) return;
+
+    // the interrupted code's registers weren't saved by irq_entry, so
+    // they go back to their owner first, even if that is this task;
+    // irq_entry turns the unit back off on the way out
+    if (in_irq()) {
+        if (c.owner != nullptr) {
+            fpsimd_save(&c.owner->fpsimd);
+            c.stats.saves++;
+            c.owner = nullptr;
+        }
+        c.stats.borrows++;
+        return;
+    }
+
+    if (c.owner == t) return;
+    if (c.owner != nullptr) {
+        fpsimd_save(&c.owner->fpsimd);
+        c.stats.saves++;
+    }
+    fpsimd_load((t->flags & PF_USED_FP) ? &t->fpsimd : &initialState);
+    c.stats.restores++;
+    t->flags |= PF_USED_FP;
+    c.owner = t;
+}
+
+void fpsimd_release(task_struct* t) {
+    unsigned long flags = irq_save();
+    FpCore& c = fpCores.mine();
+    if (c.owner == t) c.owner = nullptr;
+    irq_restore(flags);
+}
+
+void fpsimd_flush(task_struct* t) {
+    FpCore& c = fpCores.mine();
+    if (c.owner != t) return;
+    fpSet(true);
+    fpsimd_save(&t->fpsimd);
+    c.stats.saves++;
+    // nobody owns the registers now, so whoever runs traps
+    __atomic_store_n(&c.owner, nullptr, __ATOMIC_RELAXED);
+    fpSet(false);
+}
+
+bool fpsimd_loaded(uint32_t core, task_struct* t) {
+    return __atomic_load_n(&fpCores.forCPU(core).owner, __ATOMIC_RELAXED) == t;
+}
+
+void fpsimd_stats(uint32_t core, FpStats& st) {
+    st = fpCores.forCPU(core).stats;
+}
+
+void fpsimd_stats_print() {
+    for (uint32_t core = 0; core < 4; core++) {
+        FpStats st;
+        fpsimd_stats(core, st);
+        printf("| fpsimd core %d: %d traps, %d saves, %d restores, %d borrowed in IRQs\n",
+            core, (uint32_t) st.traps, (uint32_t) st.saves, (uint32_t) st.restores, (uint32_t) st.borrows);
+    }
+}
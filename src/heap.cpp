@@ -2,17 +2,39 @@
 #include "printf.h"
 #include "stdint.h"
 #include "atomic.h"
+#include "percpu.h"
 
-/* A first-fit heap */
+/* A good-fit heap with segregated free lists */
 
 
 namespace gheith {
 static int64_t *array;
 static int64_t len;
 static int safe = 0;
-static int avail = 0;
 static SpinLock *theLock = nullptr;
 
+/*
+ * Segregated free lists (TLSF style)
+ *
+ * Every available block sits on one of FL_COUNT x SL_COUNT doubly linked
+ * lists. The first level is the power of two of the block size and the
+ * second level splits that power of two into SL_COUNT equal ranges.
+ * flBitmap has a bit per first level with a non-empty list and
+ * slBitmap[fl] a bit per non-empty list in that level, so finding a
+ * block that fits is two bit scans instead of a list walk.
+ */
+constexpr int SL_BITS = 3;
+constexpr int SL_COUNT = 1 << SL_BITS;
+constexpr int FL_COUNT = 32;
+
+static int bins[FL_COUNT][SL_COUNT];
+static uint32_t flBitmap = 0;
+static uint32_t slBitmap[FL_COUNT];
+
+// units handed out by the lists (magazine contents included), under the lock
+static int takenUnits = 0;
+static int peakUnits = 0;
+
 void makeTaken(int i, int ints);
 void makeAvail(int i, int ints);
 
@@ -20,8 +42,18 @@ int abs(int x) {
     if (x < 0) return -x; else return x;
 }
 
+/*
+ * Tags are kept in the low 32 bits of the header and footer words. The
+ * header of a block handed out by a magazine also records the core that
+ * handed it out in the high 32 bits; makeTaken's sign extension leaves
+ * -1 there, meaning no owner.
+ */
+int tag(int i) {
+    return (int) array[i];
+}
+
 int size(int i) {
-    return abs(array[i]);
+    return abs(tag(i));
 }
 
 int headerFromFooter(int i) {
@@ -44,8 +76,8 @@ int sanity(int i) {
             panic("bad footer index %d\n",footer);
             return i;
         }
-        int hv = array[i];
-        int fv = array[footer];
+        int hv = tag(i);
+        int fv = tag(footer);
   
         if (hv != fv) {
             panic("bad block at %d, hv:%d fv:%d\n", i,hv,fv);
@@ -80,13 +112,36 @@ void setPrev(int i, int x) {
     array[i+2] = x;
 }
 
+int msb(uint32_t x) {
+    return 31 - __builtin_clz(x);
+}
+
+/* list a block of sz units belongs on */
+void mapping(int sz, int& fl, int& sl) {
+    if (sz < SL_COUNT) {
+        fl = 0;
+        sl = sz;
+    } else {
+        int m = msb(sz);
+        fl = m - SL_BITS + 1;
+        sl = (sz >> (m - SL_BITS)) - SL_COUNT;
+    }
+}
+
 void remove(int i) {
+    int fl, sl;
+    mapping(size(i), fl, sl);
+
     int prevIndex = prev(i);
     int nextIndex = next(i);
 
     if (prevIndex == 0) {
         /* at head */
-        avail = nextIndex;
+        bins[fl][sl] = nextIndex;
+        if (nextIndex == 0) {
+            slBitmap[fl] &= ~(1u << sl);
+            if (slBitmap[fl] == 0) flBitmap &= ~(1u << fl);
+        }
     } else {
         /* in the middle */
         setNext(prevIndex,nextIndex);
@@ -99,12 +154,18 @@ void remove(int i) {
 void makeAvail(int i, int ints) {
     array[i] = ints;
     array[footerFromHeader(i)] = ints;    
-    setNext(i,avail);
+
+    int fl, sl;
+    mapping(ints, fl, sl);
+    int head = bins[fl][sl];
+    setNext(i,head);
     setPrev(i,0);
-    if (avail != 0) {
-        setPrev(avail,i);
+    if (head != 0) {
+        setPrev(head,i);
     }
-    avail = i;
+    bins[fl][sl] = i;
+    slBitmap[fl] |= 1u << sl;
+    flBitmap |= 1u << fl;
 }
 
 void makeTaken(int i, int ints) {
@@ -113,87 +174,555 @@ void makeTaken(int i, int ints) {
 }
 
 int isAvail(int i) {
-    return array[i] > 0;
+    return tag(i) > 0;
 }
 
 int isTaken(int i) {
-    return array[i] < 0;
+    return tag(i) < 0;
+}
+
+//LockGuard needs mmu enabled in order to run correctly as it uses atomic operations
+SpinLock* heapLock() {
+    return coresAwoken ? theLock : nullptr;
+}
+
+/*
+ * Look for a block of at least `units`. The list the request itself maps
+ * to holds the tightest fits, so a few of its entries are probed first.
+ * Failing that the request is rounded up to the next list boundary and
+ * the first non-empty list from there on is used; every block on it is
+ * big enough, so that step never walks a list.
+ */
+constexpr int EXACT_PROBES = 4;
+
+int findBlock(int units) {
+    int fl, sl;
+    mapping(units, fl, sl);
+    if (fl >= FL_COUNT) return 0;
+
+    int currentIndex = bins[fl][sl];
+    for (int probes = 0; currentIndex != 0 && probes < EXACT_PROBES; probes++) {
+        if (size(currentIndex) >= units) return currentIndex;
+        currentIndex = next(currentIndex);
+    }
+
+    int target = units;
+    if (target >= SL_COUNT) {
+        target += (1 << (msb(target) - SL_BITS)) - 1;
+    }
+    mapping(target, fl, sl);
+    if (fl >= FL_COUNT) return 0;
+
+    uint32_t slMap = slBitmap[fl] & (~0u << sl);
+    if (slMap == 0) {
+        uint32_t flMap = (fl + 1 < FL_COUNT) ? (flBitmap & (~0u << (fl + 1))) : 0;
+        if (flMap == 0) return 0;
+        fl = __builtin_ctz(flMap);
+        slMap = slBitmap[fl];
+    }
+    return bins[fl][__builtin_ctz(slMap)];
+}
+
+/* take a block of at least `units` off the free lists, caller holds the lock */
+int allocBlock(int units) {
+    int idx = findBlock(units);
+    if (idx == 0) return 0;
+
+    if (!isAvail(idx)) {
+        panic("block is not available in malloc %p\n", idx);
+    }
+    int blockSize = size(idx);
+
+    remove(idx);
+    int extra = blockSize - units;
+
+    // Split block if there's enough space left
+    if (extra >= 4) {
+        makeTaken(idx, units);
+        makeAvail(idx + units, extra);
+    } else {
+        makeTaken(idx, blockSize);
+    }
+
+    takenUnits += size(idx);
+    if (takenUnits > peakUnits) peakUnits = takenUnits;
+    return idx;
 }
+
+/* give a taken block back and coalesce with its neighbors, caller holds the lock */
+void freeBlock(int idx) {
+    int sz = size(idx);
+    takenUnits -= sz;
+
+    int leftIndex = left(idx);
+    int rightIndex = right(idx);
+
+    if (isAvail(leftIndex)) {
+        remove(leftIndex);
+        idx = leftIndex;
+        sz += size(leftIndex);
+    }
+
+    if (isAvail(rightIndex)) {
+        remove(rightIndex);
+        sz += size(rightIndex);
+    }
+
+    makeAvail(idx,sz);
+}
+
+/*
+ * Per-core magazines
+ *
+ * Small requests are rounded up to one of MAG_CLASSES block sizes and
+ * served from a per-core LIFO of free blocks, without the heap lock and
+ * without atomics. Cached blocks stay taken as far as the heap above is
+ * concerned, so coalescing never sees them. An empty magazine is refilled
+ * with MAG_BATCH blocks under a single lock acquisition, and a magazine
+ * that grows past MAG_LIMIT hands MAG_BATCH blocks back the same way.
+ */
+constexpr int MAG_CLASSES = 6;
+constexpr int MAG_BATCH = 8;
+constexpr int MAG_LIMIT = 2 * MAG_BATCH;
+
+// block sizes in units, header and footer included (16 to 512 byte payloads)
+constexpr int magUnits[MAG_CLASSES] = { 4, 6, 10, 18, 34, 66 };
+
+struct MagBlock {
+    MagBlock* next;
 };
 
-void heapInit(void* base, size_t bytes) {
-    using namespace gheith;
+struct Magazine {
+    MagBlock* top[MAG_CLASSES];
+    int count[MAG_CLASSES];
+};
 
-    printf_no_lock("| heap range 0x%x 0x%x\n", (uint64_t)base, (uint64_t)base + bytes);
+// padded so the fast path never shares a line with another core
+static PaddedPerCPU<Magazine> magazines;
 
-    // Cast to uint64_t pointer for 64-bit systems
-    array = (int64_t*) base;
-    len = bytes / sizeof(uint64_t); // Divide by 8 instead of 4 for 64-bit alignment
+/* smallest class that fits, -1 if the request is too big */
+int magClass(int units) {
+    for (int c = 0; c < MAG_CLASSES; c++) {
+        if (units <= magUnits[c]) return c;
+    }
+    return -1;
+}
 
-    // Initialize the heap: Reserved blocks at both ends
-    makeTaken(0, 2);             // Mark the beginning as taken
-    makeAvail(2, len - 4);       // The main heap space available
-    makeTaken(len - 2, 2);       // Mark the end as taken
+/*
+ * class a block of this size can be cached in, -1 if none. allocBlock
+ * doesn't split off less than 4 units, so a class also owns blocks up
+ * to 3 units bigger than its nominal size.
+ */
+int magClassOf(int units) {
+    for (int c = MAG_CLASSES - 1; c >= 0; c--) {
+        if (units >= magUnits[c]) return (units - magUnits[c] < 4) ? c : -1;
+    }
+    return -1;
+}
 
-    theLock = new SpinLock();
+void* payload(int idx) {
+    return reinterpret_cast<void*>(&array[idx + 1]);
 }
 
+int blockIndex(void* p) {
+    return ((((uintptr_t) p) - ((uintptr_t) array)) / sizeof(int64_t)) - 1;
+}
 
-void* malloc(size_t bytes) {
-    using namespace gheith;
+void magPush(Magazine& mag, int c, void* p) {
+    MagBlock* b = (MagBlock*) p;
+    b->next = mag.top[c];
+    mag.top[c] = b;
+    mag.count[c]++;
+}
+
+void* magPop(Magazine& mag, int c) {
+    MagBlock* b = mag.top[c];
+    if (b == nullptr) return nullptr;
+    mag.top[c] = b->next;
+    mag.count[c]--;
+    return b;
+}
+
+/*
+ * carve up to MAG_BATCH blocks of class c out of one heap block, so a
+ * batch sits together in memory instead of being spread over the heap
+ */
+void magRefill(Magazine& mag, int c) {
+    LockGuardP g{heapLock()};
+    int units = magUnits[c];
+    int n = MAG_BATCH;
+    int idx = 0;
+    while (n > 0 && (idx = allocBlock(n * units)) == 0) {
+        n /= 2;
+    }
+    if (idx == 0) return;
+
+    int remaining = size(idx);
+    for (int i = 0; i < n; i++) {
+        int sz = (i == n - 1) ? remaining : units;
+        makeTaken(idx, sz);
+        magPush(mag, c, payload(idx));
+        idx += sz;
+        remaining -= sz;
+    }
+}
+
+/* hand n cached blocks of class c back to the heap */
+void magDrain(Magazine& mag, int c, int n) {
+    LockGuardP g{heapLock()};
+    while (n-- > 0) {
+        void* p = magPop(mag, c);
+        if (p == nullptr) break;
+        freeBlock(blockIndex(p));
+    }
+}
+
+/* return everything this core has cached, used before giving up on a request */
+void magFlush(Magazine& mag) {
+    for (int c = 0; c < MAG_CLASSES; c++) {
+        magDrain(mag, c, mag.count[c]);
+    }
+}
+
+/*
+ * Remote frees
+ *
+ * A magazine block remembers the core that handed it out. When another
+ * core frees it, the block goes on the owner's RemoteFrees list with a
+ * CAS instead of into the freeing core's magazine, so a producer core
+ * gets its blocks back from a consumer core without either of them
+ * taking the heap lock. The owner takes the whole list with a single
+ * exchange when one of its magazine classes runs dry, and before it
+ * flushes. Only the owner ever takes, so the list has no ABA problem.
+ */
+struct RemoteFrees {
+    Atomic<MagBlock*> head;
+    Atomic<uint32_t> bytes;     // payload bytes on the list, for heap_stats
+    constexpr RemoteFrees() : head(nullptr), bytes(0) {}
+};
+
+static PaddedPerCPU<RemoteFrees> remotes;
+
+int blockOwner(int idx) {
+    return (int) (array[idx] >> 32);
+}
+
+void setOwner(int idx, int core) {
+    array[idx] = (((int64_t) core) << 32) | (uint32_t) tag(idx);
+}
+
+void remotePush(RemoteFrees& r, void* p, int bytes) {
+    MagBlock* b = (MagBlock*) p;
+    r.bytes.add_fetch<MO_RELAXED>(bytes);
+    MagBlock* head = r.head.get<MO_RELAXED>();
+    do {
+        b->next = head;
+    } while (!r.head.compare_exchange_weak<MO_RELEASE>(head, b));
+}
+
+/* move everything other cores freed back into this core's magazine */
+void remoteReclaim(Magazine& mag, RemoteFrees& r) {
+    if (r.head.get<MO_RELAXED>() == nullptr) return;
+    MagBlock* list = r.head.exchange<MO_ACQUIRE>(nullptr);
+    uint32_t bytes = 0;
+    while (list != nullptr) {
+        MagBlock* b = list;
+        list = b->next;
+        int idx = blockIndex(b);
+        bytes += (size(idx) - 2) * sizeof(int64_t);
+        magPush(mag, magClassOf(size(idx)), b);
+    }
+    r.bytes.fetch_sub<MO_RELAXED>(bytes);
+    for (int c = 0; c < MAG_CLASSES; c++) {
+        if (mag.count[c] > MAG_LIMIT) magDrain(mag, c, mag.count[c] - MAG_LIMIT);
+    }
+}
+
+/*
+ * Statistics
+ *
+ * Call counts and live bytes are kept per core and only ever touched by
+ * their own core, so the fast path pays a few plain increments. A block
+ * freed on another core than the one that allocated it makes both
+ * cores' liveBytes wrong on their own, only the sum means anything.
+ * Allocation sites are only recorded while heap_track_sites(true).
+ */
+constexpr int SITES = 32;
+
+struct SiteCount {
+    void* site;
+    uint32_t count;
+    uint32_t bytes;
+};
 
+struct HeapCounters {
+    int64_t liveBytes;
+    uint32_t mallocs;
+    uint32_t frees;
+    uint32_t failed;
+    uint32_t untracked;    // allocations whose site didn't fit in sites[]
+    SiteCount sites[SITES];
+};
+
+static PaddedPerCPU<HeapCounters> counters;
+static bool trackSites = false;
+
+int payloadBytes(int idx) {
+    return (size(idx) - 2) * sizeof(int64_t);
+}
+
+void countSite(HeapCounters& hc, void* site, int bytes) {
+    int h = (((uintptr_t) site) >> 2) % SITES;
+    for (int i = 0; i < SITES; i++) {
+        SiteCount& sc = hc.sites[(h + i) % SITES];
+        if (sc.site == site || sc.site == nullptr) {
+            sc.site = site;
+            sc.count++;
+            sc.bytes += bytes;
+            return;
+        }
+    }
+    hc.untracked++;
+}
+
+void* alloc(size_t bytes, void* site) {
     // Return early for zero allocation
     if (bytes == 0) return nullptr;
 
     // Align size for 64-bit (8 bytes)
     int units = ((bytes + 7) / 8) + 2;  // Aligning to 8 bytes instead of 4
     if (units < 4) units = 4;  // Ensure a minimum block size
-    
-    //LockGuard needs mmu enabled in order to run correctly as it uses atomic operations
-    if(coresAwoken){
-        LockGuardP g{theLock};
+
+    // the magazines and counters are this core's, nothing else may use them meanwhile
+    PreemptGuard pg;
+    void* p;
+    int c = magClass(units);
+    if (c >= 0) {
+        int me = getCoreID();
+        Magazine& mag = magazines.forCPU(me);
+        if (mag.count[c] == 0) {
+            remoteReclaim(mag, remotes.forCPU(me));
+            if (mag.count[c] == 0) magRefill(mag, c);
+            if (mag.count[c] == 0) {
+                magFlush(mag);
+                magRefill(mag, c);
+            }
+        }
+        p = magPop(mag, c);
+        if (p != nullptr) setOwner(blockIndex(p), me);
+    } else {
+        int idx;
+        {
+            LockGuardP g{heapLock()};
+            idx = allocBlock(units);
+        }
+        if (idx == 0) {
+            Magazine& mag = magazines.mine();
+            remoteReclaim(mag, remotes.mine());
+            magFlush(mag);
+            LockGuardP g{heapLock()};
+            idx = allocBlock(units);
+        }
+        p = (idx == 0) ? nullptr : payload(idx);
+    }
+
+    HeapCounters& hc = counters.mine();
+    if (p == nullptr) {
+        hc.failed++;
+        return nullptr;
+    }
+    int got = payloadBytes(blockIndex(p));
+    hc.mallocs++;
+    hc.liveBytes += got;
+    if (trackSites) countSite(hc, site, got);
+    return p;
+}
+
+/*
+ * Carve a block whose payload is `align` aligned out of one that is big
+ * enough for any placement. The leading gap goes back on the free lists
+ * (it's either empty or at least a minimum block, so it can hold its own
+ * tags) and so does whatever is left past `units`. Caller holds the lock.
+ */
+int allocAlignedBlock(int units, size_t align) {
+    int a = align / sizeof(int64_t);
+    int idx = allocBlock(units + a + 3);
+    if (idx == 0) return 0;
+
+    uintptr_t p = (uintptr_t) payload(idx);
+    int lead = (((p + align - 1) & ~(uintptr_t)(align - 1)) - p) / sizeof(int64_t);
+    while (lead != 0 && lead < 4) lead += a;
+
+    int total = size(idx);
+    int at = idx + lead;
+    int rest = total - lead;
+    if (rest - units >= 4) {
+        makeTaken(at, units);
+        makeTaken(at + units, rest - units);
+        freeBlock(at + units);
+    } else {
+        makeTaken(at, rest);
+    }
+    if (lead != 0) {
+        makeTaken(idx, lead);
+        freeBlock(idx);
     }
+    return at;
+}
+
+void* allocAligned(size_t align, size_t bytes, void* site) {
+    if (bytes == 0) return nullptr;
+    if ((align & (align - 1)) != 0) return nullptr;
+    if (align <= sizeof(int64_t)) return alloc(bytes, site);
 
-    void* res = nullptr;
-    int minSize = 0x7FFFFFFF;
-    int bestFitIndex = 0;
+    int units = ((bytes + 7) / 8) + 2;
+    if (units < 4) units = 4;
 
+    PreemptGuard pg;
+    int idx;
     {
-        int attempts = 20;  // Prevent infinite loops
-        int currentIndex = avail;
-        while (currentIndex != 0) {
-            if (!isAvail(currentIndex)) {
-                panic("block is not available in malloc %p\n", currentIndex);
-            }
-            int blockSize = size(currentIndex);
+        LockGuardP g{heapLock()};
+        idx = allocAlignedBlock(units, align);
+    }
+    if (idx == 0) {
+        Magazine& mag = magazines.mine();
+        remoteReclaim(mag, remotes.mine());
+        magFlush(mag);
+        LockGuardP g{heapLock()};
+        idx = allocAlignedBlock(units, align);
+    }
 
-            if (blockSize >= units && blockSize < minSize) {
-                minSize = blockSize;
-                bestFitIndex = currentIndex;
-            }
-            attempts--;
-            if (attempts == 0) break;
+    HeapCounters& hc = counters.mine();
+    if (idx == 0) {
+        hc.failed++;
+        return nullptr;
+    }
+    int got = payloadBytes(idx);
+    hc.mallocs++;
+    hc.liveBytes += got;
+    if (trackSites) countSite(hc, site, got);
+    return payload(idx);
+}
 
-            currentIndex = next(currentIndex);
+/* walk every block by its boundary tags, caller holds the lock */
+void summarize(HeapStats& st) {
+    for (int i = 2; i < len - 2; i += size(i)) {
+        int footer = footerFromHeader(i);
+        if (size(i) < 4 || footer >= len - 2 || tag(i) != tag(footer)) {
+            panic("heap_stats: bad block at %d, hv:%d fv:%d\n", i, tag(i), tag(footer));
+        }
+        if (isAvail(i)) {
+            uint32_t bytes = (size(i) - 2) * sizeof(int64_t);
+            int bucket = msb(bytes) - 4;   // 16..31 bytes is bucket 0
+            if (bucket < 0) bucket = 0;
+            if (bucket >= HEAP_HIST_BUCKETS) bucket = HEAP_HIST_BUCKETS - 1;
+            st.freeHistogram[bucket]++;
+            st.freeBlocks++;
+            st.freeBytes += bytes;
+            if (bytes > st.largestFree) st.largestFree = bytes;
+        } else {
+            st.takenBlocks++;
         }
     }
+    st.heapBytes = (len - 4) * sizeof(int64_t);
+    st.takenBytes = takenUnits * sizeof(int64_t);
+    st.peakBytes = peakUnits * sizeof(int64_t);
+}
+};
 
-    if (bestFitIndex != 0) {
-        remove(bestFitIndex);
-        int extra = minSize - units;
-        
-        // Split block if there's enough space left
-        if (extra >= 4) {
-            makeTaken(bestFitIndex, units);
-            makeAvail(bestFitIndex + units, extra);
-        } else {
-            makeTaken(bestFitIndex, minSize);
+void heap_checks(bool on) {
+    gheith::safe = on;
+}
+
+void heap_track_sites(bool on) {
+    gheith::trackSites = on;
+}
+
+void heap_stats(HeapStats& st) {
+    using namespace gheith;
+
+    st = HeapStats{};
+    {
+        LockGuardP g{heapLock()};
+        summarize(st);
+    }
+    for (int id = 0; id < 4; id++) {
+        HeapCounters& hc = counters.forCPU(id);
+        st.liveBytes += hc.liveBytes;
+        st.mallocs += hc.mallocs;
+        st.frees += hc.frees;
+        st.failed += hc.failed;
+        Magazine& mag = magazines.forCPU(id);
+        for (int c = 0; c < MAG_CLASSES; c++) {
+            st.cachedBytes += mag.count[c] * (magUnits[c] - 2) * sizeof(int64_t);
         }
+        st.remoteBytes += remotes.forCPU(id).bytes.get();
+    }
+}
+
+void heap_stats_print() {
+    using namespace gheith;
 
-        // Return pointer to the allocated memory area
-        res = reinterpret_cast<void*>(&array[bestFitIndex + 1]);
+    HeapStats st;
+    heap_stats(st);
+
+    printf("| heap: %d bytes, %d live in %d calls, %d taken (peak %d), %d cached, %d remote\n",
+        (uint32_t) st.heapBytes, (uint32_t) st.liveBytes, st.mallocs - st.frees,
+        (uint32_t) st.takenBytes, (uint32_t) st.peakBytes, (uint32_t) st.cachedBytes,
+        (uint32_t) st.remoteBytes);
+    printf("| heap: %d mallocs, %d frees, %d failed\n", st.mallocs, st.frees, st.failed);
+    printf("| heap: %d free bytes in %d blocks, largest %d\n",
+        (uint32_t) st.freeBytes, st.freeBlocks, (uint32_t) st.largestFree);
+    for (int b = 0; b < HEAP_HIST_BUCKETS; b++) {
+        if (st.freeHistogram[b] != 0) {
+            printf("| heap:   free %d+ bytes: %d\n", 16 << b, st.freeHistogram[b]);
+        }
     }
-    return res;
+
+    if (!trackSites) return;
+    uint32_t untracked = 0;
+    for (int id = 0; id < 4; id++) {
+        HeapCounters& hc = counters.forCPU(id);
+        untracked += hc.untracked;
+        for (int i = 0; i < SITES; i++) {
+            SiteCount& sc = hc.sites[i];
+            if (sc.site == nullptr) continue;
+            printf("| heap:   site 0x%x core %d: %d allocations, %d bytes\n",
+                (uint32_t)(uintptr_t) sc.site, id, sc.count, sc.bytes);
+        }
+    }
+    if (untracked != 0) printf("| heap:   %d allocations from untracked sites\n", untracked);
+}
+
+void heapInit(void* base, size_t bytes) {
+    using namespace gheith;
+
+    printf_no_lock("| heap range 0x%x 0x%x\n", (uint64_t)base, (uint64_t)base + bytes);
+
+    // Cast to uint64_t pointer for 64-bit systems
+    array = (int64_t*) base;
+    len = bytes / sizeof(uint64_t); // Divide by 8 instead of 4 for 64-bit alignment
+
+    // Initialize the heap: Reserved blocks at both ends
+    makeTaken(0, 2);             // Mark the beginning as taken
+    makeAvail(2, len - 4);       // The main heap space available
+    makeTaken(len - 2, 2);       // Mark the end as taken
+
+    theLock = new SpinLock("heap");
+}
+
+
+void* malloc(size_t bytes) {
+    return gheith::alloc(bytes, __builtin_return_address(0));
+}
+
+
+void* aligned_alloc(size_t align, size_t bytes) {
+    return gheith::allocAligned(align, bytes, __builtin_return_address(0));
+}
+
+void* memalign(size_t align, size_t bytes) {
+    return gheith::allocAligned(align, bytes, __builtin_return_address(0));
 }
 
 
@@ -202,34 +731,36 @@ void free(void* p) {
     if (p == 0) return;
     if (p == (void*) array) return;
 
-    if(coresAwoken){
-        LockGuardP g{theLock};
-    }
-
-    int idx = ((((uintptr_t) p) - ((uintptr_t) array)) / 4) - 1;
+    int idx = blockIndex(p);
     sanity(idx);
     if (!isTaken(idx)) {
-        panic("freeing free block, p:%x idx:%d\n",(uint32_t) p,(int32_t) idx);
+        panic("freeing free block, p:%x idx:%d\n",(uint32_t)(uintptr_t) p,(int32_t) idx);
         return;
     }
 
-    int sz = size(idx);
-
-    int leftIndex = left(idx);
-    int rightIndex = right(idx);
-
-    if (isAvail(leftIndex)) {
-        remove(leftIndex);
-        idx = leftIndex;
-        sz += size(leftIndex);
-    }
-
-    if (isAvail(rightIndex)) {
-        remove(rightIndex);
-        sz += size(rightIndex);
+    PreemptGuard pg;
+    HeapCounters& hc = counters.mine();
+    hc.frees++;
+    hc.liveBytes -= payloadBytes(idx);
+
+    int c = magClassOf(size(idx));
+    if (c >= 0) {
+        int me = getCoreID();
+        int owner = blockOwner(idx);
+        if (owner >= 0 && owner != me) {
+            remotePush(remotes.forCPU(owner), p, payloadBytes(idx));
+            return;
+        }
+        Magazine& mag = magazines.forCPU(me);
+        magPush(mag, c, p);
+        if (mag.count[c] > MAG_LIMIT) {
+            magDrain(mag, c, MAG_BATCH);
+        }
+        return;
     }
 
-    makeAvail(idx,sz);
+    LockGuardP g{heapLock()};
+    freeBlock(idx);
 }
 
 
@@ -238,7 +769,7 @@ void free(void* p) {
 /*****************/
 
 void* operator new(size_t size) {
-    void* p =  malloc(size);
+    void* p =  gheith::alloc(size, __builtin_return_address(0));
     if (p == 0) panic("out of memory");
     return p;
 }
@@ -252,7 +783,7 @@ void operator delete(void* p, size_t sz) {
 }
 
 void* operator new[](size_t size) {
-    void* p =  malloc(size);
+    void* p =  gheith::alloc(size, __builtin_return_address(0));
     if (p == 0) panic("out of memory");
     return p;
 }
@@ -264,3 +795,33 @@ void operator delete[](void* p) noexcept {
 void operator delete[](void* p, size_t sz) {
     return free(p);
 }
+
+/* over-aligned types, e.g. anything holding a PaddedPerCPU */
+
+void* operator new(size_t size, std::align_val_t align) {
+    void* p = gheith::allocAligned((size_t) align, size, __builtin_return_address(0));
+    if (p == 0) panic("out of memory");
+    return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    return free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    return free(p);
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+    void* p = gheith::allocAligned((size_t) align, size, __builtin_return_address(0));
+    if (p == 0) panic("out of memory");
+    return p;
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    return free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    return free(p);
+}
@@ -0,0 +1,211 @@
+#include "ipi.h"
+#include "atomic.h"
+#include "percpu.h"
+#include "ring.h"
+#include "printf.h"
+#include "timer.h"
+
+/*
+ * The BCM2836 local peripherals (QA7 rev 3.4). Per core n:
+ *
+ *   0x50 + 4n   mailbox interrupt control, bit m routes mailbox m to IRQ
+ *   0x60 + 4n   IRQ source, bit 4 + m is mailbox m (bit 3 is the
+ *               virtual timer, see timer.cpp)
+ *   0x80 + 16n  mailbox 0 write-set
+ *   0xC0 + 16n  mailbox 0 read / write-1-to-clear
+ */
+namespace {
+
+constexpr uintptr_t LOCAL_PERIPHERALS = 0x40000000;
+constexpr uint32_t MAILBOX0_IRQ = 1u << 4;
+constexpr uint32_t CNTV_IRQ = 1u << 3;
+constexpr uint32_t CALL_RING = 64;
+constexpr uint32_t CALL_BATCH = 8;
+
+inline volatile uint32_t& localReg(uintptr_t offset) {
+    return *(volatile uint32_t*) (LOCAL_PERIPHERALS + offset);
+}
+
+inline volatile uint32_t& mailboxIrqControl(uint32_t core) {
+    return localReg(0x50 + 4 * core);
+}
+
+inline volatile uint32_t& irqSource(uint32_t core) {
+    return localReg(0x60 + 4 * core);
+}
+
+inline volatile uint32_t& mailboxSet(uint32_t core) {
+    return localReg(0x80 + 16 * core);
+}
+
+inline volatile uint32_t& mailboxClear(uint32_t core) {
+    return localReg(0xC0 + 16 * core);
+}
+
+inline uint32_t others(uint32_t mask) {
+    return mask & 0xf & ~(1u << getCoreID());
+}
+
+inline uint32_t countCores(uint32_t mask) {
+    return __builtin_popcount(mask);
+}
+
+struct Call {
+    IpiFunc func;
+    void* arg;
+    Atomic<uint32_t>* pending;      // counted down when func returns, if waited on
+};
+
+// one queue per target core, fed by everyone else
+MPMCRing<Call, CALL_RING> calls[4];
+
+PaddedPerCPU<IpiStats> counters;
+
+void (*volatile rescheduleHook)() = nullptr;
+
+// tlb_shootdown: one at a time, the others spin on the lock with IRQs on
+SpinLock shootLock{"tlb-shootdown"};
+uint64_t shootVa;
+Atomic<uint32_t> shootPending{0};
+
+void flushLocal(uint64_t va) {
+    if (va == TLB_ALL) {
+        asm volatile("dsb nshst; tlbi vmalle1; dsb nsh; isb" ::: "memory");
+    } else {
+        asm volatile("dsb nshst; tlbi vaae1, %0; dsb nsh; isb" :: "r"(va >> 12) : "memory");
+    }
+}
+
+void enqueue(uint32_t core, const Call& call) {
+    while (!calls[core].try_push(call)) {
+        // full: make sure the target is draining it
+        ipi_send(core, IPI_CALL);
+        iAmStuckInALoop(false);
+    }
+}
+
+void waitFor(Atomic<uint32_t>& pending) {
+    uint32_t left = pending.get<MO_ACQUIRE>();
+    while (left != 0) left = pending.wait_while(left);
+}
+
+void runCalls(uint32_t core, IpiStats& st) {
+    Call batch[CALL_BATCH];
+    uint32_t n;
+    while ((n = calls[core].pop_batch(batch, CALL_BATCH)) != 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            batch[i].func(batch[i].arg);
+            if (batch[i].pending != nullptr) batch[i].pending->sub_fetch<MO_RELEASE>(1);
+        }
+        st.calls += n;
+    }
+}
+
+}
+
+void ipiInit() {
+    uint32_t core = getCoreID();
+    mailboxClear(core) = ~0u;           // whatever the firmware left there
+    mailboxIrqControl(core) = 1;        // mailbox 0 -> IRQ
+    irq_enable();
+}
+
+void ipi_send_mask(uint32_t mask, IpiKind kind) {
+    // the stats are this core's, and reschedules are sent from IRQs too
+    uint64_t flags = irq_save();
+    IpiStats& st = counters.mine();
+    // everything written so far must be visible before the target's IRQ
+    asm volatile("dsb ishst" ::: "memory");
+    for (uint32_t core = 0; core < 4; core++) {
+        if (mask & (1u << core)) {
+            mailboxSet(core) = 1u << kind;
+            st.sent[kind]++;
+        }
+    }
+    irq_restore(flags);
+}
+
+void smp_call_function_single(uint32_t core, IpiFunc func, void* arg, bool wait) {
+    // "this core" has to stay this core until the call is queued
+    PreemptGuard pg;
+    if (core == getCoreID()) {
+        func(arg);
+        return;
+    }
+    smp_call_function_mask(1u << core, func, arg, wait);
+}
+
+void smp_call_function_mask(uint32_t mask, IpiFunc func, void* arg, bool wait) {
+    PreemptGuard pg;
+    uint32_t targets = others(mask);
+    if (targets == 0) return;
+    Atomic<uint32_t> pending{countCores(targets)};
+    Call call{func, arg, wait ? &pending : nullptr};
+    for (uint32_t core = 0; core < 4; core++) {
+        if (targets & (1u << core)) enqueue(core, call);
+    }
+    ipi_send_mask(targets, IPI_CALL);
+    if (wait) waitFor(pending);
+}
+
+void ipi_set_reschedule_hook(void (*hook)()) {
+    rescheduleHook = hook;
+}
+
+void tlb_shootdown(uint32_t mask, uint64_t va) {
+    PreemptGuard pg;
+    uint32_t targets = others(mask);
+    LockGuard g{shootLock};
+    shootVa = va;
+    shootPending.set<MO_RELEASE>(countCores(targets));
+    ipi_send_mask(targets, IPI_TLB);
+    flushLocal(va);
+    waitFor(shootPending);
+}
+
+extern "C" void irq_handler() {
+    uint32_t core = getCoreID();
+    IpiStats& st = counters.forCPU(core);
+
+    // the virtual timer and mailbox 0 are the only local sources we enable
+    uint32_t source = irqSource(core);
+    if (source & CNTV_IRQ) timer_irq();
+    if ((source & MAILBOX0_IRQ) == 0) {
+        if ((source & CNTV_IRQ) == 0) st.spurious++;
+        return;
+    }
+    // clear only what we read, anything raised meanwhile stays pending
+    uint32_t pending = mailboxClear(core);
+    mailboxClear(core) = pending;
+    // and see what the senders wrote before raising it
+    asm volatile("dmb ish" ::: "memory");
+
+    for (uint32_t k = 0; k < IPI_KINDS; k++) {
+        if (pending & (1u << k)) st.received[k]++;
+    }
+    if (pending & (1u << IPI_TLB)) {
+        flushLocal(shootVa);
+        shootPending.sub_fetch<MO_RELEASE>(1);
+    }
+    if (pending & (1u << IPI_CALL)) {
+        runCalls(core, st);
+    }
+    if (pending & (1u << IPI_RESCHEDULE)) {
+        void (*hook)() = rescheduleHook;
+        if (hook != nullptr) hook();
+    }
+}
+
+void ipi_stats(uint32_t core, IpiStats& st) {
+    st = counters.forCPU(core);
+}
+
+void ipi_stats_print() {
+    for (uint32_t core = 0; core < 4; core++) {
+        IpiStats st;
+        ipi_stats(core, st);
+        printf("| ipi core %d: sent %d/%d/%d/%d, received %d/%d/%d/%d (call/resched/tlb/wake), %d calls, %d spurious\n",
+            core, st.sent[0], st.sent[1], st.sent[2], st.sent[3],
+            st.received[0], st.received[1], st.received[2], st.received[3], st.calls, st.spurious);
+    }
+}
@@ -9,10 +9,16 @@
 #include "mmu.h"
 #include "kernel.h"
 #include "heap.h"
+#include "pages.h"
 #include "core.h"
+#include "ipi.h"
+#include "sched.h"
+#include "timer.h"
+#include "timeout.h"
 
 
 int onHypervisor;
+bool coresAwoken = false;
 
 
 #define PACKED __attribute__((__packed__))
@@ -280,8 +286,8 @@ extern char __heap_end;
 
 uint64_t __heap_size = ((uint64_t)__heap_end - (uint64_t)__heap_start);
 
-static Barrier* starting = nullptr;
-static Barrier* stopping = nullptr;
+// all cores meet here before and after kernelMain
+static SenseBarrier allCores{4};
 
 
 extern "C" void kernel_init() {
@@ -290,14 +296,17 @@ extern "C" void kernel_init() {
         init_printf(nullptr, uart_putc_wrapper);
         MMU_setup_pagetable();
         heapInit(&__heap_start, (uint64_t)(&__heap_end - &__heap_start));
-        starting = new Barrier(4);
-        stopping = new Barrier(4);
+        pageInit(&__heap_end);
         smpInitDone = true;
         coresAwoken = true;
         wake_up_cores();
     }
     MMU_enable();
-    starting->sync();
+    ipiInit();
+    sched_init();
+    timerInit();
+    timeoutInit();
+    allCores.sync();
     kernelMain();
-    stopping->sync();
+    allCores.sync();
 }
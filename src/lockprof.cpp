@@ -0,0 +1,71 @@
+#include "lockprof.h"
+#include "atomic.h"
+#include "printf.h"
+
+#ifdef LOCK_PROFILE
+
+static Atomic<LockProfile*> profiles{nullptr};
+
+// first acquisition, under the lock, so once per lock
+void LockProfile::add() {
+    registered = true;
+    LockProfile* head = profiles.get<MO_RELAXED>();
+    do {
+        next = head;
+    } while (!profiles.compare_exchange_weak<MO_RELEASE>(head, this));
+}
+
+static uint64_t tickFrequency() {
+    uint64_t f;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+}
+
+static uint32_t percent(uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0 : (uint32_t) (part * 100 / whole);
+}
+
+void lock_profile_report() {
+    printf("| lock profile (ticks at %d Hz):\n", (uint32_t) tickFrequency());
+    for (LockProfile* p = profiles.get<MO_ACQUIRE>(); p != nullptr; p = p->next) {
+        printf("| lock %s: %d acquired, %d contended (%d%%)\n",
+            p->name, (uint32_t) p->acquired, (uint32_t) p->contended, percent(p->contended, p->acquired));
+        printf("|   spin %d total, %d max; hold %d total, %d max\n",
+            (uint32_t) p->spinTicks, (uint32_t) p->maxSpin, (uint32_t) p->holdTicks, (uint32_t) p->maxHold);
+        for (int i = 0; i < LOCK_PROFILE_SITES; i++) {
+            LockSiteStats& s = p->sites[i];
+            if (s.site == nullptr) break;
+            printf("|   site 0x%x: %d acquired, %d contended, spin %d\n",
+                (uint32_t) (uintptr_t) s.site, (uint32_t) s.acquired, (uint32_t) s.contended, (uint32_t) s.spinTicks);
+        }
+        if (p->otherSites != 0) {
+            printf("|   other sites: %d acquired\n", (uint32_t) p->otherSites);
+        }
+    }
+}
+
+void lock_profile_reset() {
+    for (LockProfile* p = profiles.get<MO_ACQUIRE>(); p != nullptr; p = p->next) {
+        p->acquired = 0;
+        p->contended = 0;
+        p->spinTicks = 0;
+        p->maxSpin = 0;
+        p->holdTicks = 0;
+        p->maxHold = 0;
+        p->otherSites = 0;
+        for (int i = 0; i < LOCK_PROFILE_SITES; i++) {
+            p->sites[i] = LockSiteStats{};
+        }
+    }
+}
+
+#else
+
+void lock_profile_report() {
+    printf("| lock profile: not compiled in, build with LOCK_PROFILE=1\n");
+}
+
+void lock_profile_reset() {
+}
+
+#endif
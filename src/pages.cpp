@@ -0,0 +1,260 @@
+#include "pages.h"
+#include "printf.h"
+#include "atomic.h"
+#include "percpu.h"
+#include "mm.h"
+#include "rpi-SmartStart.h"
+
+/*
+ * Binary buddy allocator over 4 KB pages.
+ *
+ * The managed range starts on a 2 MB boundary so a block of order k
+ * always starts on a 2^k page boundary and its buddy is found by flipping
+ * bit k of the page number. map[] keeps one byte per page: blocks that
+ * are free or handed out record FREE/TAKEN and their order in the byte
+ * of their first page, every other byte is 0. Free blocks are linked
+ * through their own first page.
+ */
+
+namespace buddy {
+
+constexpr uint8_t ORDER_MASK = 0x0F;
+constexpr uint8_t FREE = 0x10;
+constexpr uint8_t TAKEN = 0x20;
+
+constexpr uintptr_t MAX_BLOCK = uintptr_t(PAGE_SIZE) << PAGE_MAX_ORDER;
+
+struct FreePage {
+    FreePage* next;
+    FreePage* prev;
+};
+
+static uintptr_t base = 0;
+static size_t npages = 0;
+static uint8_t* map = nullptr;
+static FreePage* lists[PAGE_MAX_ORDER + 1];
+static size_t freeCount = 0;
+static SpinLock lock{"pages"};
+
+//LockGuard needs mmu enabled in order to run correctly as it uses atomic operations
+SpinLock* pageLock() {
+    return coresAwoken ? &lock : nullptr;
+}
+
+uintptr_t alignUp(uintptr_t x, uintptr_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+size_t pfn(void* p) {
+    return ((uintptr_t) p - base) >> PAGE_SHIFT;
+}
+
+FreePage* page(size_t n) {
+    return (FreePage*) (base + (n << PAGE_SHIFT));
+}
+
+void push(size_t n, int order) {
+    FreePage* p = page(n);
+    p->prev = nullptr;
+    p->next = lists[order];
+    if (p->next != nullptr) p->next->prev = p;
+    lists[order] = p;
+    map[n] = FREE | order;
+    freeCount += size_t(1) << order;
+}
+
+void unlink(size_t n, int order) {
+    FreePage* p = page(n);
+    if (p->prev != nullptr) {
+        p->prev->next = p->next;
+    } else {
+        lists[order] = p->next;
+    }
+    if (p->next != nullptr) p->next->prev = p->prev;
+    map[n] = 0;
+    freeCount -= size_t(1) << order;
+}
+
+/* page number of a free block of this order, -1 if none. Caller holds the lock */
+int64_t take(int order) {
+    int o = order;
+    while (o <= PAGE_MAX_ORDER && lists[o] == nullptr) o++;
+    if (o > PAGE_MAX_ORDER) return -1;
+
+    size_t n = pfn(lists[o]);
+    unlink(n, o);
+    while (o > order) {
+        // keep the lower half, the upper half goes on the next list down
+        o--;
+        push(n + (size_t(1) << o), o);
+    }
+    map[n] = TAKEN | order;
+    return n;
+}
+
+/* free a taken block and merge it with its buddies. Caller holds the lock */
+void give(size_t n) {
+    int order = map[n] & ORDER_MASK;
+    map[n] = 0;
+    while (order < PAGE_MAX_ORDER) {
+        size_t buddy = n ^ (size_t(1) << order);
+        if (buddy >= npages || map[buddy] != (FREE | order)) break;
+        unlink(buddy, order);
+        if (buddy < n) n = buddy;
+        order++;
+    }
+    push(n, order);
+}
+
+/*
+ * Per-core hot lists
+ *
+ * Single pages are by far the most common request, so each core keeps a
+ * short LIFO of them, refilled and drained HOT_BATCH pages at a time
+ * under one lock acquisition. Pages on a hot list stay TAKEN in map[].
+ */
+constexpr int HOT_BATCH = 16;
+constexpr int HOT_LIMIT = 2 * HOT_BATCH;
+
+struct HotList {
+    FreePage* top;
+    int count;
+};
+
+static PaddedPerCPU<HotList> hot;
+
+void hotPush(HotList& h, void* p) {
+    FreePage* f = (FreePage*) p;
+    f->next = h.top;
+    h.top = f;
+    h.count++;
+}
+
+void* hotPop(HotList& h) {
+    FreePage* f = h.top;
+    if (f == nullptr) return nullptr;
+    h.top = f->next;
+    h.count--;
+    return f;
+}
+
+void hotRefill(HotList& h) {
+    LockGuardP g{pageLock()};
+    for (int i = 0; i < HOT_BATCH; i++) {
+        int64_t n = take(0);
+        if (n < 0) break;
+        hotPush(h, page(n));
+    }
+}
+
+void hotDrain(HotList& h, int n) {
+    LockGuardP g{pageLock()};
+    while (n-- > 0) {
+        void* p = hotPop(h);
+        if (p == nullptr) break;
+        give(pfn(p));
+    }
+}
+};
+
+void pageInit(void* firstFree) {
+    using namespace buddy;
+
+    uint32_t msg[5] = { 0 };
+    if (!mailbox_tag_message(msg, 5, MAILBOX_TAG_GET_ARM_MEMORY, 8, 8, 0, 0)) {
+        printf_no_lock("| pages: ARM memory query failed\n");
+        return;
+    }
+    // msg[3] = ARM base, msg[4] = ARM size, the VC owns the rest up to the peripherals
+    uintptr_t end = (uintptr_t(msg[3]) + msg[4]) & ~(MAX_BLOCK - 1);
+
+    // boot.S runs the secondary cores on stacks just below LOW_MEMORY + core * SECTION_SIZE
+    uintptr_t start = (uintptr_t) firstFree;
+    if (start < LOW_MEMORY + 4 * SECTION_SIZE) start = LOW_MEMORY + 4 * SECTION_SIZE;
+    start = alignUp(start, PAGE_SIZE);
+    if (alignUp(start, MAX_BLOCK) >= end) {
+        printf_no_lock("| pages: no memory above 0x%x\n", start);
+        return;
+    }
+
+    // the map goes first, at most one byte for every page that could follow it
+    size_t mapBytes = (end - alignUp(start, MAX_BLOCK)) >> PAGE_SHIFT;
+    map = (uint8_t*) start;
+    base = alignUp(start + mapBytes, MAX_BLOCK);
+    npages = (base < end) ? (end - base) >> PAGE_SHIFT : 0;
+
+    for (size_t n = 0; n < npages; n++) {
+        map[n] = 0;
+    }
+    for (size_t n = 0; n < npages; n += size_t(1) << PAGE_MAX_ORDER) {
+        push(n, PAGE_MAX_ORDER);
+    }
+
+    printf_no_lock("| pages 0x%x 0x%x (%d free)\n", base, end, npages);
+}
+
+int pageOrder(size_t bytes) {
+    int order = 0;
+    while ((size_t(PAGE_SIZE) << order) < bytes) {
+        if (++order > PAGE_MAX_ORDER) return -1;
+    }
+    return order;
+}
+
+void* pageAlloc(int order) {
+    using namespace buddy;
+    if (order < 0 || order > PAGE_MAX_ORDER || npages == 0) return nullptr;
+
+    // the hot lists are per core
+    PreemptGuard pg;
+    if (order == 0) {
+        HotList& h = hot.mine();
+        if (h.count == 0) hotRefill(h);
+        return hotPop(h);
+    }
+
+    int64_t n;
+    {
+        LockGuardP g{pageLock()};
+        n = take(order);
+    }
+    if (n < 0) {
+        // single pages parked on this core may be what's missing
+        HotList& h = hot.mine();
+        hotDrain(h, h.count);
+        LockGuardP g{pageLock()};
+        n = take(order);
+    }
+    return (n < 0) ? nullptr : page(n);
+}
+
+void pageFree(void* p) {
+    using namespace buddy;
+    if (p == nullptr) return;
+
+    uintptr_t a = (uintptr_t) p;
+    if (a < base || a >= base + (npages << PAGE_SHIFT) || (a & (PAGE_SIZE - 1)) != 0) {
+        panic("pageFree: 0x%x is not a page\n", (uint32_t) a);
+        return;
+    }
+    size_t n = pfn(p);
+    if ((map[n] & TAKEN) == 0) {
+        panic("pageFree: page 0x%x is not allocated\n", (uint32_t) a);
+        return;
+    }
+
+    if ((map[n] & ORDER_MASK) == 0) {
+        PreemptGuard pg;
+        HotList& h = hot.mine();
+        hotPush(h, p);
+        if (h.count > HOT_LIMIT) hotDrain(h, HOT_BATCH);
+        return;
+    }
+
+    LockGuardP g{pageLock()};
+    give(n);
+}
+
+size_t pageFreeCount() {
+    return buddy::freeCount;
+}
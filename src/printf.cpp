@@ -22,8 +22,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "printf.h"
 #include "uart.h"
 #include "atomic.h"
+#include "queuelock.h"
 
-SpinLock lock;
+// FIFO, so a core printing in a loop can't starve the others
+TicketLock lock{"printf"};
 typedef void (*putcf) (void*,char);
 static putcf stdout_putf;
 static void* stdout_putp;
@@ -251,10 +253,10 @@ __attribute__((noreturn)) void panic(char* fmt, ...) {
     // Lock to prevent interleaved outputs if multiple cores or threads
     lock.lock();
 
-    tfp_printf("\n***** KERNEL PANIC *****\n");
+    tfp_printf_no_lock("\n***** KERNEL PANIC *****\n");
     // Print the caller's error message
     tfp_format(stdout_putp, stdout_putf, fmt, va);
-    tfp_printf("\n");
+    tfp_printf_no_lock("\n");
 
     lock.unlock();
     va_end(va);
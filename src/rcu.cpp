@@ -0,0 +1,175 @@
+#include "rcu.h"
+#include "percpu.h"
+#include "heap.h"
+#include "printf.h"
+
+namespace {
+
+constexpr uint64_t OFFLINE = ~0ull;
+constexpr uint32_t BAGS = 3;
+
+// the last epoch each core announced, written by its core only; cores
+// start out offline, so one that never reads never holds anyone up
+struct Announce {
+    Atomic<uint64_t> epoch;
+    bool idle;              // went offline for the idle loop
+    constexpr Announce() : epoch(OFFLINE), idle(false) {}
+};
+
+struct Bag {
+    uint64_t epoch;
+    RcuHead* head;
+    uint32_t count;
+};
+
+// retired objects, touched by their core only
+struct Limbo {
+    Bag bags[BAGS];
+    uint64_t retired;
+    uint64_t reclaimed;
+    uint64_t batches;
+};
+
+Atomic<uint64_t> globalEpoch{0};
+PaddedPerCPU<Announce> announced;
+PaddedPerCPU<Limbo> limbo;
+
+void reclaimBag(Limbo& me, Bag& bag) {
+    RcuHead* list = bag.head;
+    me.reclaimed += bag.count;
+    me.batches++;
+    bag.head = nullptr;
+    bag.count = 0;
+    while (list != nullptr) {
+        RcuHead* next = list->next;
+        list->reclaim(list);
+        list = next;
+    }
+}
+
+// every bag from epoch e <= now - 2 is safe
+void reclaimOld(Limbo& me, uint64_t now) {
+    for (uint32_t i = 0; i < BAGS; i++) {
+        Bag& bag = me.bags[i];
+        if (bag.count != 0 && bag.epoch + 2 <= now) reclaimBag(me, bag);
+    }
+}
+
+// move the epoch on if every online core has announced the current one
+uint64_t tryAdvance() {
+    uint64_t now = globalEpoch.get<MO_ACQUIRE>();
+    for (int i = 0; i < 4; i++) {
+        uint64_t e = announced.forCPU(i).epoch.get<MO_ACQUIRE>();
+        if (e != OFFLINE && e != now) return now;
+    }
+    if (globalEpoch.compare_exchange(now, now + 1)) return now + 1;
+    return now;         // someone else moved it, `now` has the new value
+}
+
+void freeHead(RcuHead* head) {
+    free(head);
+}
+
+}
+
+void call_rcu(RcuHead* head, void (*reclaim)(RcuHead* head)) {
+    // the unlink comes before the epoch we tag it with
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    PreemptGuard pg;
+    uint64_t now = globalEpoch.get<MO_ACQUIRE>();
+    Limbo& me = limbo.mine();
+    Bag& bag = me.bags[now % BAGS];
+    if (bag.epoch != now) {
+        // last used three or more epochs ago, so it's all safe by now
+        if (bag.count != 0) reclaimBag(me, bag);
+        bag.epoch = now;
+    }
+    head->reclaim = reclaim;
+    head->next = bag.head;
+    bag.head = head;
+    bag.count++;
+    me.retired++;
+}
+
+void rcu_free(RcuHead* head) {
+    call_rcu(head, freeHead);
+}
+
+void rcu_quiescent() {
+    PreemptGuard pg;
+    Atomic<uint64_t>& mine = announced.mine().epoch;
+    uint64_t now = globalEpoch.get<MO_ACQUIRE>();
+    uint64_t was = mine.get<MO_RELAXED>();
+    // release: every read before this point is done before anyone sees it;
+    // an offline core stays offline
+    if (was != OFFLINE && was != now) mine.set<MO_RELEASE>(now);
+    now = tryAdvance();
+    reclaimOld(limbo.mine(), now);
+}
+
+void rcu_synchronize() {
+    PreemptGuard pg;
+    Atomic<uint64_t>& mine = announced.mine().epoch;
+    bool online = mine.get<MO_RELAXED>() != OFFLINE;
+    uint64_t target = globalEpoch.get<MO_ACQUIRE>() + 2;
+    uint64_t now;
+    while (true) {
+        now = globalEpoch.get<MO_ACQUIRE>();
+        if (online) mine.set<MO_RELEASE>(now);
+        now = tryAdvance();
+        if (now >= target) break;
+        iAmStuckInALoop(false);
+    }
+    mine.set<MO_RELEASE>(online ? now : OFFLINE);
+    reclaimOld(limbo.mine(), now);
+}
+
+void rcu_offline() {
+    announced.mine().epoch.set<MO_RELEASE>(OFFLINE);
+}
+
+void rcu_online() {
+    // seq_cst: the announcement is in place before any of our reads
+    announced.mine().epoch.set(globalEpoch.get<MO_ACQUIRE>());
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_note_switch() {
+    Atomic<uint64_t>& mine = announced.mine().epoch;
+    uint64_t was = mine.get<MO_RELAXED>();
+    uint64_t now = globalEpoch.get<MO_ACQUIRE>();
+    if (was != OFFLINE && was != now) mine.set<MO_RELEASE>(now);
+}
+
+void rcu_idle_enter() {
+    Announce& a = announced.mine();
+    if (a.epoch.get<MO_RELAXED>() == OFFLINE) return;
+    a.idle = true;
+    rcu_offline();
+}
+
+void rcu_idle_exit() {
+    Announce& a = announced.mine();
+    if (!a.idle) return;
+    a.idle = false;
+    rcu_online();
+}
+
+void rcu_stats(RcuStats& st) {
+    st = RcuStats{};
+    st.epoch = globalEpoch.get<MO_RELAXED>();
+    for (int i = 0; i < 4; i++) {
+        Limbo& l = limbo.forCPU(i);
+        st.retired += l.retired;
+        st.reclaimed += l.reclaimed;
+        st.batches += l.batches;
+    }
+}
+
+void rcu_stats_print() {
+    RcuStats st;
+    rcu_stats(st);
+    printf("| rcu: epoch %d, %d retired, %d reclaimed in %d batches, %d pending\n",
+        (uint32_t) st.epoch, (uint32_t) st.retired, (uint32_t) st.reclaimed,
+        (uint32_t) st.batches, (uint32_t) (st.retired - st.reclaimed));
+}
@@ -1,5 +1,8 @@
 #include "stdint.h"     // C++ standard for uint32_t, etc.
 #include "rpi-SmartStart.h"  // This unit's header
+#include "atomic.h"          // Atomic, for the mailbox claim
+#include "core.h"            // coresAwoken
+#include "printf.h"          // panic
 
 #define MB_CHANNEL_TAGS 8
 
@@ -44,6 +47,35 @@ uint32_t mailbox_read(uint8_t channel) {
     return value & ~0xF;
 }
 
+// one property call in flight at a time, blocking or async (async.h)
+static Atomic<uint32_t> mailboxBusy{0};
+
+bool mailbox_claim(void) {
+    return mailboxBusy.exchange<MO_ACQUIRE>(1) == 0;
+}
+
+void mailbox_release(void) {
+    mailboxBusy.set<MO_RELEASE>(0);
+}
+
+bool mailbox_try_read(uint8_t channel, uint32_t* value) {
+    if ((MAILBOX->Status0 & MAIL_EMPTY) != 0) return false;
+    uint32_t v = MAILBOX->Read0;
+    // we hold the claim and only property calls use the mailbox, so
+    // this is our answer; anything else would be lost, so don't go on
+    if ((v & 0xF) != channel) panic("mailbox: message for channel %d, waiting on %d\n", v & 0xF, channel);
+    *value = v & ~0xF;
+    return true;
+}
+
+bool mailbox_can_write(void) {
+    return (MAILBOX->Status1 & MAIL_FULL) == 0;
+}
+
+bool mailbox_can_read(void) {
+    return (MAILBOX->Status0 & MAIL_EMPTY) == 0;
+}
+
 extern "C" bool mailbox_tag_message(uint32_t* response_buf, uint8_t data_count, ...) {
     uint32_t message[data_count + 3] __attribute__((aligned(16)));
     uint32_t addr = (uint32_t)(uintptr_t)message;
@@ -63,8 +95,14 @@ extern "C" bool mailbox_tag_message(uint32_t* response_buf, uint8_t data_count,
     __asm volatile("mcr p15, 0, %0, c7, c14, 1" : : "r"(addr));
 #endif
 
+    // the claim's exclusives need the MMU on; before that only core 0 runs
+    bool shared = coresAwoken;
+    if (shared) {
+        while (!mailbox_claim()) mailboxBusy.wait_while(1);
+    }
     mailbox_write(MB_CHANNEL_TAGS, ARMaddrToGPUaddr(addr));
     mailbox_read(MB_CHANNEL_TAGS);
+    if (shared) mailbox_release();
 
 #if __aarch64__ == 1
     __asm volatile("dc civac, %0" : : "r"(addr) : "memory");
@@ -0,0 +1,883 @@
+#include "sched.h"
+#include "atomic.h"
+#include "percpu.h"
+#include "heap.h"
+#include "pages.h"
+#include "ipi.h"
+#include "timer.h"
+#include "timeout.h"
+#include "fpsimd.h"
+#include "rcu.h"
+#include "printf.h"
+
+/*
+ * Preemptive priority scheduler with per-core run queues
+ *
+ * Each core schedules its own queue: one FIFO of runnable tasks per prio
+ * level and a bitmap of the levels that aren't empty, under a
+ * RawSpinLock, plus an idle task that runs when the queue is empty.
+ * Picking the next task is a count-trailing-zeros on the bitmap and a
+ * list pop however many tasks there are. A task runs until it yields,
+ * exits, or is preempted: timer_tick(), TIMER_HZ times a second, counts
+ * down its slice (`priority` ticks) and sets need_resched when it runs
+ * out, and a reschedule IPI sets it right away, as does a task with a
+ * lower prio becoming runnable on its core. The idle task stops the tick
+ * while it waits. need_resched is acted on at IRQ exit and whenever
+ * preempt_count drops back to 0. A sleeping task is on no queue; wake_up
+ * puts it back at the tail of its level.
+ *
+ * schedule() runs with IRQs masked and the core's queue locked. The
+ * lock is held across cpu_switch_to and released by the task switched
+ * to (finish_switch), so prev can't be picked up again until its
+ * registers are saved. on_cpu stays set until then too, which is what
+ * kthread_join waits for before freeing a task.
+ *
+ * Deadline tasks (PF_DL) have a queue of their own on their core, kept
+ * in deadline order, which goes before every prio level. While one runs,
+ * the core's budget timeout is set for when its budget will be used up;
+ * at that point it is switched out and, if it is still runnable,
+ * throttled: left off the queue until its own timeout replenishes it at
+ * its deadline. A deadline task that wakes up keeps its deadline and
+ * what is left of its budget only if that doesn't let it run at more
+ * than its bandwidth until then; otherwise it gets a full budget and a
+ * deadline a period away (the CBS wake-up rule). Admission just keeps
+ * each core's total bandwidth under DL_BW_MAX.
+ *
+ * Normal tasks change cores in two ways:
+ *  - pulled by the balancer. Every BALANCE_TICKS ticks a core takes one
+ *    queued task from the busiest core if that has at least two more
+ *    (counting the running ones), and the idle task takes any it can
+ *    before it sleeps. A busy core with queued work an idle one could
+ *    take kicks that awake to come and get it.
+ *  - pushed. A task switched out on a core its affinity no longer
+ *    allows is queued on the least loaded allowed one by finish_switch.
+ * Only tasks that left nothing behind on their core are moved: a queued
+ * task's preempt_count must be just the 1 schedule() added, and its FP
+ * registers can't be live there (fpsimd.h); a pushed one flushes them
+ * first. t->cpu only changes under the old core's queue lock, so a
+ * queue locked after reading t->cpu is t's as long as t->cpu still says
+ * so (lockFor).
+ */
+
+int nr_tasks = 0;
+
+extern "C" void ret_from_kthread();
+
+namespace {
+
+constexpr uint32_t BALANCE_TICKS = 5;
+constexpr int32_t IDLE_PRIO = NR_PRIO;      // runPrio while the idle task runs
+constexpr int32_t DL_PRIO = -1;             // ... and while a deadline task does
+
+struct RunQueue {
+    RawSpinLock lock;
+    uint32_t bitmap;            // bit p: head[p] isn't empty
+    task_struct* head[NR_PRIO];
+    task_struct* tail[NR_PRIO];
+    task_struct* dl;            // deadline tasks, earliest first
+    Atomic<uint32_t> nr;        // queued, not counting the running task
+    Atomic<int32_t> runPrio;    // the running task's prio
+    Atomic<uint64_t> runDeadline;       // ... and deadline, if it has one
+    Timeout budget;             // the running deadline task's budget runs out
+    task_struct* idle;
+    task_struct* pushing;       // switched out, for finish_switch to queue elsewhere
+    uint32_t balanceTicks;
+    uint64_t switches;
+    uint64_t preemptions;
+    uint64_t ticks;
+    uint64_t pulled;
+    uint64_t pushed;
+    uint32_t hardirq;           // in an IRQ handler
+    constexpr RunQueue() : lock(), bitmap(0), head(), tail(), dl(nullptr), nr(0), runPrio(IDLE_PRIO),
+        runDeadline(0), budget(), idle(nullptr), pushing(nullptr), balanceTicks(0), switches(0), preemptions(0),
+        ticks(0), pulled(0), pushed(0), hardirq(0) {}
+};
+
+PaddedPerCPU<RunQueue> runQueues;
+
+// what each core was running when it called sched_init
+PaddedPerCPU<task_struct> bootTasks;
+
+// deadline bandwidth admitted on each core
+SpinLock dlLock{"dl"};
+uint64_t dlBw[4];
+
+// every task, newest first, and the pids handed out so far
+task_struct* tasks = nullptr;
+int nextPid = 0;
+SpinLock tasksLock{"tasks"};
+
+// rq locked
+void enqueue(RunQueue& rq, task_struct* t) {
+    int p = t->prio;
+    t->next = nullptr;
+    if (t->flags & PF_DL) {
+        // behind any with the same deadline
+        task_struct** q = &rq.dl;
+        while (*q != nullptr && (*q)->dl.deadline <= t->dl.deadline) q = &(*q)->next;
+        t->next = *q;
+        *q = t;
+    } else {
+        if (rq.tail[p] == nullptr) {
+            rq.head[p] = t;
+            rq.bitmap |= 1u << p;
+        } else {
+            rq.tail[p]->next = t;
+        }
+        rq.tail[p] = t;
+    }
+    t->on_rq = 1;
+    rq.nr.set<MO_RELAXED>(rq.nr.get<MO_RELAXED>() + 1);
+}
+
+// rq locked; prev comes before t on its level, nullptr if t is the head
+void unlink(RunQueue& rq, task_struct* t, task_struct* prev) {
+    int p = t->prio;
+    if (t->flags & PF_DL) {
+        if (prev == nullptr) {
+            rq.dl = t->next;
+        } else {
+            prev->next = t->next;
+        }
+    } else if (prev == nullptr) {
+        rq.head[p] = t->next;
+    } else {
+        prev->next = t->next;
+    }
+    if ((t->flags & PF_DL) == 0) {
+        if (rq.tail[p] == t) rq.tail[p] = prev;
+        if (rq.head[p] == nullptr) rq.bitmap &= ~(1u << p);
+    }
+    t->next = nullptr;
+    t->on_rq = 0;
+    rq.nr.set<MO_RELAXED>(rq.nr.get<MO_RELAXED>() - 1);
+}
+
+// rq locked, t queued on it
+void remove(RunQueue& rq, task_struct* t) {
+    task_struct* prev = nullptr;
+    for (task_struct* q = (t->flags & PF_DL) ? rq.dl : rq.head[t->prio]; q != t; q = q->next) prev = q;
+    unlink(rq, t, prev);
+}
+
+// rq locked: the earliest deadline, else the head of the lowest non-empty level
+task_struct* dequeue(RunQueue& rq) {
+    if (rq.dl != nullptr) {
+        task_struct* t = rq.dl;
+        unlink(rq, t, nullptr);
+        return t;
+    }
+    if (rq.bitmap == 0) return nullptr;
+    task_struct* t = rq.head[__builtin_ctz(rq.bitmap)];
+    unlink(rq, t, nullptr);
+    return t;
+}
+
+// t's run queue, locked; IRQs masked
+RunQueue& lockFor(task_struct* t) {
+    while (true) {
+        int cpu = __atomic_load_n(&t->cpu, __ATOMIC_RELAXED);
+        RunQueue& rq = runQueues.forCPU(cpu);
+        rq.lock.lock();
+        if (__atomic_load_n(&t->cpu, __ATOMIC_RELAXED) == cpu) return rq;
+        rq.lock.unlock();
+    }
+}
+
+// queued plus running, racy
+uint32_t load(uint32_t core) {
+    RunQueue& rq = runQueues.forCPU(core);
+    return rq.nr.get<MO_RELAXED>() + (rq.runPrio.get<MO_RELAXED>() != IDLE_PRIO ? 1 : 0);
+}
+
+// of the cores in mask, this one first so it wins ties
+int leastLoaded(unsigned long mask) {
+    uint32_t me = getCoreID();
+    int best = -1;
+    uint32_t least = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        uint32_t core = (me + i) % 4;
+        if ((mask & (1ul << core)) == 0) continue;
+        uint32_t l = load(core);
+        if (best < 0 || l < least) {
+            best = core;
+            least = l;
+        }
+    }
+    return best;
+}
+
+void resched(int core) {
+    if (core == (int) getCoreID()) {
+        current->need_resched = 1;
+    } else {
+        smp_send_reschedule(core);
+    }
+}
+
+// a task at prio became runnable on core: preempt whatever less important runs there
+void preemptFor(int core, int prio) {
+    if (prio >= runQueues.forCPU(core).runPrio.get<MO_RELAXED>()) return;
+    resched(core);
+}
+
+// ... or a deadline task with this deadline: anything but an earlier deadline
+void preemptForDl(int core, uint64_t deadline) {
+    RunQueue& rq = runQueues.forCPU(core);
+    if (rq.runPrio.get<MO_RELAXED>() == DL_PRIO && deadline >= rq.runDeadline.get<MO_RELAXED>()) return;
+    resched(core);
+}
+
+// src locked: the most important queued task there that may go to dst
+task_struct* movable(RunQueue& src, uint32_t srcCore, uint32_t dst, task_struct*& prev) {
+    for (uint32_t levels = src.bitmap; levels != 0; levels &= levels - 1) {
+        prev = nullptr;
+        for (task_struct* t = src.head[__builtin_ctz(levels)]; t != nullptr; t = t->next) {
+            if ((t->allowed & (1ul << dst)) != 0 && t->preempt_count == 1 && !fpsimd_loaded(srcCore, t)) {
+                return t;
+            }
+            prev = t;
+        }
+    }
+    return nullptr;
+}
+
+// take one task from the busiest core, IRQs masked. The idle task takes
+// anything, a busy core only evens out a real imbalance
+bool pull(uint32_t me, bool idle) {
+    int from = -1;
+    uint32_t most = 0;
+    for (uint32_t core = 0; core < 4; core++) {
+        if (core == me || runQueues.forCPU(core).nr.get<MO_RELAXED>() == 0) continue;
+        uint32_t l = load(core);
+        if (l > most) {
+            from = core;
+            most = l;
+        }
+    }
+    if (from < 0 || (!idle && most < load(me) + 2)) return false;
+
+    RunQueue& rq = runQueues.forCPU(me);
+    RunQueue& src = runQueues.forCPU(from);
+    RunQueue& first = from < (int) me ? src : rq;
+    RunQueue& second = from < (int) me ? rq : src;
+    first.lock.lock();
+    second.lock.lock();
+    task_struct* prev;
+    task_struct* t = movable(src, from, me, prev);
+    int prio = 0;
+    if (t != nullptr) {
+        unlink(src, t, prev);
+        t->cpu = me;
+        prio = t->prio;
+        enqueue(rq, t);
+        rq.pulled++;
+    }
+    second.lock.unlock();
+    first.lock.unlock();
+    if (t == nullptr) return false;
+    preemptFor(me, prio);
+    return true;
+}
+
+// wake an idle core if it could take some of this one's queue, IRQs masked
+void kickIdle(uint32_t me) {
+    RunQueue& rq = runQueues.forCPU(me);
+    if (rq.nr.get<MO_RELAXED>() == 0) return;
+    for (uint32_t core = 0; core < 4; core++) {
+        if (core == me || load(core) != 0) continue;
+        rq.lock.lock();
+        task_struct* prev;
+        bool some = movable(rq, me, core, prev) != nullptr;
+        rq.lock.unlock();
+        if (some) {
+            smp_send_reschedule(core);
+            return;
+        }
+    }
+}
+
+// a core for a reservation of bw: cpu if it has room, else the one with the most left
+int dlAdmit(uint64_t bw, int cpu) {
+    LockGuard g{dlLock};
+    int best = -1;
+    for (int core = 0; core < 4; core++) {
+        if (cpu >= 0 && core != cpu) continue;
+        if (dlBw[core] + bw > DL_BW_MAX) continue;
+        if (best < 0 || dlBw[core] < dlBw[best]) best = core;
+    }
+    if (best >= 0) dlBw[best] += bw;
+    return best;
+}
+
+void dlUnreserve(int core, uint64_t bw) {
+    LockGuard g{dlLock};
+    dlBw[core] -= bw;
+}
+
+// t wakes up at now: the CBS rule, rq locked or t not running yet
+void dlWake(task_struct* t, uint64_t now) {
+    sched_dl& dl = t->dl;
+    // budget / (deadline - now) > runtime / period
+    if (dl.deadline <= now || (uint64_t) dl.budget * dl.period > (dl.deadline - now) * dl.runtime) {
+        dl.deadline = now + dl.period;
+        dl.budget = dl.runtime;
+    }
+}
+
+// rq locked: t was just switched out with no budget left
+void dlThrottle(task_struct* t, uint64_t now) {
+    t->dl.throttled = true;
+    t->dl.stats.throttles++;
+    timeout_add(t->dl.timer, t->dl.deadline > now ? t->dl.deadline : now);
+}
+
+// a deadline task's timeout, on its core: the next release of a task in
+// dl_wait_period, or the end of a throttle
+void dlTimer(void* arg) {
+    task_struct* t = (task_struct*) arg;
+    if (!t->dl.throttled) {
+        t->dl.release = t->dl.timer.expires;
+        t->dl.budget = t->dl.runtime;
+        // the charge for this job starts now, if t hasn't made it off the core yet
+        if (t == current) t->dl.since = timer_now();
+        wake_up(t);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    RunQueue& rq = lockFor(t);
+    uint64_t now = timer_now();
+    t->dl.throttled = false;
+    t->dl.deadline += t->dl.period;
+    if (t->dl.deadline <= now) t->dl.deadline = now + t->dl.period;
+    t->dl.budget = t->dl.runtime;
+    int cpu = t->cpu;
+    uint64_t deadline = t->dl.deadline;
+    enqueue(rq, t);
+    rq.lock.unlock();
+    irq_restore(flags);
+    preemptForDl(cpu, deadline);
+}
+
+// the running deadline task's budget timeout, in interrupt context
+void dlBudgetOut(void*) {
+    task_struct* t = current;
+    if (t != nullptr && (t->flags & PF_DL)) t->need_resched = 1;
+}
+
+// the second half of a switch, run by the task switched to
+void finish_switch(task_struct* last) {
+    RunQueue& rq = runQueues.forCPU(getCoreID());
+    // last can't have been in an RCU read (those keep preemption off)
+    rcu_note_switch();
+    task_struct* push = rq.pushing;
+    int to = -1;
+    if (push != nullptr) {
+        rq.pushing = nullptr;
+        fpsimd_flush(push);
+        to = leastLoaded(push->allowed);
+        push->cpu = to;
+        rq.pushed++;
+    }
+    __atomic_store_n(&last->on_cpu, 0, __ATOMIC_RELEASE);
+    rq.lock.unlock();
+    if (push == nullptr) return;
+
+    RunQueue& dst = runQueues.forCPU(to);
+    dst.lock.lock();
+    int prio = push->prio;
+    enqueue(dst, push);
+    dst.lock.unlock();
+    preemptFor(to, prio);
+}
+
+void addTask(task_struct* t) {
+    LockGuard g{tasksLock};
+    t->pid = nextPid++;
+    t->tasks_prev = nullptr;
+    t->tasks_next = tasks;
+    if (tasks != nullptr) tasks->tasks_prev = t;
+    tasks = t;
+    nr_tasks++;
+}
+
+void removeTask(task_struct* t) {
+    LockGuard g{tasksLock};
+    if (t->tasks_prev == nullptr) {
+        tasks = t->tasks_next;
+    } else {
+        t->tasks_prev->tasks_next = t->tasks_next;
+    }
+    if (t->tasks_next != nullptr) t->tasks_next->tasks_prev = t->tasks_prev;
+    nr_tasks--;
+}
+
+// a task that will start in ret_from_kthread, not on any list yet
+task_struct* newTask(void (*fn)(void*), void* arg, int cpu, long priority) {
+    task_struct* t = (task_struct*) aligned_alloc(alignof(task_struct), sizeof(task_struct));
+    if (t == nullptr) return nullptr;
+    *t = task_struct{};
+    t->stack = pageAlloc(pageOrder(THREAD_SIZE));
+    if (t->stack == nullptr) {
+        free(t);
+        return nullptr;
+    }
+    t->cpu_context.x19 = (unsigned long) fn;
+    t->cpu_context.x20 = (unsigned long) arg;
+    t->cpu_context.sp = (unsigned long) t->stack + THREAD_SIZE;
+    t->cpu_context.pc = (unsigned long) ret_from_kthread;
+    t->state = TASK_RUNNING;
+    t->priority = priority;
+    t->counter = priority;
+    t->preempt_count = 1;       // until kthread_start has finished the switch
+    t->flags = PF_KTHREAD;
+    t->cpu = cpu;
+    t->pid = -1;
+    t->prio = DEFAULT_PRIO;
+    t->allowed = 1ul << cpu;
+    return t;
+}
+
+void freeTask(task_struct* t) {
+    pageFree(t->stack);
+    free(t);
+}
+
+int clampPrio(int prio) {
+    if (prio < 0) return 0;
+    if (prio >= NR_PRIO) return NR_PRIO - 1;
+    return prio;
+}
+
+void idleLoop(void*) {
+    uint32_t core = getCoreID();
+    RunQueue& rq = runQueues.forCPU(core);
+    while (true) {
+        // someone else's queued work first
+        uint64_t flags = irq_save();
+        bool pulled = pull(core, true);
+        irq_restore(flags);
+        if (!pulled) {
+            // while we wait: no tick, with nothing to slice up; no
+            // timeouts, which a busy core can run instead; and no grace
+            // period waiting on us, since an idle core holds no RCU reads
+            timeout_idle_enter();
+            tick_idle_enter();
+            rcu_idle_enter();
+            cpu_idle_until([&rq] { return rq.nr.get<MO_RELAXED>() != 0 || current->need_resched; });
+            rcu_idle_exit();
+            tick_idle_exit();
+            timeout_idle_exit();
+        }
+        schedule();
+    }
+}
+
+// IPI_RESCHEDULE
+void kick() {
+    task_struct* t = current;
+    if (t != nullptr) t->need_resched = 1;
+}
+
+}
+
+extern "C" void kthread_start(task_struct* last, void (*fn)(void*), void* arg) {
+    finish_switch(last);
+    current->preempt_count--;
+    irq_enable();
+    fn(arg);
+    kthread_exit();
+}
+
+void sched_init() {
+    uint32_t core = getCoreID();
+    RunQueue& rq = runQueues.forCPU(core);
+
+    task_struct* boot = &bootTasks.forCPU(core);
+    *boot = task_struct{};
+    boot->state = TASK_RUNNING;
+    boot->priority = DEFAULT_PRIORITY;
+    boot->counter = DEFAULT_PRIORITY;
+    boot->flags = PF_KTHREAD;
+    boot->on_cpu = 1;
+    boot->cpu = core;
+    boot->pid = -1;
+    boot->prio = DEFAULT_PRIO;
+    boot->allowed = 1ul << core;
+    addTask(boot);
+    rq.runPrio.set(boot->prio);
+    timeout_init(rq.budget, dlBudgetOut, nullptr, TIMEOUT_PINNED);
+
+    rq.idle = newTask(idleLoop, nullptr, core, DEFAULT_PRIORITY);
+    if (rq.idle == nullptr) panic("sched_init: no memory for the idle task\n");
+    rq.idle->flags |= PF_IDLE;
+
+    asm volatile("msr tpidr_el1, %0" :: "r"(boot) : "memory");
+    fpsimd_init();
+    ipi_set_reschedule_hook(kick);
+}
+
+void schedule() {
+    uint64_t flags = irq_save();
+    task_struct* prev = current;
+    if (prev == nullptr) {
+        irq_restore(flags);
+        return;
+    }
+    prev->preempt_count++;
+
+    uint32_t core = getCoreID();
+    RunQueue& rq = runQueues.forCPU(core);
+    rq.lock.lock();
+    prev->need_resched = 0;
+    uint64_t now = 0;
+    if (prev->flags & PF_DL) {
+        now = timer_now();
+        prev->dl.budget -= (int64_t) (now - prev->dl.since);
+        timeout_cancel(rq.budget);
+    }
+    if (prev->state == TASK_RUNNING && (prev->flags & PF_IDLE) == 0) {
+        if ((prev->flags & PF_DL) && prev->dl.budget <= 0) {
+            dlThrottle(prev, now);
+        } else if ((prev->allowed & (1ul << core)) == 0 && prev->preempt_count == 1) {
+            // not allowed here any more, and free to go
+            rq.pushing = prev;
+        } else {
+            enqueue(rq, prev);
+        }
+    }
+    task_struct* next = dequeue(rq);
+    if (next == nullptr) next = rq.idle;
+    if (next->counter <= 0) next->counter = next->priority;
+    if (next->flags & PF_DL) {
+        if (now == 0) now = timer_now();
+        next->dl.since = now;
+        timeout_add(rq.budget, now + next->dl.budget);
+        rq.runDeadline.set<MO_RELAXED>(next->dl.deadline);
+        rq.runPrio.set<MO_RELAXED>(DL_PRIO);
+    } else {
+        rq.runPrio.set<MO_RELAXED>(next == rq.idle ? IDLE_PRIO : next->prio);
+    }
+
+    if (next != prev) {
+        next->on_cpu = 1;
+        next->switches++;
+        rq.switches++;
+        fpsimd_switch(next);
+        task_struct* last = cpu_switch_to(prev, next);
+        // prev again, some time later
+        finish_switch(last);
+    } else {
+        rq.lock.unlock();
+    }
+
+    prev->preempt_count--;
+    irq_restore(flags);
+}
+
+void preempt_schedule() {
+    task_struct* t = current;
+    if (t == nullptr || t->preempt_count != 0 || !t->need_resched) return;
+    schedule();
+}
+
+void yield() {
+    schedule();
+}
+
+void timer_tick() {
+    task_struct* t = current;
+    if (t == nullptr) return;
+    uint32_t core = getCoreID();
+    RunQueue& rq = runQueues.forCPU(core);
+    rq.ticks++;
+    if (++rq.balanceTicks >= BALANCE_TICKS) {
+        rq.balanceTicks = 0;
+        pull(core, false);
+        kickIdle(core);
+    }
+    if (t->flags & PF_IDLE) {
+        if (rq.nr.get<MO_RELAXED>() != 0) t->need_resched = 1;
+        return;
+    }
+    // deadline tasks aren't sliced, their budget timeout stops them
+    if (t->flags & PF_DL) return;
+    // running where it's no longer allowed: off at the next chance
+    if (--t->counter <= 0 || (t->allowed & (1ul << core)) == 0) t->need_resched = 1;
+}
+
+extern "C" void irq_enter() {
+    runQueues.forCPU(getCoreID()).hardirq++;
+    task_struct* t = current;
+    if (t != nullptr) t->preempt_count++;
+}
+
+extern "C" void irq_exit() {
+    runQueues.forCPU(getCoreID()).hardirq--;
+    task_struct* t = current;
+    if (t == nullptr) return;
+    if (--t->preempt_count == 0 && t->need_resched) {
+        runQueues.forCPU(getCoreID()).preemptions++;
+        schedule();
+    }
+}
+
+bool in_irq() {
+    return runQueues.forCPU(getCoreID()).hardirq != 0;
+}
+
+task_struct* kthread_create(void (*fn)(void*), void* arg, int cpu, long priority, int prio) {
+    unsigned long allowed = CPU_MASK_ALL;
+    if (cpu < 0 || cpu > 3) {
+        cpu = leastLoaded(allowed);
+    } else {
+        allowed = 1ul << cpu;
+    }
+    task_struct* t = newTask(fn, arg, cpu, priority);
+    if (t == nullptr) return nullptr;
+    t->prio = clampPrio(prio);
+    t->allowed = allowed;
+    addTask(t);
+
+    RunQueue& rq = runQueues.forCPU(cpu);
+    uint64_t flags = irq_save();
+    rq.lock.lock();
+    enqueue(rq, t);
+    rq.lock.unlock();
+    irq_restore(flags);
+
+    // only something less important gets preempted for it
+    preemptFor(cpu, t->prio);
+    preempt_schedule();
+    return t;
+}
+
+void wake_up(task_struct* t) {
+    uint64_t flags = irq_save();
+    RunQueue& rq = lockFor(t);
+    int cpu = t->cpu;
+    int prio = t->prio;
+    bool dl = (t->flags & PF_DL) != 0;
+    bool woken = t->state == TASK_SLEEPING;
+    if (woken) {
+        if (dl) dlWake(t, timer_now());
+        t->state = TASK_RUNNING;
+        // still on its way into schedule(), which will queue it now
+        if (__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE) == 0) enqueue(rq, t);
+    }
+    uint64_t deadline = t->dl.deadline;
+    rq.lock.unlock();
+    irq_restore(flags);
+
+    if (!woken) return;
+    if (dl) {
+        preemptForDl(cpu, deadline);
+    } else {
+        preemptFor(cpu, prio);
+    }
+    preempt_schedule();
+}
+
+void sched_setprio(task_struct* t, int prio) {
+    if (t->flags & PF_DL) return;
+    prio = clampPrio(prio);
+    uint64_t flags = irq_save();
+    RunQueue& rq = lockFor(t);
+    int cpu = t->cpu;
+    bool queued = t->on_rq != 0;
+    if (queued) {
+        remove(rq, t);
+        t->prio = prio;
+        enqueue(rq, t);
+    } else {
+        t->prio = prio;
+    }
+    bool running = !queued && t->on_cpu != 0;
+    if (t == current) {
+        rq.runPrio.set<MO_RELAXED>(prio);
+        // something queued here may matter more now
+        if ((rq.bitmap & ((1u << prio) - 1)) != 0) t->need_resched = 1;
+    }
+    rq.lock.unlock();
+    irq_restore(flags);
+
+    if (queued) {
+        preemptFor(cpu, prio);
+    } else if (running && cpu != (int) getCoreID()) {
+        // let it find out whether it still comes first there
+        smp_send_reschedule(cpu);
+    }
+    preempt_schedule();
+}
+
+void sched_setaffinity(task_struct* t, unsigned long mask) {
+    mask &= CPU_MASK_ALL;
+    if (mask == 0 || (t->flags & PF_DL)) return;
+    uint64_t flags = irq_save();
+    RunQueue& rq = lockFor(t);
+    int from = t->cpu;
+    t->allowed = mask;
+    bool leave = (mask & (1ul << from)) == 0;
+    int to = -1;
+    if (leave && t->on_rq && t->preempt_count == 1 && !fpsimd_loaded(from, t)) {
+        remove(rq, t);
+        to = leastLoaded(mask);
+        t->cpu = to;
+        rq.pushed++;
+    }
+    bool running = leave && !t->on_rq && t->on_cpu != 0;
+    rq.lock.unlock();
+    int prio = t->prio;
+    if (to >= 0) {
+        RunQueue& dst = runQueues.forCPU(to);
+        dst.lock.lock();
+        enqueue(dst, t);
+        dst.lock.unlock();
+    }
+    irq_restore(flags);
+
+    // anything else moves when it next switches out
+    if (to >= 0) {
+        preemptFor(to, prio);
+    } else if (t == current) {
+        t->need_resched = 1;
+    } else if (running && from != (int) getCoreID()) {
+        smp_send_reschedule(from);
+    }
+    preempt_schedule();
+}
+
+task_struct* kthread_create_dl(void (*fn)(void*), void* arg, unsigned long runtime_us,
+                               unsigned long period_us, int cpu) {
+    if (runtime_us == 0 || runtime_us > period_us || period_us > DL_PERIOD_MAX_US) return nullptr;
+    if (cpu > 3) cpu = -1;
+    uint64_t bw = ((uint64_t) runtime_us << DL_BW_SHIFT) / period_us;
+    cpu = dlAdmit(bw, cpu);
+    if (cpu < 0) return nullptr;
+    task_struct* t = newTask(fn, arg, cpu, DEFAULT_PRIORITY);
+    if (t == nullptr) {
+        dlUnreserve(cpu, bw);
+        return nullptr;
+    }
+    t->flags |= PF_DL;
+    sched_dl& dl = t->dl;
+    dl.runtime = timer_us(runtime_us);
+    dl.period = timer_us(period_us);
+    dl.bw = bw;
+    dl.release = timer_now();
+    dl.deadline = dl.release + dl.period;
+    dl.budget = dl.runtime;
+    timeout_init(dl.timer, dlTimer, t, TIMEOUT_PINNED);
+    addTask(t);
+
+    RunQueue& rq = runQueues.forCPU(cpu);
+    uint64_t flags = irq_save();
+    rq.lock.lock();
+    enqueue(rq, t);
+    rq.lock.unlock();
+    irq_restore(flags);
+
+    preemptForDl(cpu, dl.deadline);
+    preempt_schedule();
+    return t;
+}
+
+void dl_wait_period() {
+    task_struct* t = current;
+    if (t == nullptr || (t->flags & PF_DL) == 0) {
+        yield();
+        return;
+    }
+    sched_dl& dl = t->dl;
+    uint64_t now = timer_now();
+    dl.stats.jobs++;
+    if (now > dl.deadline) dl.stats.misses++;
+    uint64_t next = dl.release + dl.period;
+
+    if (next <= now) {
+        // late: the next job starts right away, from the last release that has passed
+        while (next + dl.period <= now) next += dl.period;
+        uint64_t flags = irq_save();
+        dl.release = next;
+        dl.deadline = next + dl.period;
+        dl.budget = dl.runtime;
+        dl.since = now;
+        irq_restore(flags);
+        // for the new deadline, and the budget timeout
+        yield();
+        return;
+    }
+
+    preempt_disable();
+    // the release timeout moves dl.release on; anything else waking us doesn't count
+    while (__atomic_load_n(&dl.release, __ATOMIC_RELAXED) != next) {
+        t->state = TASK_SLEEPING;
+        // the timeout may have gone off just before that
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&dl.release, __ATOMIC_RELAXED) == next) {
+            t->state = TASK_RUNNING;
+            break;
+        }
+        if (!timeout_pending(dl.timer)) timeout_add(dl.timer, next);
+        schedule();
+    }
+    uint64_t latency = timer_now() - next;
+    preempt_enable();
+    dl.stats.totalLatency += latency;
+    if (latency > dl.stats.worstLatency) dl.stats.worstLatency = latency;
+}
+
+void sched_dl_stats(task_struct* t, DlStats& st) {
+    st = t->dl.stats;
+}
+
+void kthread_exit() {
+    task_struct* t = current;
+    fpsimd_release(t);
+    if (t->flags & PF_DL) dlUnreserve(t->cpu, t->dl.bw);
+    __atomic_store_n(&t->state, TASK_ZOMBIE, __ATOMIC_RELEASE);
+    schedule();
+    panic("kthread_exit: task %d ran again\n", t->pid);
+    while (true) {}
+}
+
+void exit_process() {
+    kthread_exit();
+}
+
+void kthread_join(task_struct* t) {
+    // yielding from a more important level would never let t run here
+    task_struct* me = current;
+    int prio = me->prio;
+    if (t->prio > prio) sched_setprio(me, t->prio);
+    // on_cpu is only cleared once another task has switched in after it exited
+    while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != TASK_ZOMBIE ||
+           __atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE) != 0) {
+        yield();
+    }
+    if (me->prio != prio) sched_setprio(me, prio);
+    removeTask(t);
+    freeTask(t);
+}
+
+void sched_stats(int cpu, SchedStats& st) {
+    RunQueue& rq = runQueues.forCPU(cpu);
+    st.switches = rq.switches;
+    st.preemptions = rq.preemptions;
+    st.ticks = rq.ticks;
+    st.pulled = rq.pulled;
+    st.pushed = rq.pushed;
+    st.queued = rq.nr.get<MO_RELAXED>();
+    st.dlUtil = (uint32_t) ((__atomic_load_n(&dlBw[cpu], __ATOMIC_RELAXED) * 1000) >> DL_BW_SHIFT);
+}
+
+void sched_stats_print() {
+    for (int cpu = 0; cpu < 4; cpu++) {
+        SchedStats st;
+        sched_stats(cpu, st);
+        printf("| sched core %d: %d switches, %d preemptions, %d ticks, %d pulled, %d pushed, %d queued\n",
+            cpu, (uint32_t) st.switches, (uint32_t) st.preemptions, (uint32_t) st.ticks,
+            (uint32_t) st.pulled, (uint32_t) st.pushed, st.queued);
+    }
+}
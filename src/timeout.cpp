@@ -0,0 +1,364 @@
+#include "timeout.h"
+#include "timer.h"
+#include "sched.h"
+#include "atomic.h"
+#include "percpu.h"
+#include "ipi.h"
+#include "utils.h"
+#include "printf.h"
+
+namespace {
+
+constexpr uint32_t BITS = 6;
+constexpr uint32_t SLOTS = 1u << BITS;
+constexpr uint64_t MASK = SLOTS - 1;
+constexpr uint64_t MAX_DELTA = (1ull << (BITS * TIMEOUT_LEVELS)) - 1;   // in units
+constexpr uint64_t NEVER = ~0ull;
+constexpr uint16_t EXPIRING = 0xffff;  // slot of a timeout on the expiring list
+
+/*
+ * clk is the next unit to run: everything before it has been, and every
+ * cascade up to and including it is done. A timeout on level L sits in
+ * the slot of its expiry's L-th 6-bit digit, and has between 64^L and
+ * 64^(L+1) units to go as of when it was put there.
+ */
+struct Wheel {
+    RawSpinLock lock;
+    uint64_t clk;
+    uint64_t occupied[TIMEOUT_LEVELS];      // bit n: slots[level][n] is nonempty
+    Timeout* slots[TIMEOUT_LEVELS][SLOTS];
+    Timeout* expiring;                      // taken off, callbacks not yet run
+    uint64_t programmed;                    // the timer deadline we last set
+    volatile bool idle;
+    volatile bool ready;
+    TimeoutStats stats;
+    constexpr Wheel() : lock(), clk(0), occupied(), slots(), expiring(nullptr), programmed(TIMER_NEVER),
+        idle(false), ready(false), stats() {}
+};
+
+PaddedPerCPU<Wheel> wheels;
+
+// log2 of counter ticks per unit, the same on every core
+uint32_t unitShift = 0;
+
+// the unit a time falls due in, rounded up so nothing fires early
+inline uint64_t unitOf(uint64_t ticks) {
+    return (ticks >> unitShift) + ((ticks & ((1ull << unitShift) - 1)) != 0);
+}
+
+inline uint64_t now() {
+    return timer_now() >> unitShift;
+}
+
+void link(Timeout*& head, Timeout* t) {
+    t->next = head;
+    if (head != nullptr) head->pprev = &t->next;
+    t->pprev = &head;
+    head = t;
+}
+
+// locked
+void place(Wheel& w, Timeout* t, uint32_t core) {
+    uint64_t e = unitOf(t->expires);
+    if (e < w.clk) e = w.clk;
+    if (e - w.clk > MAX_DELTA) e = w.clk + MAX_DELTA;   // comes back round, then gets placed again
+    uint64_t delta = e - w.clk;
+    uint32_t level = 0;
+    while (delta >= (1ull << (BITS * (level + 1)))) level++;
+    uint32_t index = (e >> (BITS * level)) & MASK;
+    link(w.slots[level][index], t);
+    w.occupied[level] |= 1ull << index;
+    t->slot = level * SLOTS + index;
+    __atomic_store_n(&t->cpu, (int32_t) core, __ATOMIC_RELAXED);
+}
+
+// locked: off a slot or the expiring list, still owned by the wheel
+void detach(Wheel& w, Timeout* t) {
+    *t->pprev = t->next;
+    if (t->next != nullptr) t->next->pprev = t->pprev;
+    if (t->slot != EXPIRING) {
+        uint32_t level = t->slot / SLOTS;
+        uint32_t index = t->slot % SLOTS;
+        if (w.slots[level][index] == nullptr) w.occupied[level] &= ~(1ull << index);
+        w.stats.pending--;
+    }
+}
+
+// locked: off the wheel altogether
+void unlink(Wheel& w, Timeout* t) {
+    detach(w, t);
+    t->next = nullptr;
+    t->pprev = nullptr;
+    __atomic_store_n(&t->cpu, -1, __ATOMIC_RELEASE);
+}
+
+// locked: spread a slot over the levels below
+void cascade(Wheel& w, uint32_t core, uint32_t level) {
+    uint32_t index = (w.clk >> (BITS * level)) & MASK;
+    Timeout* list = w.slots[level][index];
+    w.slots[level][index] = nullptr;
+    w.occupied[level] &= ~(1ull << index);
+    while (list != nullptr) {
+        Timeout* next = list->next;
+        place(w, list, core);
+        w.stats.cascaded++;
+        list = next;
+    }
+}
+
+// locked: move clk to `to`, cascading if it lands on a level 0 wrap. Any
+// wraps skipped over must have had nothing to cascade.
+void advance(Wheel& w, uint32_t core, uint64_t to) {
+    w.clk = to;
+    if ((to & MASK) != 0) return;
+    for (uint32_t level = 1; level < TIMEOUT_LEVELS; level++) {
+        cascade(w, core, level);
+        if (((to >> (BITS * level)) & MASK) != 0) break;
+    }
+}
+
+/*
+ * locked: the first unit at or after clk where anything happens, a level
+ * 0 slot falling due or a higher slot cascading, NEVER if the wheel is
+ * empty. Slots behind the current one on some level are on its next turn,
+ * so that level's wrap stands in for them.
+ */
+uint64_t nextUnit(Wheel& w) {
+    if (w.stats.pending == 0) return NEVER;
+    for (uint32_t level = 0; level < TIMEOUT_LEVELS; level++) {
+        uint32_t shift = BITS * level;
+        uint64_t index = (w.clk >> shift) & MASK;
+        uint64_t bits = w.occupied[level];
+        // the current slot above level 0 has been cascaded already
+        uint64_t from = level == 0 ? index : index + 1;
+        uint64_t later = from < SLOTS ? bits & (~0ull << from) : 0;
+        if (later != 0) return ((w.clk >> shift) - index + __builtin_ctzll(later)) << shift;
+        if (bits != 0) return ((w.clk >> (shift + BITS)) + 1) << (shift + BITS);
+    }
+    return NEVER;
+}
+
+// locked, on the wheel's own core: the timer deadline to the next event
+void reprogram(Wheel& w) {
+    uint64_t next = nextUnit(w);
+    uint64_t when = next == NEVER ? TIMER_NEVER : next << unitShift;
+    if (when == w.programmed) return;
+    w.programmed = when;
+    timer_set_deadline(when);
+}
+
+// locked: run clk up to now, moving what fell due onto the expiring list
+uint64_t turn(Wheel& w, uint32_t core) {
+    uint64_t target = now();
+    uint64_t batch = 0;
+    while (w.clk <= target) {
+        uint64_t next = nextUnit(w);
+        if (next > target) {
+            advance(w, core, target + 1);
+            break;
+        }
+        if (next > w.clk) advance(w, core, next);
+        uint32_t index = w.clk & MASK;
+        while (w.slots[0][index] != nullptr) {
+            Timeout* t = w.slots[0][index];
+            detach(w, t);
+            t->slot = EXPIRING;
+            link(w.expiring, t);
+            batch++;
+        }
+        advance(w, core, w.clk + 1);
+    }
+    return batch;
+}
+
+// the timer deadline hook, in interrupt context
+void expire() {
+    uint32_t core = getCoreID();
+    Wheel& w = wheels.forCPU(core);
+    if (!w.ready) return;
+    w.lock.lock();
+    w.programmed = TIMER_NEVER;         // it just went off
+    uint64_t batch = turn(w, core);
+    w.stats.runs++;
+    w.stats.expired += batch;
+    if (batch > w.stats.maxBatch) w.stats.maxBatch = batch;
+    // one at a time, so a callback can add or cancel any of the others
+    while (w.expiring != nullptr) {
+        Timeout* t = w.expiring;
+        void (*fn)(void*) = t->fn;
+        void* arg = t->arg;
+        // after this the owner may reuse it
+        unlink(w, t);
+        w.lock.unlock();
+        fn(arg);
+        w.lock.lock();
+    }
+    reprogram(w);
+    w.lock.unlock();
+}
+
+// on a core that was handed timeouts
+void retune(void*) {
+    Wheel& w = wheels.mine();
+    uint64_t flags = irq_save();
+    w.lock.lock();
+    reprogram(w);
+    w.lock.unlock();
+    irq_restore(flags);
+}
+
+void wakeSleeper(void* arg) {
+    wake_up((task_struct*) arg);
+}
+
+}
+
+void timeoutInit() {
+    uint64_t unit = timer_freq() / 10000;
+    uint32_t shift = 0;
+    while ((1ull << shift) < unit) shift++;
+    unitShift = shift;
+
+    Wheel& w = wheels.mine();
+    w.clk = now();
+    w.programmed = TIMER_NEVER;
+    timer_set_deadline_hook(expire);
+    __atomic_store_n(&w.ready, true, __ATOMIC_RELEASE);
+}
+
+void timeout_add(Timeout& t, uint64_t expires) {
+    timeout_cancel(t);
+    uint32_t core = getCoreID();
+    Wheel& w = wheels.forCPU(core);
+    uint64_t flags = irq_save();
+    w.lock.lock();
+    // an empty wheel isn't turned, so clk may be far behind
+    uint64_t unit = now();
+    if (w.stats.pending == 0 && w.expiring == nullptr && unit > w.clk) w.clk = unit;
+    t.expires = expires;
+    place(w, &t, core);
+    w.stats.pending++;
+    w.stats.added++;
+    reprogram(w);
+    w.lock.unlock();
+    irq_restore(flags);
+}
+
+bool timeout_cancel(Timeout& t) {
+    while (true) {
+        int32_t core = __atomic_load_n(&t.cpu, __ATOMIC_ACQUIRE);
+        if (core < 0) return false;
+        Wheel& w = wheels.forCPU(core);
+        uint64_t flags = irq_save();
+        w.lock.lock();
+        // it may have moved, or gone off, in the meantime
+        bool mine = t.cpu == core;
+        if (mine) {
+            unlink(w, &t);
+            w.stats.cancelled++;
+        }
+        w.lock.unlock();
+        irq_restore(flags);
+        if (mine) return true;
+    }
+}
+
+void timeout_idle_enter() {
+    uint32_t me = getCoreID();
+    Wheel& w = wheels.forCPU(me);
+    if (!w.ready) return;
+    w.idle = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (w.stats.pending == 0) return;
+
+    int target = -1;
+    for (uint32_t core = 0; core < 4; core++) {
+        Wheel& other = wheels.forCPU(core);
+        if (core != me && other.ready && !other.idle) {
+            target = core;
+            break;
+        }
+    }
+    if (target < 0) return;
+    Wheel& to = wheels.forCPU(target);
+
+    uint64_t flags = irq_save();
+    Wheel& first = me < (uint32_t) target ? w : to;
+    Wheel& second = me < (uint32_t) target ? to : w;
+    first.lock.lock();
+    second.lock.lock();
+    uint64_t unit = now();
+    if (to.stats.pending == 0 && to.expiring == nullptr && unit > to.clk) to.clk = unit;
+    uint64_t moved = 0;
+    for (uint32_t level = 0; level < TIMEOUT_LEVELS; level++) {
+        uint64_t bits = w.occupied[level];
+        while (bits != 0) {
+            uint32_t index = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            Timeout* list = w.slots[level][index];
+            w.slots[level][index] = nullptr;
+            w.occupied[level] &= ~(1ull << index);
+            while (list != nullptr) {
+                Timeout* next = list->next;
+                if (list->flags & TIMEOUT_PINNED) {
+                    place(w, list, me);
+                } else {
+                    place(to, list, target);
+                    moved++;
+                }
+                list = next;
+            }
+        }
+    }
+    w.stats.pending -= moved;
+    w.stats.migrated += moved;
+    to.stats.pending += moved;
+    reprogram(w);
+    second.lock.unlock();
+    first.lock.unlock();
+    irq_restore(flags);
+
+    // only a core can set its own timer
+    if (moved != 0) smp_call_function_single(target, retune, nullptr, false);
+}
+
+void timeout_idle_exit() {
+    wheels.mine().idle = false;
+}
+
+void sleep_until(uint64_t when) {
+    task_struct* t = current;
+    if (t == nullptr || !wheels.mine().ready) {
+        while (timer_now() < when) {}
+        return;
+    }
+    while (timer_now() < when) {
+        Timeout to;
+        timeout_init(to, wakeSleeper, t);
+        preempt_disable();
+        t->state = TASK_SLEEPING;
+        timeout_add(to, when);
+        schedule();
+        preempt_enable();
+        // in case something else woke us
+        timeout_cancel(to);
+    }
+}
+
+void sleep_us(uint64_t us) {
+    sleep_until(timer_now() + timer_us(us));
+}
+
+void timeout_stats(uint32_t core, TimeoutStats& st) {
+    st = wheels.forCPU(core).stats;
+}
+
+void timeout_stats_print() {
+    for (uint32_t core = 0; core < 4; core++) {
+        TimeoutStats st;
+        timeout_stats(core, st);
+        printf("| timeouts core %d: %d added, %d cancelled, %d expired, %d cascaded, %d migrated, %d runs (max batch %d), %d pending\n",
+            core, (uint32_t) st.added, (uint32_t) st.cancelled, (uint32_t) st.expired, (uint32_t) st.cascaded,
+            (uint32_t) st.migrated, (uint32_t) st.runs, (uint32_t) st.maxBatch, (uint32_t) st.pending);
+    }
+}
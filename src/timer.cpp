@@ -0,0 +1,125 @@
+#include "timer.h"
+#include "sched.h"
+#include "percpu.h"
+#include "utils.h"
+#include "printf.h"
+
+namespace {
+
+constexpr uintptr_t LOCAL_PERIPHERALS = 0x40000000;
+constexpr uint32_t CNTV_IRQ = 1u << 3;
+
+// CNTV_CTL_EL0
+constexpr uint64_t CTL_ENABLE = 1;
+
+inline volatile uint32_t& timerIrqControl(uint32_t core) {
+    return *(volatile uint32_t*) (LOCAL_PERIPHERALS + 0x40 + 4 * core);
+}
+
+// only ever touched by its own core, with IRQs masked
+struct Clock {
+    uint64_t period;        // counter ticks per scheduler tick
+    uint64_t nextTick;
+    uint64_t deadline;
+    bool idle;              // tick stopped
+    TimerStats stats;
+};
+
+PaddedPerCPU<Clock> clocks;
+
+void (*volatile deadlineHook)() = nullptr;
+
+// the comparator to whatever comes first, or off
+void program(Clock& c) {
+    uint64_t when = c.deadline;
+    if (!c.idle && c.nextTick < when) when = c.nextTick;
+    if (when == TIMER_NEVER) {
+        asm volatile("msr cntv_ctl_el0, %0; isb" :: "r"(0ull) : "memory");
+        return;
+    }
+    // a time already past fires straight away
+    asm volatile("msr cntv_cval_el0, %0" :: "r"(when) : "memory");
+    asm volatile("msr cntv_ctl_el0, %0; isb" :: "r"(CTL_ENABLE) : "memory");
+}
+
+}
+
+void timerInit() {
+    uint32_t core = getCoreID();
+    Clock& c = clocks.forCPU(core);
+    unsigned long flags = irq_save();
+    c.period = timer_freq() / TIMER_HZ;
+    c.nextTick = timer_now() + c.period;
+    c.deadline = TIMER_NEVER;
+    c.idle = false;
+    program(c);
+    timerIrqControl(core) = CNTV_IRQ;
+    irq_restore(flags);
+}
+
+void timer_irq() {
+    Clock& c = clocks.mine();
+    uint64_t now = timer_now();
+    c.stats.irqs++;
+    if (!c.idle && now >= c.nextTick) {
+        uint64_t late = (now - c.nextTick) / c.period;
+        c.stats.missedTicks += late;
+        c.nextTick += (late + 1) * c.period;
+        c.stats.ticks++;
+        timer_tick();
+    }
+    if (now >= c.deadline) {
+        c.deadline = TIMER_NEVER;
+        c.stats.deadlines++;
+        void (*hook)() = deadlineHook;
+        if (hook != nullptr) hook();
+    }
+    // also what acknowledges it: the comparator moves on, or stops
+    program(c);
+}
+
+void timer_set_deadline(uint64_t when) {
+    unsigned long flags = irq_save();
+    Clock& c = clocks.mine();
+    c.deadline = when;
+    program(c);
+    irq_restore(flags);
+}
+
+void timer_set_deadline_hook(void (*hook)()) {
+    deadlineHook = hook;
+}
+
+void tick_idle_enter() {
+    unsigned long flags = irq_save();
+    Clock& c = clocks.mine();
+    c.idle = true;
+    c.stats.idleEnters++;
+    program(c);
+    irq_restore(flags);
+}
+
+void tick_idle_exit() {
+    unsigned long flags = irq_save();
+    Clock& c = clocks.mine();
+    c.idle = false;
+    uint64_t now = timer_now();
+    // nothing was running to charge the skipped ticks to
+    if (c.nextTick <= now) c.nextTick = now + c.period;
+    program(c);
+    irq_restore(flags);
+}
+
+void timer_stats(uint32_t core, TimerStats& st) {
+    st = clocks.forCPU(core).stats;
+}
+
+void timer_stats_print() {
+    for (uint32_t core = 0; core < 4; core++) {
+        TimerStats st;
+        timer_stats(core, st);
+        printf("| timer core %d: %d irqs, %d ticks, %d missed, %d deadlines, %d idle stops\n",
+            core, (uint32_t) st.irqs, (uint32_t) st.ticks, (uint32_t) st.missedTicks,
+            (uint32_t) st.deadlines, (uint32_t) st.idleEnters);
+    }
+}
@@ -65,6 +65,10 @@ void uart_putc(char c) {
     put32(UART0_DR, c);
 }
 
+bool uart_can_putc(void) {
+    return (get32(UART0_FR) & 0x20) == 0;
+}
+
 void uart_puts(const char* str) {
     while (*str) {
         uart_putc(*str++);
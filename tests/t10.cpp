@@ -0,0 +1,49 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Heap benchmark: uniform small sizes.
+ *
+ * Every core keeps SLOTS blocks of 16..256 bytes and replaces a random
+ * one OPS times, on 1, 2 and 4 cores. All of it fits the magazines, so
+ * this is the fast path and how well it scales.
+ */
+
+static constexpr int SLOTS = 64;
+static constexpr int OPS = 4000;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> failed{0};
+static BenchBlock blocks[4][SLOTS];
+
+static void churn(uint32_t me, uint32_t cores) {
+    BenchRng rng{me * 7919 + cores};
+    BenchBlock* mine = blocks[me];
+    for (int op = 0; op < OPS; op++) {
+        BenchBlock& b = mine[rng.next() % SLOTS];
+        if (!b.release()) errors.fetch_add(1);
+        if (!b.fill(rng.range(16, 256))) failed.fetch_add(1);
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (!mine[i].release()) errors.fetch_add(1);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+    for (uint32_t cores = 1; cores <= 4; cores *= 2) {
+        phase.sync();
+        uint64_t start = bench_ticks();
+        if (me < cores) churn(me, cores);
+        phase.sync();
+        uint64_t ticks = bench_ticks() - start;
+        if (me == 0) bench_report("t10", "uniform-16-256", cores, uint64_t(cores) * (2 * OPS + SLOTS), ticks);
+    }
+    if (me == 0) {
+        bench_metric("t10", "uniform-16-256", "failed", failed.get());
+        printf("*** uniform errors %d\n", errors.get());
+    }
+}
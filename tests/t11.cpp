@@ -0,0 +1,65 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Heap benchmark: mixed sizes on all cores.
+ *
+ * Like t10 but requests are log-uniform from 16 B to 8 KB, so most of
+ * them miss the magazines and go through the locked free lists. Worst
+ * single malloc and free are reported along with the throughput.
+ */
+
+static constexpr int SLOTS = 48;
+static constexpr int OPS = 3000;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> failed{0};
+static BenchBlock blocks[4][SLOTS];
+static uint64_t worstMalloc[4];
+static uint64_t worstFree[4];
+
+static void churn(uint32_t me) {
+    BenchRng rng{me + 1};
+    BenchBlock* mine = blocks[me];
+    for (int op = 0; op < OPS; op++) {
+        BenchBlock& b = mine[rng.next() % SLOTS];
+
+        uint64_t start = bench_ticks();
+        if (!b.release()) errors.fetch_add(1);
+        uint64_t t = bench_ticks() - start;
+        if (t > worstFree[me]) worstFree[me] = t;
+
+        start = bench_ticks();
+        if (!b.fill(rng.logRange(4, 12))) failed.fetch_add(1);
+        t = bench_ticks() - start;
+        if (t > worstMalloc[me]) worstMalloc[me] = t;
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (!mine[i].release()) errors.fetch_add(1);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+    phase.sync();
+    uint64_t start = bench_ticks();
+    churn(me);
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+
+    if (me == 0) {
+        uint64_t wm = 0, wf = 0;
+        for (int i = 0; i < 4; i++) {
+            if (worstMalloc[i] > wm) wm = worstMalloc[i];
+            if (worstFree[i] > wf) wf = worstFree[i];
+        }
+        bench_report("t11", "mixed-16-8k", 4, 4 * (2 * OPS + SLOTS), ticks);
+        bench_metric("t11", "mixed-16-8k", "malloc-max-ticks", wm);
+        bench_metric("t11", "mixed-16-8k", "free-max-ticks", wf);
+        bench_metric("t11", "mixed-16-8k", "failed", failed.get());
+        printf("*** mixed errors %d\n", errors.get());
+    }
+}
@@ -0,0 +1,69 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Heap benchmark: larson-style cross-core frees.
+ *
+ * There are four sets of SLOTS blocks. In round r core c works on set
+ * (c + r) % 4, replacing random blocks, so most frees hit a block that
+ * another core allocated a round or more ago. That is the remote-free
+ * path, and the magazines see blocks wander from core to core.
+ */
+
+static constexpr int SLOTS = 64;
+static constexpr int ROUNDS = 16;
+static constexpr int OPS = 500;      // per core per round
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> failed{0};
+static BenchBlock blocks[4][SLOTS];
+
+static void larsonRound(uint32_t me, int r, BenchRng& rng) {
+    BenchBlock* set = blocks[(me + r) % 4];
+    for (int op = 0; op < OPS; op++) {
+        BenchBlock& b = set[rng.next() % SLOTS];
+        if (!b.release()) errors.fetch_add(1);
+        if (!b.fill(rng.range(16, 512))) failed.fetch_add(1);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+    HeapStats before;
+    if (me == 0) heap_stats(before);
+
+    BenchRng rng{me * 31 + 5};
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (int r = 0; r < ROUNDS; r++) {
+        larsonRound(me, r, rng);
+        phase.sync();
+    }
+    uint64_t ticks = bench_ticks() - start;
+
+    if (me == 0) {
+        HeapStats during;
+        heap_stats(during);
+        bench_report("t12", "larson-16-512", 4, 4 * ROUNDS * OPS * 2, ticks);
+        bench_metric("t12", "larson-16-512", "remote-bytes", during.remoteBytes);
+        bench_metric("t12", "larson-16-512", "failed", failed.get());
+    }
+    phase.sync();
+
+    // everyone frees someone else's set
+    BenchBlock* set = blocks[(me + 1) % 4];
+    for (int i = 0; i < SLOTS; i++) {
+        if (!set[i].release()) errors.fetch_add(1);
+    }
+    phase.sync();
+
+    if (me == 0) {
+        HeapStats after;
+        heap_stats(after);
+        printf("*** larson errors %d\n", errors.get());
+        printf("*** larson live bytes back: %s\n", after.liveBytes == before.liveBytes ? "ok" : "FAIL");
+    }
+}
@@ -0,0 +1,76 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Heap benchmark: long-lived blocks and fragmentation.
+ *
+ * Each core interleaves long-lived allocations with a churn of short
+ * lived ones, then drops the short-lived blocks. The long-lived blocks
+ * stay behind scattered over the heap; what matters is how much of the
+ * free space is still usable. Free bytes, free block count and the
+ * largest free block are reported, before and after the long-lived
+ * blocks go too.
+ */
+
+static constexpr int LONG_LIVED = 100;
+static constexpr int SHORT_LIVED = 32;
+static constexpr int CHURN = 20;     // short-lived replacements per long-lived block
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> failed{0};
+static BenchBlock longLived[4][LONG_LIVED];
+static BenchBlock shortLived[4][SHORT_LIVED];
+
+static void report(const char* what) {
+    HeapStats st;
+    heap_stats(st);
+    bench_metric("t13", what, "free-bytes", st.freeBytes);
+    bench_metric("t13", what, "free-blocks", st.freeBlocks);
+    bench_metric("t13", what, "largest-free", st.largestFree);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+    BenchRng rng{me * 101 + 3};
+    HeapStats before;
+    if (me == 0) heap_stats(before);
+
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (int i = 0; i < LONG_LIVED; i++) {
+        if (!longLived[me][i].fill(rng.logRange(6, 10))) failed.fetch_add(1);
+        for (int k = 0; k < CHURN; k++) {
+            BenchBlock& b = shortLived[me][rng.next() % SHORT_LIVED];
+            if (!b.release()) errors.fetch_add(1);
+            if (!b.fill(rng.logRange(4, 11))) failed.fetch_add(1);
+        }
+    }
+    for (int i = 0; i < SHORT_LIVED; i++) {
+        if (!shortLived[me][i].release()) errors.fetch_add(1);
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+
+    if (me == 0) {
+        bench_report("t13", "long-lived", 4, 4 * LONG_LIVED * (1 + 2 * CHURN), ticks);
+        bench_metric("t13", "long-lived", "failed", failed.get());
+        report("long-lived");
+    }
+    phase.sync();
+
+    for (int i = 0; i < LONG_LIVED; i++) {
+        if (!longLived[me][i].release()) errors.fetch_add(1);
+    }
+    phase.sync();
+
+    if (me == 0) {
+        report("all-freed");
+        HeapStats after;
+        heap_stats(after);
+        printf("*** fragmentation errors %d\n", errors.get());
+        printf("*** fragmentation live bytes back: %s\n", after.liveBytes == before.liveBytes ? "ok" : "FAIL");
+    }
+}
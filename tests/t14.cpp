@@ -0,0 +1,70 @@
+#include "printf.h"
+#include "atomic.h"
+#include "spinlock.h"
+#include "queuelock.h"
+#include "bench.h"
+
+/*
+ * Lock contention on 4 cores.
+ *
+ * Every core takes the lock ITERS times, holding it for a short critical
+ * section that bumps a shared counter. Reports throughput and the worst
+ * time any core waited in lock(), which is where unfair locks show up.
+ */
+
+static constexpr int ITERS = 2000;
+static constexpr int HOLD = 20;
+static constexpr int THINK = 10;
+
+static BenchSync phase;
+static uint64_t worstWait[4];
+static volatile uint32_t counter = 0;
+
+static SpinLock spinLock;
+static Spinlock plainLock;
+static TicketLock ticketLock;
+static MCSLock mcsLock;
+
+static void spin(int n) {
+    for (volatile int i = 0; i < n; i++) {}
+}
+
+template <typename L>
+static void contend(const char* what, L& lock) {
+    uint32_t me = getCoreID();
+    worstWait[me] = 0;
+    if (me == 0) counter = 0;
+    phase.sync();
+
+    uint64_t start = bench_ticks();
+    for (int i = 0; i < ITERS; i++) {
+        uint64_t before = bench_ticks();
+        lock.lock();
+        uint64_t waited = bench_ticks() - before;
+        counter = counter + 1;
+        spin(HOLD);
+        lock.unlock();
+        if (waited > worstWait[me]) worstWait[me] = waited;
+        spin(THINK);
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+
+    if (me == 0) {
+        uint64_t worst = 0;
+        for (int i = 0; i < 4; i++) {
+            if (worstWait[i] > worst) worst = worstWait[i];
+        }
+        bench_report("t14", what, 4, 4 * ITERS, ticks);
+        bench_metric("t14", what, "max-wait-ticks", worst);
+        printf("*** %s mutual exclusion: %s\n", what, counter == 4 * ITERS ? "ok" : "FAIL");
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    contend("SpinLock", spinLock);
+    contend("Spinlock", plainLock);
+    contend("TicketLock", ticketLock);
+    contend("MCSLock", mcsLock);
+}
@@ -0,0 +1,102 @@
+#include "printf.h"
+#include "atomic.h"
+#include "bench.h"
+
+/*
+ * Read-mostly data on 1, 2 and 4 cores.
+ *
+ * A table of WORDS words is read as a whole READS times per core, and
+ * core 0 rewrites it once every WRITE_EVERY reads. The writer puts the
+ * same value in every word, so a reader that sees two different values
+ * got a torn read. Compares SpinLock, RWSpinLock and SeqLock.
+ */
+
+static constexpr int WORDS = 16;
+static constexpr int READS = 2000;
+static constexpr int WRITE_EVERY = 64;
+
+static BenchSync phase;
+static Atomic<uint32_t> torn{0};
+static volatile uint64_t table[WORDS];
+
+static SpinLock spinLock;
+static RWSpinLock rwLock;
+static SeqLock seqLock;
+
+static void write(uint64_t v) {
+    for (int i = 0; i < WORDS; i++) table[i] = v;
+}
+
+static bool consistent(uint64_t* copy) {
+    for (int i = 1; i < WORDS; i++) {
+        if (copy[i] != copy[0]) return false;
+    }
+    return true;
+}
+
+static void copyTable(uint64_t* copy) {
+    for (int i = 0; i < WORDS; i++) copy[i] = table[i];
+}
+
+struct WithSpinLock {
+    static void read(uint64_t* copy) {
+        LockGuard g{spinLock};
+        copyTable(copy);
+    }
+    static void update(uint64_t v) {
+        LockGuard g{spinLock};
+        write(v);
+    }
+};
+
+struct WithRWSpinLock {
+    static void read(uint64_t* copy) {
+        ReadGuard g{rwLock};
+        copyTable(copy);
+    }
+    static void update(uint64_t v) {
+        LockGuard g{rwLock};
+        write(v);
+    }
+};
+
+struct WithSeqLock {
+    static void read(uint64_t* copy) {
+        seqLock.read([copy] { copyTable(copy); });
+    }
+    static void update(uint64_t v) {
+        LockGuard g{seqLock};
+        write(v);
+    }
+};
+
+template <typename Lock>
+static void run(const char* what, uint32_t cores) {
+    uint32_t me = getCoreID();
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (me < cores) {
+        uint64_t copy[WORDS];
+        for (int i = 0; i < READS; i++) {
+            if (me == 0 && i % WRITE_EVERY == 0) Lock::update(i);
+            Lock::read(copy);
+            if (!consistent(copy)) torn.fetch_add(1);
+        }
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) bench_report("t15", what, cores, cores * READS, ticks);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    for (uint32_t cores = 1; cores <= 4; cores *= 2) {
+        run<WithSpinLock>("SpinLock", cores);
+        run<WithRWSpinLock>("RWSpinLock", cores);
+        run<WithSeqLock>("SeqLock", cores);
+    }
+    phase.sync();
+    if (getCoreID() == 0) {
+        printf("*** torn reads %d\n", torn.get());
+    }
+}
@@ -0,0 +1,88 @@
+#include "printf.h"
+#include "atomic.h"
+#include "bench.h"
+
+/*
+ * Cost of each memory order, and 64-bit atomics.
+ *
+ * Core 0 times OPS uncontended operations per case; "loop" is the same
+ * loop doing a plain volatile access, to subtract. Then all cores hammer
+ * one Atomic<uint64_t> across the 2^32 boundary and set their own bits
+ * in the upper half with fetch_or, to check the 64-bit operations.
+ */
+
+static constexpr int OPS = 10000;
+static constexpr uint32_t ADDS = 5000;
+static constexpr uint64_t START = 0xffffff00ull;
+
+static BenchSync phase;
+static Atomic<uint32_t> a32{0};
+static Atomic<uint64_t> a64{0};
+static Atomic<uint64_t> wide{START};
+static Atomic<uint64_t> bits{0};
+static volatile uint64_t plain = 0;
+
+template <typename Op>
+static void timeOp(const char* what, Op op) {
+    uint64_t start = bench_ticks();
+    for (int i = 0; i < OPS; i++) op();
+    bench_report("t16", what, 1, OPS, bench_ticks() - start);
+}
+
+static void orders() {
+    timeOp("loop", [] { plain = plain + 1; });
+
+    timeOp("load-relaxed-32", [] { a32.get<MO_RELAXED>(); });
+    timeOp("load-acquire-32", [] { a32.get<MO_ACQUIRE>(); });
+    timeOp("load-seq_cst-32", [] { a32.get(); });
+    timeOp("store-relaxed-32", [] { a32.set<MO_RELAXED>(1); });
+    timeOp("store-release-32", [] { a32.set<MO_RELEASE>(1); });
+    timeOp("store-seq_cst-32", [] { a32.set(1); });
+    timeOp("fetch_add-relaxed-32", [] { a32.fetch_add<MO_RELAXED>(1); });
+    timeOp("fetch_add-acq_rel-32", [] { a32.fetch_add<MO_ACQ_REL>(1); });
+    timeOp("fetch_add-seq_cst-32", [] { a32.fetch_add(1); });
+    timeOp("cas-relaxed-32", [] {
+        uint32_t v = a32.get<MO_RELAXED>();
+        a32.compare_exchange<MO_RELAXED>(v, v + 1);
+    });
+    timeOp("cas-acq_rel-32", [] {
+        uint32_t v = a32.get<MO_RELAXED>();
+        a32.compare_exchange<MO_ACQ_REL>(v, v + 1);
+    });
+    timeOp("cas-seq_cst-32", [] {
+        uint32_t v = a32.get<MO_RELAXED>();
+        a32.compare_exchange(v, v + 1);
+    });
+
+    timeOp("load-relaxed-64", [] { a64.get<MO_RELAXED>(); });
+    timeOp("load-seq_cst-64", [] { a64.get(); });
+    timeOp("fetch_add-relaxed-64", [] { a64.fetch_add<MO_RELAXED>(1); });
+    timeOp("fetch_add-seq_cst-64", [] { a64.fetch_add(1); });
+    timeOp("fetch_or-relaxed-64", [] { a64.fetch_or<MO_RELAXED>(1); });
+    timeOp("exchange-acquire-64", [] { a64.exchange<MO_ACQUIRE>(1); });
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+    if (me == 0) orders();
+    phase.sync();
+
+    for (uint32_t i = 0; i < ADDS; i++) {
+        if (i & 1) {
+            wide.fetch_add<MO_RELAXED>(1);
+        } else {
+            uint64_t v = wide.get<MO_RELAXED>();
+            while (!wide.compare_exchange_weak<MO_RELAXED>(v, v + 1)) {}
+        }
+    }
+    bits.fetch_or<MO_RELAXED>(uint64_t(1) << (32 + me));
+    bits.fetch_or<MO_RELAXED>(uint64_t(1) << me);
+    bits.fetch_and<MO_RELAXED>(~(uint64_t(1) << me));
+    phase.sync();
+
+    if (me == 0) {
+        printf("*** 64-bit add: %s\n", wide.get() == START + 4 * ADDS ? "ok" : "FAIL");
+        printf("*** 64-bit or/and: %s\n", bits.get() == (uint64_t(0xf) << 32) ? "ok" : "FAIL");
+    }
+}
@@ -0,0 +1,63 @@
+#include "printf.h"
+#include "atomic.h"
+#include "bench.h"
+
+/*
+ * Barrier latency on 2 and 4 cores.
+ *
+ * The participating cores run ITERS phases. In each one every core writes
+ * the phase number into its own slot, syncs, checks that every other
+ * participant's slot has it too, and syncs again before the next write.
+ * Reports ticks per barrier for SenseBarrier and TreeBarrier over cores
+ * {0,1}, {0,2} (different pair, same count) and all four.
+ */
+
+static constexpr int ITERS = 2000;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static volatile uint32_t slots[4];
+
+static SenseBarrier sensePair{2};
+static SenseBarrier senseAll{4};
+static TreeBarrier treePair01{0x3};
+static TreeBarrier treePair02{0x5};
+static TreeBarrier treeAll{0xf};
+
+template <typename B>
+static void run(const char* what, B& barrier, uint32_t mask) {
+    uint32_t me = getCoreID();
+    uint32_t cores = 0;
+    for (int i = 0; i < 4; i++) cores += (mask >> i) & 1;
+
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (mask & (1u << me)) {
+        for (int i = 1; i <= ITERS; i++) {
+            slots[me] = i;
+            barrier.sync();
+            for (int c = 0; c < 4; c++) {
+                if ((mask & (1u << c)) && slots[c] != (uint32_t) i) errors.fetch_add(1);
+            }
+            barrier.sync();
+        }
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) bench_report("t17", what, cores, 2 * ITERS, ticks);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    run("SenseBarrier-01", sensePair, 0x3);
+    run("SenseBarrier-02", sensePair, 0x5);
+    run("SenseBarrier", senseAll, 0xf);
+    run("TreeBarrier-01", treePair01, 0x3);
+    run("TreeBarrier-02", treePair02, 0x5);
+    run("TreeBarrier", treeAll, 0xf);
+
+    phase.sync();
+    if (getCoreID() == 0) {
+        printf("*** barrier phase errors %d\n", errors.get());
+    }
+}
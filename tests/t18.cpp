@@ -0,0 +1,135 @@
+#include "printf.h"
+#include "ring.h"
+#include "bench.h"
+
+/*
+ * Ring buffer throughput.
+ *
+ * SPSC: MSGS messages from one core to another for each of the 12
+ * ordered core pairs, one at a time with the blocking push/pop, and for
+ * 0 -> 1 again in batches of BATCH. MPMC: cores 0 and 1 produce, 2 and 3
+ * consume, single and batched. Consumers check order (SPSC) or the sum
+ * of everything received (MPMC). Rates are in messages per second.
+ */
+
+static constexpr uint32_t MSGS = 20000;
+static constexpr uint32_t BATCH = 16;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint64_t> received{0};
+
+static SPSCRing<uint32_t, 256> spsc;
+static MPMCRing<uint32_t, 256> mpmc;
+
+static void rate(const char* what, uint32_t cores, uint64_t msgs, uint64_t ticks) {
+    bench_report("t18", what, cores, msgs, ticks);
+    bench_metric("t18", what, "msgs-per-sec", ticks == 0 ? 0 : msgs * bench_freq() / ticks);
+}
+
+static void spscPair(uint32_t from, uint32_t to) {
+    uint32_t me = getCoreID();
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (me == from) {
+        for (uint32_t i = 0; i < MSGS; i++) spsc.push(i);
+    } else if (me == to) {
+        for (uint32_t i = 0; i < MSGS; i++) {
+            if (spsc.pop() != i) errors.fetch_add(1);
+        }
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) {
+        char what[16] = "spsc-x-y";
+        what[5] = '0' + from;
+        what[7] = '0' + to;
+        rate(what, 2, MSGS, ticks);
+    }
+}
+
+static void spscBatched() {
+    uint32_t me = getCoreID();
+    uint32_t buf[BATCH];
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (me == 0) {
+        for (uint32_t sent = 0; sent < MSGS; ) {
+            uint32_t n = MSGS - sent < BATCH ? MSGS - sent : BATCH;
+            for (uint32_t i = 0; i < n; i++) buf[i] = sent + i;
+            sent += spsc.push_batch(buf, n);
+        }
+    } else if (me == 1) {
+        for (uint32_t got = 0; got < MSGS; ) {
+            uint32_t n = spsc.pop_batch(buf, BATCH);
+            for (uint32_t i = 0; i < n; i++) {
+                if (buf[i] != got + i) errors.fetch_add(1);
+            }
+            got += n;
+        }
+    }
+    phase.sync();
+    if (me == 0) rate("spsc-batch-0-1", 2, MSGS, bench_ticks() - start);
+}
+
+static void mpmcRun(const char* what, uint32_t batch) {
+    uint32_t me = getCoreID();
+    uint32_t buf[BATCH];
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (me < 2) {
+        // each producer sends MSGS / 2 messages
+        for (uint32_t sent = 0; sent < MSGS / 2; ) {
+            uint32_t n = MSGS / 2 - sent < batch ? MSGS / 2 - sent : batch;
+            for (uint32_t i = 0; i < n; i++) buf[i] = sent + i + 1;
+            if (batch == 1) {
+                mpmc.push(buf[0]);
+                sent++;
+            } else {
+                sent += mpmc.push_batch(buf, n);
+            }
+        }
+    } else {
+        uint64_t sum = 0;
+        uint32_t got = 0;
+        // each consumer takes MSGS / 2 messages
+        while (got < MSGS / 2) {
+            uint32_t want = MSGS / 2 - got < batch ? MSGS / 2 - got : batch;
+            uint32_t n;
+            if (batch == 1) {
+                buf[0] = mpmc.pop();
+                n = 1;
+            } else {
+                n = mpmc.pop_batch(buf, want);
+            }
+            for (uint32_t i = 0; i < n; i++) sum += buf[i];
+            got += n;
+        }
+        received.fetch_add(sum);
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) rate(what, 4, MSGS, ticks);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    for (uint32_t from = 0; from < 4; from++) {
+        for (uint32_t to = 0; to < 4; to++) {
+            if (from != to) spscPair(from, to);
+        }
+    }
+    spscBatched();
+    mpmcRun("mpmc-2p2c", 1);
+    mpmcRun("mpmc-batch-2p2c", BATCH);
+
+    phase.sync();
+    if (getCoreID() == 0) {
+        // two producers each sent 1 .. MSGS/2, twice over
+        uint64_t half = MSGS / 2;
+        uint64_t expected = 2 * 2 * (half * (half + 1) / 2);
+        printf("*** spsc order errors %d\n", errors.get());
+        printf("*** mpmc sum: %s\n", received.get() == expected ? "ok" : "FAIL");
+        printf("*** rings empty: %s\n", spsc.size() == 0 && mpmc.size() == 0 ? "ok" : "FAIL");
+    }
+}
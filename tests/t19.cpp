@@ -0,0 +1,177 @@
+#include "printf.h"
+#include "ipi.h"
+#include "bench.h"
+
+/*
+ * Inter-processor interrupts.
+ *
+ * While core 0 drives each part, the other cores sleep in cpu_idle_until,
+ * so every IPI also has to wake a core out of WFI.
+ *
+ *   sync calls:   core 0 calls each other core ROUNDS times and waits
+ *   async calls:  every core fires ASYNC calls at every other core, then
+ *                 one waited call each; calls from one sender run in
+ *                 order, so all of its async calls have run by then
+ *   wake:         IPI_WAKE latency, sent to received, on the counter
+ *   resched:      each kick runs the hook once on the right core
+ *   tlb:          all four cores shoot down at once, SHOOTS times each
+ */
+
+static constexpr uint32_t ROUNDS = 1000;
+static constexpr uint32_t ASYNC = 2000;
+static constexpr uint32_t SHOOTS = 200;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> stop{0};
+
+static Atomic<uint32_t> hits[4] = {0, 0, 0, 0};
+static Atomic<uint32_t> kicks[4] = {0, 0, 0, 0};
+static Atomic<uint32_t> woken[4] = {0, 0, 0, 0};
+static volatile uint64_t sentAt;
+static volatile uint64_t wakeTicks;
+
+static void hit(void* arg) {
+    uint32_t core = (uint32_t) (uintptr_t) arg;
+    if (core != getCoreID()) errors.fetch_add(1);
+    hits[core].fetch_add<MO_RELAXED>(1);
+}
+
+static void kicked() {
+    kicks[getCoreID()].fetch_add<MO_RELAXED>(1);
+}
+
+// everyone but core 0 sleeps until core 0 says stop
+static void idleOthers() {
+    if (getCoreID() != 0) {
+        cpu_idle_until([] { return stop.get() != 0; });
+    }
+}
+
+static void syncCalls() {
+    stop.set(0);
+    phase.sync();
+    if (getCoreID() == 0) {
+        uint64_t start = bench_ticks();
+        for (uint32_t i = 0; i < ROUNDS; i++) {
+            for (uint32_t core = 1; core < 4; core++) {
+                smp_call_function_single(core, hit, (void*) (uintptr_t) core, true);
+            }
+        }
+        uint64_t ticks = bench_ticks() - start;
+        bench_report("t19", "call-sync", 4, 3 * ROUNDS, ticks);
+        for (uint32_t core = 1; core < 4; core++) {
+            if (hits[core].get() != ROUNDS) errors.fetch_add(1);
+        }
+        printf("*** sync calls %s\n", errors.get() == 0 ? "ok" : "FAILED");
+        stop.set(1);
+        ipi_send_mask(0xe, IPI_WAKE);
+    }
+    idleOthers();
+}
+
+static void asyncCalls() {
+    uint32_t me = getCoreID();
+    if (me == 0) {
+        for (uint32_t core = 0; core < 4; core++) hits[core].set(0);
+    }
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (uint32_t i = 0; i < ASYNC; i++) {
+        uint32_t core = (me + 1 + i % 3) % 4;
+        smp_call_function_single(core, hit, (void*) (uintptr_t) core, false);
+    }
+    for (uint32_t core = 0; core < 4; core++) {
+        if (core != me) smp_call_function_single(core, hit, (void*) (uintptr_t) core, true);
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) {
+        bench_report("t19", "call-async", 4, 4 * (ASYNC + 3), ticks);
+        bool ok = true;
+        for (uint32_t core = 0; core < 4; core++) {
+            if (hits[core].get() != ASYNC + 3) ok = false;
+        }
+        printf("*** async calls %s\n", ok ? "ok" : "FAILED");
+    }
+}
+
+static void wake() {
+    uint32_t me = getCoreID();
+    uint64_t total = 0;
+    phase.sync();
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        uint32_t target = 1 + i % 3;
+        if (me == 0) {
+            sentAt = bench_ticks();
+            woken[target].set(i + 1);
+            ipi_send(target, IPI_WAKE);
+            uint32_t seen = woken[0].get();
+            while (seen != i + 1) seen = woken[0].wait_while(seen);
+            total += wakeTicks;
+        } else if (me == target) {
+            cpu_idle_until([&] { return woken[me].get() == i + 1; });
+            wakeTicks = bench_ticks() - sentAt;
+            woken[0].set(i + 1);
+        }
+    }
+    phase.sync();
+    if (me == 0) {
+        bench_metric("t19", "wake", "avg-ticks", total / ROUNDS);
+        printf("*** idle cores woke ok\n");
+    }
+}
+
+static void reschedule() {
+    stop.set(0);
+    if (getCoreID() == 0) ipi_set_reschedule_hook(kicked);
+    phase.sync();
+    if (getCoreID() == 0) {
+        for (uint32_t i = 0; i < ROUNDS; i++) {
+            uint32_t core = 1 + i % 3;
+            uint32_t before = kicks[core].get();
+            smp_send_reschedule(core);
+            while (kicks[core].get() == before) iAmStuckInALoop(false);
+        }
+        bool ok = kicks[0].get() == 0;
+        for (uint32_t core = 1; core < 4; core++) {
+            if (kicks[core].get() != ROUNDS / 3 + (core <= ROUNDS % 3)) ok = false;
+        }
+        printf("*** reschedule kicks %s\n", ok ? "ok" : "FAILED");
+        stop.set(1);
+        ipi_send_mask(0xe, IPI_WAKE);
+    }
+    idleOthers();
+}
+
+static void shootdowns() {
+    IpiStats before;
+    ipi_stats(getCoreID(), before);
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (uint32_t i = 0; i < SHOOTS; i++) {
+        tlb_shootdown(0xf, i % 2 ? TLB_ALL : (uint64_t) &sentAt);
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    IpiStats after;
+    ipi_stats(getCoreID(), after);
+    if (after.received[IPI_TLB] - before.received[IPI_TLB] != 3 * SHOOTS) errors.fetch_add(1);
+    phase.sync();
+    if (getCoreID() == 0) {
+        bench_report("t19", "tlb-shootdown", 4, 4 * SHOOTS, ticks);
+        printf("*** tlb shootdowns %s\n", errors.get() == 0 ? "ok" : "FAILED");
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    syncCalls();
+    asyncCalls();
+    wake();
+    reschedule();
+    shootdowns();
+
+    phase.sync();
+    if (getCoreID() == 0) ipi_stats_print();
+}
@@ -0,0 +1,62 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Allocation throughput on 1, 2 and 4 cores.
+ *
+ * 32 byte requests are served by the per-core magazines, 1 KB requests
+ * are too big for them and always take the heap lock.
+ */
+
+static constexpr int ROUNDS = 2000;
+static constexpr int DEPTH = 8;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+
+static void churn(size_t bytes) {
+    uint64_t* live[DEPTH];
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < DEPTH; i++) {
+            live[i] = (uint64_t*) malloc(bytes);
+            if (live[i] == nullptr) {
+                errors.fetch_add(1);
+            } else {
+                live[i][0] = r;
+                live[i][bytes / 8 - 1] = i;
+            }
+        }
+        for (int i = DEPTH - 1; i >= 0; i--) {
+            if (live[i] == nullptr) continue;
+            if (live[i][0] != (uint64_t) r || live[i][bytes / 8 - 1] != (uint64_t) i) {
+                errors.fetch_add(1);
+            }
+            free(live[i]);
+        }
+    }
+}
+
+static void run(const char* what, size_t bytes, uint32_t cores) {
+    uint32_t me = getCoreID();
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (me < cores) churn(bytes);
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) {
+        bench_report("t2", what, cores, uint64_t(cores) * ROUNDS * DEPTH * 2, ticks);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    for (uint32_t cores = 1; cores <= 4; cores *= 2) {
+        run("malloc-32", 32, cores);
+        run("malloc-1k", 1024, cores);
+    }
+    phase.sync();
+    if (getCoreID() == 0) {
+        printf("*** churn errors %d\n", errors.get());
+    }
+}
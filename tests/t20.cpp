@@ -0,0 +1,174 @@
+#include "printf.h"
+#include "rcu.h"
+#include "bench.h"
+
+/*
+ * Read-mostly linked list: RCU readers against SpinLock readers.
+ *
+ * A sorted list of KEYS nodes. All four cores look up random keys;
+ * core 0 also replaces a random node with an updated copy every
+ * UPDATE_EVERY lookups. With RCU the readers take no lock, the writer
+ * publishes the copy with rcu_assign and retires the old node with
+ * call_rcu, and every core announces a quiescent state every QUIESCE
+ * lookups. With the lock every lookup and update holds one SpinLock and
+ * the old node is freed on the spot.
+ *
+ * Reclaimed nodes are poisoned before they go back to the heap, so a
+ * reader that reaches one too early sees the poison.
+ *
+ * Then core 0 alone replaces SOLO nodes and waits for a grace period
+ * while the others sit offline in a barrier; that must not wait for
+ * them, and has to reclaim everything it retired.
+ */
+
+static constexpr uint32_t KEYS = 64;
+static constexpr uint32_t LOOKUPS = 20000;
+static constexpr uint32_t UPDATE_EVERY = 32;
+static constexpr uint32_t QUIESCE = 16;
+static constexpr uint32_t SOLO = 200;
+static constexpr uint32_t ALIVE = 0xA11FE;
+static constexpr uint32_t DEAD = 0xDEAD;
+
+struct Node {
+    RcuHead rcu;            // first, for rcu_free and the cast in poison()
+    Node* next;
+    uint32_t key;
+    uint32_t value;
+    uint32_t magic;
+};
+
+static BenchSync phase;
+static Atomic<uint32_t> stale{0};
+static Atomic<uint32_t> missing{0};
+static SpinLock listLock;
+static Node* list;
+
+static Node* makeNode(uint32_t key, uint32_t value, Node* next) {
+    Node* n = (Node*) malloc(sizeof(Node));
+    n->next = next;
+    n->key = key;
+    n->value = value;
+    n->magic = ALIVE;
+    return n;
+}
+
+static void poison(RcuHead* head) {
+    Node* n = (Node*) head;
+    n->magic = DEAD;
+    free(n);
+}
+
+static void build() {
+    list = nullptr;
+    for (uint32_t k = KEYS; k-- > 0; ) list = makeNode(k, 0, list);
+}
+
+static void destroy() {
+    while (list != nullptr) {
+        Node* n = list;
+        list = n->next;
+        free(n);
+    }
+}
+
+static uint32_t lookup(uint32_t key) {
+    for (Node* n = rcu_dereference(list); n != nullptr; n = rcu_dereference(n->next)) {
+        if (n->magic != ALIVE) stale.fetch_add(1);
+        if (n->key == key) return n->value;
+    }
+    missing.fetch_add(1);
+    return 0;
+}
+
+// caller serializes writers; returns the node it replaced
+static Node* replace(uint32_t key) {
+    Node** link = &list;
+    Node* old = *link;
+    while (old->key != key) {
+        link = &old->next;
+        old = *link;
+    }
+    Node* copy = makeNode(key, old->value + 1, old->next);
+    rcu_assign(*link, copy);
+    return old;
+}
+
+template <bool useRcu>
+static void run(const char* what) {
+    uint32_t me = getCoreID();
+    BenchRng rng(me * 7919 + 1);
+    uint32_t sum = 0;
+    if (me == 0) build();
+    if (useRcu) rcu_online();
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (uint32_t i = 1; i <= LOOKUPS; i++) {
+        uint32_t key = rng.range(0, KEYS - 1);
+        if (useRcu) {
+            rcu_read_lock();
+            sum += lookup(key);
+            rcu_read_unlock();
+            if (me == 0 && i % UPDATE_EVERY == 0) {
+                Node* old = replace(rng.range(0, KEYS - 1));
+                call_rcu(&old->rcu, poison);
+            }
+            if (i % QUIESCE == 0) rcu_quiescent();
+        } else {
+            listLock.lock();
+            sum += lookup(key);
+            if (me == 0 && i % UPDATE_EVERY == 0) {
+                Node* old = replace(rng.range(0, KEYS - 1));
+                poison(&old->rcu);
+            }
+            listLock.unlock();
+        }
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (useRcu) {
+        rcu_synchronize();
+        rcu_offline();
+    }
+    phase.sync();
+    if (me == 0) {
+        bench_report("t20", what, 4, 4 * LOOKUPS, ticks);
+        bench_metric("t20", what, "lookups-per-sec", ticks == 0 ? 0 : 4ull * LOOKUPS * bench_freq() / ticks);
+        destroy();
+    }
+    (void) sum;
+}
+
+static void solo() {
+    RcuStats before, after;
+    rcu_stats(before);
+    build();
+    for (uint32_t i = 0; i < SOLO; i++) {
+        Node* old = replace(i % KEYS);
+        call_rcu(&old->rcu, poison);
+    }
+    rcu_synchronize();
+    rcu_stats(after);
+    destroy();
+    printf("*** rcu writer alone reclaimed all: %s\n",
+        after.retired - before.retired == SOLO && after.reclaimed == after.retired ? "ok" : "FAILED");
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    run<false>("spinlock-read");
+    run<true>("rcu-read");
+
+    phase.sync();
+    if (getCoreID() == 0) {
+        RcuStats st;
+        rcu_stats(st);
+        rcu_stats_print();
+        printf("*** stale reads %d, missing keys %d\n", stale.get(), missing.get());
+        printf("*** rcu reclaimed all: %s\n",
+            st.retired == (LOOKUPS / UPDATE_EVERY) && st.reclaimed == st.retired ? "ok" : "FAILED");
+    }
+
+    phase.sync();
+    if (getCoreID() == 0) solo();
+    phase.sync();
+}
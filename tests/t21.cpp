@@ -0,0 +1,91 @@
+#include "printf.h"
+#include "atomic.h"
+#include "queuelock.h"
+#include "critical.h"
+#include "lockprof.h"
+#include "bench.h"
+
+/*
+ * Lock contention profiling.
+ *
+ * All four cores hammer a named SpinLock, a named TicketLock and
+ * critical(), each from two call sites, and check mutual exclusion the
+ * usual way (a non-atomic counter). In a LOCK_PROFILE build the
+ * statistics must add up: every acquisition counted, per site too,
+ * contended ones included. Either way the report goes to the UART and
+ * the cost per acquisition to the bench lines, so a profiled and an
+ * unprofiled run can be compared.
+ */
+
+static constexpr uint32_t ITERS = 5000;
+
+static BenchSync phase;
+static SpinLock spinLock{"t21-spin"};
+static TicketLock ticketLock{"t21-ticket"};
+static volatile uint32_t counter;
+
+template <typename Lock>
+static void siteA(Lock& lock) {
+    LockGuard g{lock};
+    counter = counter + 1;
+}
+
+template <typename Lock>
+static void siteB(Lock& lock) {
+    lock.lock();
+    counter = counter + 1;
+    lock.unlock();
+}
+
+static void criticalA() {
+    critical([] { counter = counter + 1; });
+}
+
+static void criticalB() {
+    critical([] { counter = counter + 1; });
+}
+
+template <typename Lock>
+static bool profileOk(Lock& lock) {
+#ifdef LOCK_PROFILE
+    const LockProfile& p = lock.profile();
+    uint64_t sites = 0;
+    for (int i = 0; i < LOCK_PROFILE_SITES; i++) sites += p.sites[i].acquired;
+    return p.acquired == 4 * ITERS && sites + p.otherSites == p.acquired &&
+        p.contended <= p.acquired && p.maxSpin <= p.spinTicks && p.maxHold <= p.holdTicks;
+#else
+    (void) lock;
+    return true;
+#endif
+}
+
+template <typename Work>
+static void run(const char* what, Work work) {
+    phase.sync();
+    if (getCoreID() == 0) counter = 0;
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (uint32_t i = 0; i < ITERS; i++) work(i);
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (getCoreID() == 0) {
+        bench_report("t21", what, 4, 4 * ITERS, ticks);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    run("SpinLock", [](uint32_t i) { if (i & 1) siteA(spinLock); else siteB(spinLock); });
+    if (getCoreID() == 0) {
+        printf("*** profiled SpinLock: %s\n", counter == 4 * ITERS && profileOk(spinLock) ? "ok" : "FAILED");
+    }
+    run("TicketLock", [](uint32_t i) { if (i & 1) siteA(ticketLock); else siteB(ticketLock); });
+    if (getCoreID() == 0) {
+        printf("*** profiled TicketLock: %s\n", counter == 4 * ITERS && profileOk(ticketLock) ? "ok" : "FAILED");
+    }
+    run("critical", [](uint32_t i) { if (i & 1) criticalA(); else criticalB(); });
+    if (getCoreID() == 0) {
+        printf("*** profiled critical(): %s\n", counter == 4 * ITERS ? "ok" : "FAILED");
+        lock_profile_report();
+    }
+}
@@ -0,0 +1,152 @@
+#include "printf.h"
+#include "sched.h"
+#include "ipi.h"
+#include "bench.h"
+
+/*
+ * Preemptive scheduling on the per-core run queues.
+ *
+ *   ping-pong:   on core 0, kernelMain and one thread yield to each other
+ *                SWITCHES times; every yield must switch, so the two
+ *                strictly alternate
+ *   spawn/join:  every core creates BATCH threads for itself at a time
+ *                and joins them, SPAWNS in all
+ *   preemption:  two threads on core 1 spin without ever yielding, with
+ *                slices of SLOW and FAST ticks. Core 0 plays the timer,
+ *                running timer_tick on core 1 through an IPI TICKS times;
+ *                both threads must make progress, and the one with the
+ *                longer slice more of it
+ */
+
+static constexpr uint32_t SWITCHES = 5000;
+static constexpr uint32_t SPAWNS = 400;
+static constexpr uint32_t BATCH = 8;
+static constexpr uint32_t TICKS = 400;
+static constexpr long SLOW = 2;
+static constexpr long FAST = 6;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> spawned{0};
+static Atomic<uint32_t> stop{0};
+static volatile uint32_t step;
+
+struct alignas(64) Progress {
+    volatile uint64_t count;
+};
+static Progress progress[2];
+
+// preemption off, so the tick can't switch anywhere but at the yields
+static void pong(void*) {
+    preempt_disable();
+    for (uint32_t i = 0; i < SWITCHES; i++) {
+        if (step % 2 != 1) errors.fetch_add(1);
+        step = step + 1;
+        yield();
+    }
+    preempt_enable();
+}
+
+static void pingPong() {
+    phase.sync();
+    if (getCoreID() == 0) {
+        step = 0;
+        task_struct* t = kthread_create(pong, nullptr, 0);
+        if (t == nullptr) errors.fetch_add(1);
+        uint64_t start = bench_ticks();
+        preempt_disable();
+        for (uint32_t i = 0; i < SWITCHES; i++) {
+            if (step % 2 != 0) errors.fetch_add(1);
+            step = step + 1;
+            yield();
+        }
+        preempt_enable();
+        uint64_t ticks = bench_ticks() - start;
+        kthread_join(t);
+        bench_report("t22", "yield-switch", 1, 2 * SWITCHES, ticks);
+        printf("*** yield ping-pong %s\n", errors.get() == 0 && step == 2 * SWITCHES ? "ok" : "FAILED");
+    }
+    phase.sync();
+}
+
+static void spawnee(void* arg) {
+    if ((uintptr_t) arg != getCoreID()) errors.fetch_add(1);
+    spawned.fetch_add<MO_RELAXED>(1);
+}
+
+static void spawnJoin() {
+    uint32_t me = getCoreID();
+    task_struct* batch[BATCH];
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (uint32_t done = 0; done < SPAWNS; done += BATCH) {
+        for (uint32_t i = 0; i < BATCH; i++) {
+            batch[i] = kthread_create(spawnee, (void*) (uintptr_t) me, me);
+            if (batch[i] == nullptr) errors.fetch_add(1);
+        }
+        for (uint32_t i = 0; i < BATCH; i++) {
+            if (batch[i] != nullptr) kthread_join(batch[i]);
+        }
+    }
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (me == 0) {
+        bench_report("t22", "spawn-join", 4, 4 * SPAWNS, ticks);
+        printf("*** spawn/join %s\n", errors.get() == 0 && spawned.get() == 4 * SPAWNS ? "ok" : "FAILED");
+    }
+}
+
+static void spinner(void* arg) {
+    Progress& p = progress[(uintptr_t) arg];
+    while (stop.get<MO_RELAXED>() == 0) p.count = p.count + 1;
+}
+
+static void tick(void*) {
+    timer_tick();
+}
+
+static void preemption() {
+    uint32_t me = getCoreID();
+    SchedStats before;
+    sched_stats(1, before);
+    phase.sync();
+    if (me == 1) {
+        task_struct* slow = kthread_create(spinner, (void*) 0, 1, SLOW);
+        task_struct* fast = kthread_create(spinner, (void*) 1, 1, FAST);
+        // yields to them until they are done
+        kthread_join(slow);
+        kthread_join(fast);
+    } else if (me == 0) {
+        // a tick every 100us, until both have started and then TICKS more
+        uint64_t gap = bench_freq() / 10000;
+        uint32_t left = TICKS;
+        while (left != 0) {
+            uint64_t at = bench_ticks();
+            while (bench_ticks() - at < gap) iAmStuckInALoop(false);
+            smp_call_function_single(1, tick, nullptr, true);
+            if (progress[0].count != 0 && progress[1].count != 0) left--;
+        }
+        stop.set(1);
+    }
+    phase.sync();
+    if (me == 0) {
+        SchedStats after;
+        sched_stats(1, after);
+        uint64_t slow = progress[0].count;
+        uint64_t fast = progress[1].count;
+        bench_metric("t22", "preempt", "fast-to-slow-x100", slow == 0 ? 0 : fast * 100 / slow);
+        bench_metric("t22", "preempt", "preemptions", after.preemptions - before.preemptions);
+        printf("*** preemption %s\n",
+            slow != 0 && fast > slow && after.preemptions > before.preemptions ? "ok" : "FAILED");
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    pingPong();
+    spawnJoin();
+    preemption();
+
+    phase.sync();
+    if (getCoreID() == 0) sched_stats_print();
+}
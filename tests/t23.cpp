@@ -0,0 +1,204 @@
+#include "printf.h"
+#include "forkjoin.h"
+#include "pages.h"
+#include "bench.h"
+
+/*
+ * Fork/join work stealing: speedup at 1, 2 and 4 cores.
+ *
+ *   sum:       parallel_reduce over SUM_N values
+ *   mergesort: recursive halves spawned as tasks, merged sequentially,
+ *              SORT_N values
+ *   matmul:    parallel_for over the rows of a MAT_N x MAT_N product
+ *
+ * Every run is checked against the sequential answer. Each case reports
+ * its ticks per core count, and the speedup over one core (x100) as a
+ * bench metric, since what QEMU gives us depends on the host.
+ */
+
+static constexpr int64_t SUM_N = 1 << 18;
+static constexpr int64_t SUM_GRAIN = 4096;
+static constexpr int64_t SORT_N = 1 << 15;
+static constexpr int64_t SORT_SERIAL = 1024;
+static constexpr int64_t MAT_N = 64;
+
+static BenchSync phase;
+static bool ok[3] = {true, true, true};
+
+static uint32_t* values;
+static uint32_t* sorted;
+static uint32_t* scratch;
+static uint32_t* a;
+static uint32_t* b;
+static uint32_t* c;
+static uint32_t* expected;
+
+template <typename T>
+static T* pages(int64_t n) {
+    T* p = (T*) pageAlloc(pageOrder(n * sizeof(T)));
+    if (p == nullptr) panic("t23: out of pages\n");
+    return p;
+}
+
+// prepare() and check() run on core 0 only, outside the timing
+template <typename Prepare, typename Work, typename Check>
+static void measure(uint32_t which, const char* what, uint64_t ops, Prepare prepare, Work work, Check check) {
+    uint64_t base = 0;
+    for (uint32_t cores = 1; cores <= 4; cores *= 2) {
+        uint64_t ticks = 0;
+        fj_run(cores, [&] {
+            prepare();
+            uint64_t start = bench_ticks();
+            work();
+            ticks = bench_ticks() - start;
+            if (!check()) ok[which] = false;
+        });
+        if (getCoreID() == 0) {
+            bench_report("t23", what, cores, ops, ticks);
+            if (cores == 1) base = ticks;
+            else bench_metric("t23", what, cores == 2 ? "speedup-2-x100" : "speedup-4-x100",
+                ticks == 0 ? 0 : base * 100 / ticks);
+        }
+    }
+}
+
+/* sum */
+
+static uint64_t sum;
+
+static void parallelSum() {
+    sum = parallel_reduce<uint64_t>(0, SUM_N, SUM_GRAIN, 0,
+        [](int64_t lo, int64_t hi) {
+            uint64_t s = 0;
+            for (int64_t i = lo; i < hi; i++) s += values[i];
+            return s;
+        },
+        [](uint64_t x, uint64_t y) { return x + y; });
+}
+
+static bool checkSum() {
+    uint64_t want = 0;
+    for (int64_t i = 0; i < SUM_N; i++) want += (uint64_t) (i % 1000);
+    return sum == want;
+}
+
+/* mergesort */
+
+static void merge(uint32_t* p, uint32_t* tmp, int64_t mid, int64_t n) {
+    int64_t i = 0, j = mid, k = 0;
+    while (i < mid && j < n) tmp[k++] = p[i] <= p[j] ? p[i++] : p[j++];
+    while (i < mid) tmp[k++] = p[i++];
+    while (j < n) tmp[k++] = p[j++];
+    for (k = 0; k < n; k++) p[k] = tmp[k];
+}
+
+static void mergesort(uint32_t* p, uint32_t* tmp, int64_t n) {
+    if (n <= 16) {
+        for (int64_t i = 1; i < n; i++) {
+            uint32_t v = p[i];
+            int64_t j = i;
+            for (; j > 0 && p[j - 1] > v; j--) p[j] = p[j - 1];
+            p[j] = v;
+        }
+        return;
+    }
+    int64_t mid = n / 2;
+    if (n <= SORT_SERIAL) {
+        mergesort(p, tmp, mid);
+        mergesort(p + mid, tmp + mid, n - mid);
+    } else {
+        TaskGroup g;
+        auto left = fj_job([&] { mergesort(p, tmp, mid); });
+        g.spawn(left);
+        mergesort(p + mid, tmp + mid, n - mid);
+        g.sync();
+    }
+    merge(p, tmp, mid, n);
+}
+
+static uint64_t unsortedSum;
+
+static void prepareSort() {
+    unsortedSum = 0;
+    for (int64_t i = 0; i < SORT_N; i++) {
+        sorted[i] = (uint32_t) i * 2654435761u;
+        unsortedSum += sorted[i];
+    }
+}
+
+static void parallelSort() {
+    mergesort(sorted, scratch, SORT_N);
+}
+
+static bool checkSort() {
+    uint64_t after = sorted[0];
+    for (int64_t i = 1; i < SORT_N; i++) {
+        if (sorted[i - 1] > sorted[i]) return false;
+        after += sorted[i];
+    }
+    return after == unsortedSum;
+}
+
+/* matmul */
+
+static void parallelMatmul() {
+    parallel_for(0, MAT_N, 2, [](int64_t lo, int64_t hi) {
+        for (int64_t i = lo; i < hi; i++) {
+            for (int64_t j = 0; j < MAT_N; j++) {
+                uint32_t s = 0;
+                for (int64_t k = 0; k < MAT_N; k++) s += a[i * MAT_N + k] * b[k * MAT_N + j];
+                c[i * MAT_N + j] = s;
+            }
+        }
+    });
+}
+
+static bool checkMatmul() {
+    for (int64_t i = 0; i < MAT_N * MAT_N; i++) {
+        if (c[i] != expected[i]) return false;
+    }
+    return true;
+}
+
+static void setup() {
+    values = pages<uint32_t>(SUM_N);
+    sorted = pages<uint32_t>(SORT_N);
+    scratch = pages<uint32_t>(SORT_N);
+    a = pages<uint32_t>(MAT_N * MAT_N);
+    b = pages<uint32_t>(MAT_N * MAT_N);
+    c = pages<uint32_t>(MAT_N * MAT_N);
+    expected = pages<uint32_t>(MAT_N * MAT_N);
+
+    for (int64_t i = 0; i < SUM_N; i++) values[i] = i % 1000;
+    BenchRng rng(42);
+    for (int64_t i = 0; i < MAT_N * MAT_N; i++) {
+        a[i] = rng.range(0, 99);
+        b[i] = rng.range(0, 99);
+    }
+    for (int64_t i = 0; i < MAT_N; i++) {
+        for (int64_t j = 0; j < MAT_N; j++) {
+            uint32_t s = 0;
+            for (int64_t k = 0; k < MAT_N; k++) s += a[i * MAT_N + k] * b[k * MAT_N + j];
+            expected[i * MAT_N + j] = s;
+        }
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() == 0) setup();
+    phase.sync();
+
+    auto nothing = [] {};
+    measure(0, "sum", SUM_N, nothing, parallelSum, checkSum);
+    measure(1, "mergesort", SORT_N, prepareSort, parallelSort, checkSort);
+    measure(2, "matmul", MAT_N * MAT_N * MAT_N, [] { for (int64_t i = 0; i < MAT_N * MAT_N; i++) c[i] = 0; },
+        parallelMatmul, checkMatmul);
+
+    if (getCoreID() == 0) {
+        printf("*** parallel sum %s\n", ok[0] ? "ok" : "FAILED");
+        printf("*** parallel mergesort %s\n", ok[1] ? "ok" : "FAILED");
+        printf("*** parallel matmul %s\n", ok[2] ? "ok" : "FAILED");
+        fj_stats_print();
+    }
+}
@@ -0,0 +1,149 @@
+#include "printf.h"
+#include "timer.h"
+#include "sched.h"
+#include "ipi.h"
+#include "bench.h"
+#include "loop.h"
+
+/*
+ * Generic timer: tick, preemption, tickless idle and deadlines.
+ *
+ *   tick:      core 0 spins for WINDOW_MS; the timer must tick at TIMER_HZ
+ *              all the while
+ *   preempt:   two threads spin on core 0 until a common end time without
+ *              ever yielding; only the tick can switch between them, so
+ *              both must have started well before the end
+ *   idle:      cores 1-3 sleep for WINDOW_MS in WFI, first with the tick
+ *              running, then tickless; count the timer IRQs they take
+ *   deadline:  DEADLINES one-shot deadlines DEADLINE_US apart on core 0,
+ *              each must fire, and no earlier than asked
+ */
+
+static constexpr uint32_t WINDOW_MS = 200;
+static constexpr uint32_t DEADLINES = 20;
+static constexpr uint32_t DEADLINE_US = 2000;
+
+static BenchSync phase;
+static Atomic<uint32_t> wakeUp{0};
+static volatile uint64_t startedAt[2];
+static volatile uint64_t spinEnd;
+static volatile uint64_t deadlineAt;
+static Atomic<uint32_t> fired{0};
+static volatile uint64_t lateness;
+static volatile uint64_t worstLateness;
+static volatile bool early = false;
+
+static void tick() {
+    TimerStats before, after;
+    timer_stats(0, before);
+    uint64_t end = timer_now() + timer_us(WINDOW_MS * 1000);
+    while (timer_now() < end) iAmStuckInALoop(false);
+    timer_stats(0, after);
+    uint64_t ticks = (after.ticks - before.ticks) + (after.missedTicks - before.missedTicks);
+    uint64_t want = TIMER_HZ * WINDOW_MS / 1000;
+    bench_metric("t24", "tick", "ticks-per-window", ticks);
+    printf("*** timer ticks at TIMER_HZ %s\n", ticks + 2 >= want && ticks <= want + 2 ? "ok" : "FAILED");
+}
+
+static void spinner(void* arg) {
+    uint32_t me = (uint32_t) (uintptr_t) arg;
+    startedAt[me] = timer_now();
+    while (timer_now() < spinEnd) {}
+}
+
+static void preempt() {
+    SchedStats before, after;
+    sched_stats(0, before);
+    spinEnd = timer_now() + timer_us(WINDOW_MS * 1000);
+    startedAt[0] = startedAt[1] = 0;
+    task_struct* a = kthread_create(spinner, (void*) 0, 0, 2);
+    task_struct* b = kthread_create(spinner, (void*) 1, 0, 2);
+    kthread_join(a);
+    kthread_join(b);
+    sched_stats(0, after);
+    uint64_t half = spinEnd - timer_us(WINDOW_MS * 1000 / 2);
+    bench_metric("t24", "preempt", "preemptions", after.preemptions - before.preemptions);
+    printf("*** timer preempts spinning threads %s\n",
+        startedAt[0] != 0 && startedAt[1] != 0 && startedAt[0] < half && startedAt[1] < half ? "ok" : "FAILED");
+}
+
+static uint64_t idleIrqs(bool tickless) {
+    uint32_t me = getCoreID();
+    TimerStats before, after;
+    timer_stats(me, before);
+    phase.sync();
+    if (me == 0) {
+        uint64_t end = timer_now() + timer_us(WINDOW_MS * 1000);
+        while (timer_now() < end) iAmStuckInALoop(false);
+        wakeUp.set(1);
+        ipi_send_mask(0xe, IPI_WAKE);
+    } else {
+        if (tickless) tick_idle_enter();
+        cpu_idle_until([] { return wakeUp.get() != 0; });
+        if (tickless) tick_idle_exit();
+    }
+    phase.sync();
+    timer_stats(me, after);
+    if (me == 0) wakeUp.set(0);
+    return after.irqs - before.irqs;
+}
+
+static Atomic<uint64_t> idleTotal{0};
+
+static void idle() {
+    uint64_t n = idleIrqs(false);
+    if (getCoreID() != 0) idleTotal.fetch_add(n);
+    phase.sync();
+    uint64_t ticking = idleTotal.get();
+    phase.sync();
+    if (getCoreID() == 0) idleTotal.set(0);
+    phase.sync();
+    n = idleIrqs(true);
+    if (getCoreID() != 0) idleTotal.fetch_add(n);
+    phase.sync();
+    if (getCoreID() == 0) {
+        uint64_t tickless = idleTotal.get();
+        bench_metric("t24", "idle", "ticking-irqs", ticking);
+        bench_metric("t24", "idle", "tickless-irqs", tickless);
+        printf("*** tickless idle %s\n", ticking >= 3 * (TIMER_HZ * WINDOW_MS / 1000 - 2) && tickless <= 3 ? "ok" : "FAILED");
+    }
+}
+
+static void onDeadline() {
+    uint64_t now = timer_now();
+    if (now < deadlineAt) early = true;
+    uint64_t late = now - deadlineAt;
+    lateness = lateness + late;
+    if (late > worstLateness) worstLateness = late;
+    fired.fetch_add(1);
+}
+
+static void deadlines() {
+    timer_set_deadline_hook(onDeadline);
+    for (uint32_t i = 0; i < DEADLINES; i++) {
+        deadlineAt = timer_now() + timer_us(DEADLINE_US);
+        timer_set_deadline(deadlineAt);
+        uint32_t seen = fired.get();
+        while (seen == i) {
+            cpu_idle();
+            seen = fired.get();
+        }
+    }
+    bench_metric("t24", "deadline", "avg-late-ticks", lateness / DEADLINES);
+    bench_metric("t24", "deadline", "worst-late-ticks", worstLateness);
+    printf("*** one-shot deadlines %s\n", fired.get() == DEADLINES && !early ? "ok" : "FAILED");
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() == 0) {
+        tick();
+        preempt();
+    }
+    phase.sync();
+    idle();
+    if (getCoreID() == 0) {
+        deadlines();
+        timer_stats_print();
+    }
+}
@@ -0,0 +1,230 @@
+#include "printf.h"
+#include "timeout.h"
+#include "timer.h"
+#include "sched.h"
+#include "pages.h"
+#include "ipi.h"
+#include "bench.h"
+
+/*
+ * Timing wheels: insert/cancel cost, firing, sleep and idle migration.
+ *
+ *   insert/cancel: BENCH_N timeouts from 128 us to 30 s out added on core
+ *                  0, then all cancelled in a shuffled order, with IRQs
+ *                  masked so none go off meanwhile; LIST_N of them also
+ *                  into a sorted list for comparison
+ *   fire:          FIRE_N timeouts up to 600 ms out, every other one
+ *                  cancelled again; the rest must fire, none early, and
+ *                  the cancelled ones never
+ *   sleep:         cores 1-3 each arm a pinned and an unpinned timeout and
+ *                  go to sleep, so their cores idle while core 0 keeps
+ *                  busy: the sleeps must last as long as asked, the pinned
+ *                  timeouts fire where they were added, and the others
+ *                  (sleeps included) are handed to core 0
+ */
+
+static constexpr uint32_t BENCH_N = 100000;
+static constexpr uint32_t LIST_N = 4096;
+static constexpr uint32_t FIRE_N = 1000;
+static constexpr uint32_t CHUNK = 32768;
+
+static BenchSync phase;
+
+static Timeout* chunks[(BENCH_N + CHUNK - 1) / CHUNK];
+static uint32_t* order;
+static uint64_t* firedAt;
+static Atomic<uint32_t> fired{0};
+
+static Timeout& at(uint32_t i) {
+    return chunks[i / CHUNK][i % CHUNK];
+}
+
+static void setup() {
+    for (uint32_t i = 0; i < (BENCH_N + CHUNK - 1) / CHUNK; i++) {
+        chunks[i] = (Timeout*) pageAlloc(pageOrder(CHUNK * sizeof(Timeout)));
+        if (chunks[i] == nullptr) panic("t25: out of pages\n");
+    }
+    order = (uint32_t*) pageAlloc(pageOrder(BENCH_N * sizeof(uint32_t)));
+    firedAt = (uint64_t*) pageAlloc(pageOrder(FIRE_N * sizeof(uint64_t)));
+    if (order == nullptr || firedAt == nullptr) panic("t25: out of pages\n");
+}
+
+static void record(void* arg) {
+    firedAt[(uintptr_t) arg] = timer_now();
+    fired.fetch_add(1);
+}
+
+/* insert/cancel */
+
+// the obvious alternative: one list, kept sorted by expiry
+static Timeout* sortedList;
+
+static void listInsert(Timeout* t) {
+    Timeout** p = &sortedList;
+    while (*p != nullptr && (*p)->expires <= t->expires) p = &(*p)->next;
+    t->next = *p;
+    *p = t;
+}
+
+static bool listRemove(Timeout* t) {
+    for (Timeout** p = &sortedList; *p != nullptr; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void insertCancel() {
+    BenchRng rng(25);
+    uint64_t freq = timer_freq();
+    for (uint32_t i = 0; i < BENCH_N; i++) {
+        timeout_init(at(i), record, (void*) 0);
+        at(i).expires = freq * rng.logRange(7, 24) / 1000000;
+        order[i] = i;
+    }
+    for (uint32_t i = BENCH_N - 1; i > 0; i--) {
+        uint32_t j = rng.range(0, i);
+        uint32_t x = order[i];
+        order[i] = order[j];
+        order[j] = x;
+    }
+
+    TimeoutStats before, after;
+    timeout_stats(0, before);
+    bool ok = true;
+    uint64_t flags = irq_save();
+    uint64_t base = timer_now();
+    uint64_t start = bench_ticks();
+    for (uint32_t i = 0; i < BENCH_N; i++) timeout_add(at(i), base + at(i).expires);
+    uint64_t added = bench_ticks();
+    for (uint32_t i = 0; i < BENCH_N; i++) {
+        if (!timeout_cancel(at(order[i]))) ok = false;
+    }
+    uint64_t cancelled = bench_ticks();
+    irq_restore(flags);
+    timeout_stats(0, after);
+    bench_report("t25", "wheel-insert", 1, BENCH_N, added - start);
+    bench_report("t25", "wheel-cancel", 1, BENCH_N, cancelled - added);
+    ok = ok && after.pending == before.pending && after.added - before.added == BENCH_N &&
+        after.cancelled - before.cancelled == BENCH_N && fired.get() == 0;
+
+    // relative times are fine for ordering
+    sortedList = nullptr;
+    start = bench_ticks();
+    for (uint32_t i = 0; i < LIST_N; i++) listInsert(&at(i));
+    added = bench_ticks();
+    for (uint32_t i = 0; i < LIST_N; i++) {
+        if (!listRemove(&at(LIST_N - 1 - i))) ok = false;
+    }
+    cancelled = bench_ticks();
+    bench_report("t25", "sorted-list-insert", 1, LIST_N, added - start);
+    bench_report("t25", "sorted-list-cancel", 1, LIST_N, cancelled - added);
+
+    printf("*** timeout wheel insert/cancel %s\n", ok ? "ok" : "FAILED");
+}
+
+/* fire */
+
+static void fire() {
+    BenchRng rng(6);
+    uint64_t base = timer_now();
+    for (uint32_t i = 0; i < FIRE_N; i++) {
+        firedAt[i] = 0;
+        timeout_init(at(i), record, (void*) (uintptr_t) i);
+        timeout_add(at(i), base + timer_us(rng.range(0, 600000)));
+    }
+    bool ok = true;
+    for (uint32_t i = 1; i < FIRE_N; i += 2) {
+        // the ones due first may be gone already
+        if (!timeout_cancel(at(i)) && firedAt[i] == 0) ok = false;
+    }
+    uint32_t want = 0;
+    for (uint32_t i = 0; i < FIRE_N; i++) {
+        if (i % 2 == 0 || firedAt[i] != 0) want++;
+    }
+    cpu_idle_until([want] { return fired.get() >= want; });
+    // give any cancelled one that would still fire time to
+    uint64_t end = timer_now() + timer_us(50000);
+    while (timer_now() < end) cpu_idle();
+
+    uint64_t worst = 0;
+    for (uint32_t i = 0; i < FIRE_N; i++) {
+        if (i % 2 == 1 && firedAt[i] == 0) continue;
+        if (firedAt[i] < at(i).expires) ok = false;
+        uint64_t late = firedAt[i] - at(i).expires;
+        if (late > worst) worst = late;
+    }
+    ok = ok && fired.get() == want;
+    bench_metric("t25", "fire", "worst-late-us", worst * 1000000 / timer_freq());
+    printf("*** timeouts fire on time %s\n", ok ? "ok" : "FAILED");
+}
+
+/* sleep */
+
+static volatile int32_t pinnedOn[4];
+static volatile int32_t unpinnedOn[4];
+static volatile bool sleptEnough[4];
+static Atomic<uint32_t> sleepersDone{0};
+
+static void notePinned(void* arg) {
+    pinnedOn[(uintptr_t) arg] = getCoreID();
+}
+
+static void noteUnpinned(void* arg) {
+    unpinnedOn[(uintptr_t) arg] = getCoreID();
+}
+
+static void sleeper() {
+    uint32_t me = getCoreID();
+    Timeout pinned, unpinned;
+    timeout_init(pinned, notePinned, (void*) (uintptr_t) me, TIMEOUT_PINNED);
+    timeout_init(unpinned, noteUnpinned, (void*) (uintptr_t) me);
+    pinnedOn[me] = unpinnedOn[me] = -1;
+    uint64_t start = timer_now();
+    timeout_add(pinned, start + timer_us(10000));
+    timeout_add(unpinned, start + timer_us(10000));
+    uint64_t want = timer_us(20000 * me);
+    sleep_us(20000 * me);
+    sleptEnough[me] = timer_now() - start >= want;
+    timeout_cancel(pinned);
+    timeout_cancel(unpinned);
+    sleepersDone.fetch_add(1);
+}
+
+static void sleepers() {
+    TimeoutStats before[4], after[4];
+    for (uint32_t core = 0; core < 4; core++) timeout_stats(core, before[core]);
+    phase.sync();
+    if (getCoreID() == 0) {
+        // stay busy, so the sleepers' cores are the idle ones
+        while (sleepersDone.get() != 3) {}
+    } else {
+        sleeper();
+    }
+    phase.sync();
+    if (getCoreID() != 0) return;
+
+    bool ok = true;
+    uint64_t migrated = 0;
+    for (uint32_t core = 1; core < 4; core++) {
+        timeout_stats(core, after[core]);
+        migrated += after[core].migrated - before[core].migrated;
+        ok = ok && sleptEnough[core] && pinnedOn[core] == (int32_t) core && unpinnedOn[core] == 0;
+    }
+    bench_metric("t25", "sleep", "migrated", migrated);
+    printf("*** sleep and idle migration %s\n", ok && migrated >= 6 ? "ok" : "FAILED");
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() == 0) {
+        setup();
+        insertCancel();
+        fire();
+    }
+    phase.sync();
+    sleepers();
+    if (getCoreID() == 0) timeout_stats_print();
+}
@@ -0,0 +1,173 @@
+#include "printf.h"
+#include "sched.h"
+#include "fpsimd.h"
+#include "ipi.h"
+#include "timer.h"
+#include "bench.h"
+
+/*
+ * Lazy FP/SIMD switching.
+ *
+ *   switch cost: on core 1, kernelMain and one thread yield to each other
+ *                SWITCHES times each, neither, one or both doing a
+ *                floating point multiply between yields. Only the last
+ *                should take FP traps, about one per switch
+ *   yields:      KEEPERS threads on core 2 each put their own value in d8
+ *                and their own rounding mode in FPCR, and check both
+ *                after every one of ROUNDS yields
+ *   preemption:  the same threads spinning without yielding for WINDOW_MS,
+ *                switched by the tick, while core 0 keeps running a
+ *                callback that uses FP on core 2 over IPIs
+ */
+
+static constexpr uint32_t SWITCHES = 5000;
+static constexpr uint32_t KEEPERS = 3;
+static constexpr uint32_t ROUNDS = 2000;
+static constexpr uint32_t WINDOW_MS = 300;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> stop{0};
+static volatile double sink;
+static volatile uint64_t intSink;
+
+/* switch cost */
+
+// even copying a double goes through the FP registers
+static void work(bool fp) {
+    if (fp) {
+        volatile double x = sink;
+        sink = x * 1.0000001;
+    } else {
+        intSink = intSink + 1;
+    }
+}
+
+static void partner(void* arg) {
+    bool fp = (uintptr_t) arg != 0;
+    preempt_disable();
+    for (uint32_t i = 0; i < SWITCHES; i++) {
+        work(fp);
+        yield();
+    }
+    preempt_enable();
+}
+
+// ticks for 2 * SWITCHES switches, and the FP traps they took
+static void switchCost(const char* what, bool fpHere, bool fpThere, uint64_t& traps) {
+    FpStats before, after;
+    task_struct* t = kthread_create(partner, (void*) (uintptr_t) fpThere, 1);
+    if (t == nullptr) errors.fetch_add(1);
+    fpsimd_stats(1, before);
+    uint64_t start = bench_ticks();
+    preempt_disable();
+    for (uint32_t i = 0; i < SWITCHES; i++) {
+        work(fpHere);
+        yield();
+    }
+    preempt_enable();
+    uint64_t ticks = bench_ticks() - start;
+    fpsimd_stats(1, after);
+    kthread_join(t);
+    traps = after.traps - before.traps;
+    bench_report("t26", what, 1, 2 * SWITCHES, ticks);
+    bench_metric("t26", what, "fp-traps", traps);
+}
+
+/* keepers */
+
+static inline void setMine(uint64_t d8, uint64_t fpcr) {
+    asm volatile("fmov d8, %0; msr fpcr, %1" :: "r"(d8), "r"(fpcr) : "d8");
+}
+
+static inline bool stillMine(uint64_t d8, uint64_t fpcr) {
+    uint64_t d, f;
+    asm volatile("fmov %0, d8; mrs %1, fpcr" : "=r"(d), "=r"(f));
+    return d == d8 && f == fpcr;
+}
+
+static void keeper(void* arg) {
+    uint64_t id = (uintptr_t) arg;
+    bool spin = (id & 0x100) != 0;
+    id &= 0xff;
+    uint64_t d8 = 0x4000000000000000ull | (id << 32) | id;
+    uint64_t fpcr = (id % 4) << 22;     // RMode
+    setMine(d8, fpcr);
+    if (spin) {
+        while (stop.get<MO_RELAXED>() == 0) {
+            if (!stillMine(d8, fpcr)) errors.fetch_add(1);
+        }
+    } else {
+        for (uint32_t i = 0; i < ROUNDS; i++) {
+            yield();
+            if (!stillMine(d8, fpcr)) errors.fetch_add(1);
+        }
+    }
+    setMine(0, 0);
+}
+
+static void keepers(bool spin) {
+    task_struct* t[KEEPERS];
+    for (uint32_t i = 0; i < KEEPERS; i++) {
+        t[i] = kthread_create(keeper, (void*) (uintptr_t) ((spin ? 0x100 : 0) | (i + 1)), 2, 2);
+        if (t[i] == nullptr) errors.fetch_add(1);
+    }
+    for (uint32_t i = 0; i < KEEPERS; i++) {
+        if (t[i] != nullptr) kthread_join(t[i]);
+    }
+}
+
+static void useFp(void*) {
+    volatile double x = 3.0;
+    x = x * x + 0.5;
+    if (x != 9.5) errors.fetch_add(1);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+
+    if (me == 0) sink = 1.0;
+    phase.sync();
+    if (me == 1) {
+        uint64_t none, one, both;
+        switchCost("switch-no-fp", false, false, none);
+        switchCost("switch-one-fp", true, false, one);
+        switchCost("switch-both-fp", true, true, both);
+        // a handful for the first use in each run
+        printf("*** lazy fp switching %s\n",
+            errors.get() == 0 && none <= 4 && one <= 4 && both >= SWITCHES ? "ok" : "FAILED");
+    }
+
+    phase.sync();
+    if (me == 2) {
+        keepers(false);
+        printf("*** fp state survives yields %s\n", errors.get() == 0 ? "ok" : "FAILED");
+    }
+
+    FpStats before;
+    fpsimd_stats(2, before);
+    phase.sync();
+    if (me == 2) {
+        keepers(true);
+    } else if (me == 0) {
+        uint64_t end = timer_now() + timer_us(WINDOW_MS * 1000);
+        while (timer_now() < end) {
+            smp_call_function_single(2, useFp, nullptr, true);
+            uint64_t at = timer_now();
+            while (timer_now() - at < timer_us(200)) {}
+        }
+        stop.set(1);
+    }
+    phase.sync();
+    if (me == 0) {
+        FpStats after;
+        fpsimd_stats(2, after);
+        SchedStats st;
+        sched_stats(2, st);
+        bench_metric("t26", "preempt", "borrows", after.borrows - before.borrows);
+        printf("*** fp state survives preemption and IRQs %s\n",
+            errors.get() == 0 && st.preemptions != 0 ? "ok" : "FAILED");
+        fpsimd_stats_print();
+    }
+}
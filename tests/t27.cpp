@@ -0,0 +1,231 @@
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+#include "timeout.h"
+#include "bench.h"
+
+/*
+ * Priority run queues, affinity and load balancing.
+ *
+ *   order:     core 1 creates ORDER_N threads for itself at mixed prios
+ *              with preemption off, then drops its own prio below all of
+ *              them; they must run in prio order, 0 first, and in creation
+ *              order within a level
+ *   many:      core 2 runs 2, then MANY yielding threads at one level,
+ *              the latter well past the old 64-task table; picking the
+ *              next one mustn't get slower with more of them queued
+ *   affinity:  a thread with its own d8 and FPCR spins wherever it is
+ *              let, while core 0 narrows its mask to core 3, then to
+ *              cores 1-2; it must end up there each time with its FP
+ *              state intact
+ *   balance:   core 0 creates BALANCE_N spinners for itself and then lets
+ *              them run anywhere, while cores 1-3 sleep; the balancer has
+ *              to have put some on each of those within WINDOW_MS
+ */
+
+static constexpr uint32_t ORDER_N = 6;
+static constexpr uint32_t MANY = 200;
+static constexpr uint32_t ROUNDS = 100;
+static constexpr uint32_t BALANCE_N = 8;
+static constexpr uint32_t WINDOW_MS = 300;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> stop{0};
+
+/* order */
+
+static const int orderPrio[ORDER_N] = { 20, 3, 12, 3, 28, 7 };
+static const uint32_t orderWant[ORDER_N] = { 1, 3, 5, 2, 0, 4 };
+static Atomic<uint32_t> ran{0};
+static volatile uint32_t ranOrder[ORDER_N];
+
+static void note(void* arg) {
+    ranOrder[ran.fetch_add(1)] = (uintptr_t) arg;
+}
+
+static void order() {
+    task_struct* t[ORDER_N];
+    preempt_disable();
+    for (uint32_t i = 0; i < ORDER_N; i++) {
+        t[i] = kthread_create(note, (void*) (uintptr_t) i, 1, DEFAULT_PRIORITY, orderPrio[i]);
+        if (t[i] == nullptr) errors.fetch_add(1);
+    }
+    // nothing has run yet; all of them go before us from here on
+    bool early = ran.get() != 0;
+    sched_setprio(current, NR_PRIO - 1);
+    preempt_enable();
+    for (uint32_t i = 0; i < ORDER_N; i++) {
+        if (t[i] != nullptr) kthread_join(t[i]);
+    }
+    sched_setprio(current, DEFAULT_PRIO);
+
+    bool ok = !early && ran.get() == ORDER_N && errors.get() == 0;
+    for (uint32_t i = 0; ok && i < ORDER_N; i++) ok = ranOrder[i] == orderWant[i];
+    printf("*** priority order %s\n", ok ? "ok" : "FAILED");
+}
+
+/* many */
+
+static void yielder(void*) {
+    for (uint32_t i = 0; i < ROUNDS; i++) yield();
+}
+
+static void yields(uint32_t n, const char* what) {
+    task_struct** t = (task_struct**) malloc(n * sizeof(task_struct*));
+    if (t == nullptr) {
+        errors.fetch_add(1);
+        return;
+    }
+    // all queued before any runs
+    preempt_disable();
+    for (uint32_t i = 0; i < n; i++) {
+        t[i] = kthread_create(yielder, nullptr, 2);
+        if (t[i] == nullptr) errors.fetch_add(1);
+    }
+    int tasks = nr_tasks;
+    uint64_t start = bench_ticks();
+    preempt_enable();
+    for (uint32_t i = 0; i < n; i++) {
+        if (t[i] != nullptr) kthread_join(t[i]);
+    }
+    uint64_t ticks = bench_ticks() - start;
+    if ((uint32_t) tasks < n) errors.fetch_add(1);
+    free(t);
+    bench_report("t27", what, 1, n * ROUNDS, ticks);
+}
+
+static void many() {
+    yields(2, "yield-2-tasks");
+    yields(MANY, "yield-many-tasks");
+    printf("*** hundreds of tasks %s\n", errors.get() == 0 ? "ok" : "FAILED");
+}
+
+/* affinity */
+
+static volatile int32_t where = -1;
+static volatile bool fpKept = true;
+
+static void wanderer(void*) {
+    uint64_t d8 = 0x4000000000002700ull;
+    uint64_t fpcr = 2ull << 22;     // RMode: towards minus infinity
+    asm volatile("fmov d8, %0; msr fpcr, %1" :: "r"(d8), "r"(fpcr) : "d8");
+    while (stop.get<MO_RELAXED>() == 0) {
+        uint64_t d, f;
+        asm volatile("fmov %0, d8; mrs %1, fpcr" : "=r"(d), "=r"(f));
+        if (d != d8 || f != fpcr) fpKept = false;
+        where = getCoreID();
+    }
+    asm volatile("fmov d8, xzr; msr fpcr, xzr" ::: "d8");
+}
+
+// whether the wanderer turns up on a core `in` accepts within a second
+template <typename In>
+static bool settles(In in) {
+    uint64_t end = timer_now() + timer_us(1000000);
+    while (timer_now() < end) {
+        if (in(where)) return true;
+    }
+    return false;
+}
+
+static void affinity() {
+    SchedStats before[4], after[4];
+    for (uint32_t core = 0; core < 4; core++) sched_stats(core, before[core]);
+    stop.set(0);
+    task_struct* t = kthread_create(wanderer, nullptr);
+    bool ok = t != nullptr && settles([](int32_t c) { return c >= 0; });
+    if (t != nullptr) {
+        sched_setaffinity(t, 1ul << 3);
+        ok = ok && settles([](int32_t c) { return c == 3; });
+        sched_setaffinity(t, 0x6ul);
+        ok = ok && settles([](int32_t c) { return c == 1 || c == 2; });
+        // and stays there
+        uint64_t end = timer_now() + timer_us(50000);
+        while (timer_now() < end) {
+            if (where != 1 && where != 2) ok = false;
+        }
+        stop.set(1);
+        kthread_join(t);
+    }
+    uint64_t pushed = 0;
+    for (uint32_t core = 0; core < 4; core++) {
+        sched_stats(core, after[core]);
+        pushed += after[core].pushed - before[core].pushed;
+    }
+    bench_metric("t27", "affinity", "pushed", pushed);
+    printf("*** affinity %s\n", ok && fpKept && pushed >= 2 ? "ok" : "FAILED");
+}
+
+/* balance */
+
+static volatile int32_t lastCore[BALANCE_N];
+static Atomic<uint32_t> balanced{0};
+
+static void spinner(void* arg) {
+    uint32_t i = (uintptr_t) arg;
+    while (stop.get<MO_RELAXED>() == 0) lastCore[i] = getCoreID();
+}
+
+static void balance() {
+    uint32_t me = getCoreID();
+    SchedStats before[4], after[4];
+    if (me == 0) {
+        for (uint32_t core = 0; core < 4; core++) sched_stats(core, before[core]);
+        stop.set(0);
+    }
+    phase.sync();
+    if (me != 0) {
+        // sleeping, so the idle task runs here and pulls
+        while (balanced.get() == 0) sleep_us(10000);
+        return;
+    }
+
+    task_struct* t[BALANCE_N];
+    for (uint32_t i = 0; i < BALANCE_N; i++) {
+        lastCore[i] = -1;
+        t[i] = kthread_create(spinner, (void*) (uintptr_t) i, 0);
+        if (t[i] != nullptr) sched_setaffinity(t[i], CPU_MASK_ALL);
+    }
+    uint64_t end = timer_now() + timer_us(WINDOW_MS * 1000);
+    while (timer_now() < end) iAmStuckInALoop(false);
+    uint32_t cores = 0;
+    for (uint32_t i = 0; i < BALANCE_N; i++) {
+        if (lastCore[i] >= 0) cores |= 1u << lastCore[i];
+    }
+    stop.set(1);
+    bool ok = true;
+    for (uint32_t i = 0; i < BALANCE_N; i++) {
+        if (t[i] == nullptr) {
+            ok = false;
+        } else {
+            kthread_join(t[i]);
+        }
+    }
+    balanced.set(1);
+
+    uint64_t pulled = 0;
+    for (uint32_t core = 0; core < 4; core++) {
+        sched_stats(core, after[core]);
+        pulled += after[core].pulled - before[core].pulled;
+    }
+    bench_metric("t27", "balance", "pulled", pulled);
+    printf("*** load balancing %s\n", ok && (cores & 0xe) == 0xe && pulled >= 3 ? "ok" : "FAILED");
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+
+    phase.sync();
+    if (me == 1) order();
+    phase.sync();
+    if (me == 2) many();
+    phase.sync();
+    if (me == 0) affinity();
+    phase.sync();
+    balance();
+
+    phase.sync();
+    if (me == 0) sched_stats_print();
+}
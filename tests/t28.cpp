@@ -0,0 +1,264 @@
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+#include "timeout.h"
+#include "bench.h"
+
+/*
+ * Deadline tasks: admission, release jitter and budget enforcement.
+ *
+ *   admission: core 0 reserves 30% of core 1 three times, which must fit,
+ *              then a fourth time, which mustn't; without a core given it
+ *              goes elsewhere. The bandwidth comes back when they exit
+ *   jitter:    on core 2, a 1 ms and a 5 ms periodic task share the core
+ *              with a thread that never stops spinning, for JOBS_1MS
+ *              periods; every job must start within a period of its
+ *              release and finish by its deadline. Core 3 runs the same
+ *              1 ms loop as a normal thread against its own spinner, with
+ *              sleep_until, for comparison
+ *   budget:    a deadline task with 200 us of every 2 ms spins without
+ *              ever ending a job, next to a normal thread doing the same;
+ *              it must be throttled to about its share of the core
+ *   mixed:     MIXED normal and MIXED deadline tasks, created in turn on
+ *              core 1 at the same prio, go back on its run queue ROUNDS
+ *              times each (yield, dl_wait_period); all of them must finish
+ */
+
+static constexpr uint32_t JOBS_1MS = 400;
+static constexpr uint32_t JOBS_5MS = JOBS_1MS / 5;
+static constexpr uint32_t WINDOW_MS = 300;
+static constexpr uint32_t MIXED = 8;
+static constexpr uint32_t ROUNDS = 20;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+static Atomic<uint32_t> stop{0};
+static Atomic<uint32_t> done{0};
+
+static void spinUs(uint64_t us) {
+    uint64_t end = timer_now() + timer_us(us);
+    while (timer_now() < end) {}
+}
+
+static uint64_t toUs(uint64_t ticks) {
+    return ticks * 1000000 / timer_freq();
+}
+
+/* admission */
+
+static void quick(void*) {
+    dl_wait_period();
+}
+
+static void admission() {
+    task_struct* t[5];
+    bool ok = true;
+    for (uint32_t i = 0; i < 3; i++) {
+        t[i] = kthread_create_dl(quick, nullptr, 300, 1000, 1);
+        ok = ok && t[i] != nullptr;
+    }
+    SchedStats st;
+    sched_stats(1, st);
+    uint32_t full = st.dlUtil;
+    t[3] = kthread_create_dl(quick, nullptr, 300, 1000, 1);
+    t[4] = kthread_create_dl(quick, nullptr, 300, 1000);
+    ok = ok && full >= 899 && full <= 900 && t[3] == nullptr && t[4] != nullptr && t[4]->cpu != 1;
+    // nonsense
+    ok = ok && kthread_create_dl(quick, nullptr, 2000, 1000) == nullptr &&
+        kthread_create_dl(quick, nullptr, 0, 1000) == nullptr;
+
+    for (uint32_t i = 0; i < 5; i++) {
+        if (t[i] != nullptr) kthread_join(t[i]);
+    }
+    uint32_t left = 0;
+    for (uint32_t core = 0; core < 4; core++) {
+        sched_stats(core, st);
+        left += st.dlUtil;
+    }
+    printf("*** deadline admission control %s\n", ok && left == 0 ? "ok" : "FAILED");
+}
+
+/* jitter */
+
+struct Periodic {
+    uint32_t workUs;
+    uint32_t jobs;
+    DlStats stats;
+};
+
+static Periodic fast = { 30, JOBS_1MS, {} };
+static Periodic slow = { 200, JOBS_5MS, {} };
+
+static void periodic(void* arg) {
+    Periodic& p = *(Periodic*) arg;
+    for (uint32_t i = 0; i < p.jobs; i++) {
+        spinUs(p.workUs);
+        dl_wait_period();
+    }
+    sched_dl_stats(current, p.stats);
+}
+
+static void hog(void*) {
+    while (stop.get<MO_RELAXED>() == 0) {}
+}
+
+static volatile uint64_t polledWorst;
+static volatile uint64_t polledTotal;
+static volatile uint64_t polledJobs;
+
+// the 1 ms loop as a normal thread
+static void polled(void*) {
+    uint64_t period = timer_us(1000);
+    uint64_t next = timer_now() + period;
+    uint64_t end = next + period * JOBS_1MS;
+    while (next < end) {
+        sleep_until(next);
+        uint64_t latency = timer_now() - next;
+        polledTotal = polledTotal + latency;
+        if (latency > polledWorst) polledWorst = latency;
+        polledJobs = polledJobs + 1;
+        spinUs(fast.workUs);
+        next += period;
+        while (next <= timer_now()) next += period;
+    }
+}
+
+static void report(const char* what, const DlStats& st) {
+    bench_metric("t28", what, "worst-latency-us", toUs(st.worstLatency));
+    bench_metric("t28", what, "avg-latency-us", st.jobs == 0 ? 0 : toUs(st.totalLatency / st.jobs));
+    bench_metric("t28", what, "misses", st.misses);
+    bench_metric("t28", what, "throttles", st.throttles);
+}
+
+static void jitter() {
+    uint32_t me = getCoreID();
+    if (me != 2 && me != 3) return;
+    task_struct* h = kthread_create(hog, nullptr, me);
+    task_struct* t[2] = { nullptr, nullptr };
+    if (me == 2) {
+        t[0] = kthread_create_dl(periodic, &fast, 100, 1000, 2);
+        t[1] = kthread_create_dl(periodic, &slow, 500, 5000, 2);
+        if (t[0] == nullptr || t[1] == nullptr) errors.fetch_add(1);
+    } else {
+        t[0] = kthread_create(polled, nullptr, 3);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        if (t[i] != nullptr) kthread_join(t[i]);
+    }
+    if (done.add_fetch(1) == 2) stop.set(1);
+    if (h != nullptr) kthread_join(h);
+}
+
+static void jitterReport() {
+    report("dl-1ms", fast.stats);
+    report("dl-5ms", slow.stats);
+    bench_metric("t28", "normal-1ms", "worst-latency-us", toUs(polledWorst));
+    bench_metric("t28", "normal-1ms", "avg-latency-us", polledJobs == 0 ? 0 : toUs(polledTotal / polledJobs));
+    uint64_t bound = timer_us(1000);
+    bool ok = errors.get() == 0 && fast.stats.jobs == JOBS_1MS && slow.stats.jobs == JOBS_5MS &&
+        fast.stats.misses == 0 && slow.stats.misses == 0 &&
+        fast.stats.worstLatency < bound && slow.stats.worstLatency < bound;
+    printf("*** deadline release jitter %s\n", ok ? "ok" : "FAILED");
+}
+
+/* budget */
+
+struct alignas(64) Progress {
+    volatile uint64_t count;
+};
+static Progress progress[2];
+static Atomic<uint32_t> budgetDone{0};
+static DlStats greedyStats;
+
+static void greedy(void*) {
+    while (stop.get<MO_RELAXED>() == 0) progress[0].count = progress[0].count + 1;
+    sched_dl_stats(current, greedyStats);
+}
+
+static void fair(void*) {
+    while (stop.get<MO_RELAXED>() == 0) progress[1].count = progress[1].count + 1;
+}
+
+static void budget() {
+    if (getCoreID() != 0) {
+        // asleep, so only the two of them are busy on core 3
+        while (budgetDone.get() == 0) sleep_us(10000);
+        return;
+    }
+    stop.set(0);
+    task_struct* g = kthread_create_dl(greedy, nullptr, 200, 2000, 3);
+    task_struct* f = kthread_create(fair, nullptr, 3);
+    spinUs(WINDOW_MS * 1000);
+    stop.set(1);
+    if (g != nullptr) kthread_join(g);
+    if (f != nullptr) kthread_join(f);
+    budgetDone.set(1);
+
+    uint64_t dl = progress[0].count;
+    uint64_t normal = progress[1].count;
+    uint64_t share = dl + normal == 0 ? 0 : dl * 1000 / (dl + normal);
+    bench_metric("t28", "budget", "share-x1000", share);
+    bench_metric("t28", "budget", "throttles", greedyStats.throttles);
+    // 100 reserved, plus up to a wheel unit of overrun per period
+    printf("*** deadline budgets enforced %s\n",
+        g != nullptr && f != nullptr && greedyStats.throttles != 0 && share >= 50 && share <= 300 ? "ok" : "FAILED");
+}
+
+/* mixed */
+
+static Atomic<uint32_t> finished{0};
+static Atomic<uint32_t> mixedDone{0};
+
+static void normalRounds(void*) {
+    for (uint32_t i = 0; i < ROUNDS; i++) yield();
+    finished.fetch_add(1);
+}
+
+static void dlRounds(void*) {
+    for (uint32_t i = 0; i < ROUNDS; i++) dl_wait_period();
+    finished.fetch_add(1);
+}
+
+static void mixed() {
+    if (getCoreID() != 0) {
+        while (mixedDone.get() == 0) sleep_us(10000);
+        return;
+    }
+    task_struct* t[2 * MIXED];
+    bool ok = true;
+    for (uint32_t i = 0; i < MIXED; i++) {
+        t[2 * i] = kthread_create(normalRounds, nullptr, 1);
+        t[2 * i + 1] = kthread_create_dl(dlRounds, nullptr, 20, 1000, 1);
+        ok = ok && t[2 * i] != nullptr && t[2 * i + 1] != nullptr;
+    }
+    // a task lost off the run queue never finishes, so don't join blind
+    uint64_t end = timer_now() + timer_us(1000000);
+    while (finished.get() != 2 * MIXED && timer_now() < end) sleep_us(1000);
+    bool all = finished.get() == 2 * MIXED;
+    if (all) {
+        for (uint32_t i = 0; i < 2 * MIXED; i++) {
+            if (t[i] != nullptr) kthread_join(t[i]);
+        }
+    }
+    mixedDone.set(1);
+    printf("*** deadline and normal tasks share a level %s\n", ok && all ? "ok" : "FAILED");
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+
+    phase.sync();
+    if (me == 0) admission();
+    phase.sync();
+    jitter();
+    phase.sync();
+    if (me == 0) jitterReport();
+    phase.sync();
+    budget();
+    phase.sync();
+    mixed();
+
+    phase.sync();
+    if (me == 0) sched_stats_print();
+}
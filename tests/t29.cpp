@@ -0,0 +1,212 @@
+#include "printf.h"
+#include "async.h"
+#include "sched.h"
+#include "ipi.h"
+#include "uart.h"
+#include "timer.h"
+#include "percpu.h"
+#include "rpi-SmartStart.h"
+#include "bench.h"
+
+/*
+ * Coroutines on the per-core executors.
+ *
+ *   overlap:  core 0 writes LINES lines to the UART and makes QUERIES
+ *             mailbox property calls, first one after the other with the
+ *             blocking calls, then as two coroutines on its executor, each
+ *             going on while the other waits for its device. The answers
+ *             must be the same both ways; the difference in time is what
+ *             the overlap saved
+ *   sleep:    core 1 spawns SLEEPERS coroutines sleeping 1 to 10 ms; none
+ *             may wake early, and all of them must finish
+ *   hops:     a coroutine goes round cores 1, 2, 3 and 0 HOPS times, and
+ *             must be where it asked to be after each hop
+ *   events:   WAITERS coroutines on each of cores 1-3 wait on one
+ *             AsyncEvent, which core 0 has set in an IPI handler on core 2
+ */
+
+static constexpr uint32_t LINES = 8;
+static constexpr uint32_t QUERIES = 24;
+static constexpr uint32_t SLEEPERS = 500;
+static constexpr uint32_t HOPS = 500;
+static constexpr uint32_t WAITERS = 50;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+
+/* overlap */
+
+// "| " lines, so they don't count as output
+static const char line[] = "| async uart: the quick brown fox jumps over the lazy dog 0123456789\r\n";
+
+static char text[LINES * (sizeof(line) - 1) + 1];
+
+static const uint32_t tags[3] = { MAILBOX_TAG_GET_VERSION, MAILBOX_TAG_GET_BOARD_REVISION, MAILBOX_TAG_GET_ARM_MEMORY };
+
+struct alignas(CACHE_LINE) Msg {
+    uint32_t w[8];
+};
+
+static Msg msgs[QUERIES];
+static uint32_t blocking[QUERIES][2];
+
+static Async<void> queries(uint32_t& answered) {
+    for (uint32_t i = 0; i < QUERIES; i++) {
+        uint32_t* m = msgs[i].w;
+        m[0] = sizeof(msgs[i].w);
+        m[1] = 0;
+        m[2] = tags[i % 3];
+        m[3] = 8;
+        m[4] = 8;
+        m[5] = 0;
+        m[6] = 0;
+        m[7] = 0;
+        if (co_await mailbox_call_async(m)) answered++;
+    }
+}
+
+static void overlap() {
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < LINES; i++) {
+        for (uint32_t j = 0; line[j] != 0; j++) text[len++] = line[j];
+    }
+    text[len] = 0;
+
+    uint32_t answered = 0;
+    uint64_t start = bench_ticks();
+    uart_puts(text);
+    for (uint32_t i = 0; i < QUERIES; i++) {
+        uint32_t r[5];
+        if (mailbox_tag_message(r, 5, tags[i % 3], 8, 8, 0, 0)) {
+            blocking[i][0] = r[3];
+            blocking[i][1] = r[4];
+            answered++;
+        }
+    }
+    uint64_t serial = bench_ticks() - start;
+
+    uint32_t overlapped = 0;
+    start = bench_ticks();
+    bool spawned = async_spawn(uart_write_async(text, len)) && async_spawn(queries(overlapped));
+    async_run();
+    uint64_t together = bench_ticks() - start;
+
+    bool same = spawned && answered == QUERIES && overlapped == QUERIES;
+    for (uint32_t i = 0; same && i < QUERIES; i++) {
+        same = msgs[i].w[5] == blocking[i][0] && msgs[i].w[6] == blocking[i][1];
+    }
+    uint64_t saved = serial > together ? serial - together : 0;
+    bench_report("t29", "uart-mailbox-blocking", 1, QUERIES, serial);
+    bench_report("t29", "uart-mailbox-overlapped", 1, QUERIES, together);
+    bench_metric("t29", "overlap", "saved-ticks", saved);
+    bench_metric("t29", "overlap", "saved-us", saved * 1000000 / timer_freq());
+    printf("*** async uart and mailbox overlap %s\n", same ? "ok" : "FAILED");
+}
+
+/* sleep */
+
+static Atomic<uint32_t> woke{0};
+static Atomic<uint32_t> early{0};
+
+static Async<void> sleeper(uint32_t i) {
+    uint64_t when = timer_now() + timer_us(1000 + (i % 10) * 1000);
+    co_await async_sleep_until(when);
+    if (timer_now() < when) early.fetch_add(1);
+    woke.fetch_add(1);
+}
+
+static void sleeps() {
+    uint64_t start = bench_ticks();
+    for (uint32_t i = 0; i < SLEEPERS; i++) {
+        if (!async_spawn(sleeper(i))) errors.fetch_add(1);
+    }
+    async_run();
+    uint64_t ticks = bench_ticks() - start;
+    bench_report("t29", "sleepers", 1, SLEEPERS, ticks);
+    printf("*** async sleep %s\n",
+        errors.get() == 0 && woke.get() == SLEEPERS && early.get() == 0 ? "ok" : "FAILED");
+}
+
+/* hops */
+
+static Atomic<uint32_t> hopsDone{0};
+static Atomic<uint32_t> lost{0};
+
+static void done() {
+    hopsDone.set(1);
+    for (uint32_t core = 1; core < 4; core++) async_wake(core);
+}
+
+static Async<void> traveller() {
+    for (uint32_t i = 0; i < HOPS; i++) {
+        for (uint32_t core = 1; core <= 4; core++) {
+            co_await async_on_core(core % 4);
+            if (getCoreID() != core % 4) lost.fetch_add(1);
+        }
+    }
+    done();
+}
+
+static void hops() {
+    if (getCoreID() != 0) {
+        async_run_until([] { return hopsDone.get() != 0; });
+        return;
+    }
+    uint64_t start = bench_ticks();
+    if (!async_spawn(traveller())) {
+        lost.fetch_add(1);
+        done();
+    }
+    async_run();
+    uint64_t ticks = bench_ticks() - start;
+    bench_report("t29", "hop", 4, HOPS * 4, ticks);
+}
+
+/* events */
+
+static AsyncEvent go;
+static Atomic<uint32_t> waiting{0};
+static Atomic<uint32_t> resumed{0};
+
+static Async<void> waiter() {
+    waiting.fetch_add(1);
+    co_await go.wait();
+    resumed.fetch_add(1);
+}
+
+static void setGo(void*) {
+    go.set();
+}
+
+static void events() {
+    uint32_t me = getCoreID();
+    if (me == 0) {
+        while (waiting.get() != 3 * WAITERS) {}
+        smp_call_function_single(2, setGo, nullptr, true);
+        return;
+    }
+    for (uint32_t i = 0; i < WAITERS; i++) {
+        if (!async_spawn(waiter())) waiting.fetch_add(1);
+    }
+    async_run();
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+
+    phase.sync();
+    if (me == 0) overlap();
+    phase.sync();
+    if (me == 1) sleeps();
+    phase.sync();
+    hops();
+    phase.sync();
+    if (me == 0) printf("*** async hops between cores %s\n", lost.get() == 0 ? "ok" : "FAILED");
+    events();
+    phase.sync();
+    if (me == 0) {
+        printf("*** async events from IPIs %s\n", resumed.get() == 3 * WAITERS ? "ok" : "FAILED");
+        async_stats_print();
+    }
+}
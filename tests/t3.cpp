@@ -0,0 +1,113 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Heap latency and fragmentation, single core.
+ *
+ * A fixed pseudo-random mix of 16 B .. 8 KB allocations and frees keeps
+ * up to SLOTS blocks live. Every call is timed; the worst and total
+ * ticks for malloc and free are reported along with failed requests.
+ * Afterwards every other live block is freed and the largest request
+ * that still succeeds is measured, then everything is freed and it is
+ * measured again.
+ *
+ * The test only uses malloc/free, so the same file can be built against
+ * an older src/heap.cpp to compare allocators.
+ */
+
+static constexpr int SLOTS = 200;
+static constexpr int OPS = 20000;
+
+static uint32_t seed = 1;
+
+static uint32_t rnd() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static size_t pickSize() {
+    uint32_t shift = 4 + rnd() % 9;
+    return (size_t(1) << shift) + rnd() % (1 << shift);
+}
+
+struct Slot {
+    uint8_t* p;
+    size_t bytes;
+};
+
+static Slot slots[SLOTS];
+static uint32_t errors = 0;
+
+static size_t largest() {
+    size_t lo = 0;
+    size_t hi = 1 << 20;
+    while (lo < hi) {
+        size_t mid = (lo + hi + 1) / 2;
+        void* p = malloc(mid);
+        if (p != nullptr) {
+            free(p);
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static void release(Slot& s) {
+    if (s.p == nullptr) return;
+    if (s.p[0] != uint8_t(s.bytes) || s.p[s.bytes - 1] != uint8_t(s.bytes)) errors++;
+    free(s.p);
+    s.p = nullptr;
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() != 0) return;
+
+    uint64_t mallocTicks = 0, mallocMax = 0, mallocs = 0, failed = 0;
+    uint64_t freeTicks = 0, freeMax = 0, frees = 0;
+
+    for (int op = 0; op < OPS; op++) {
+        Slot& s = slots[rnd() % SLOTS];
+        if (s.p == nullptr) {
+            size_t bytes = pickSize();
+            uint64_t start = bench_ticks();
+            s.p = (uint8_t*) malloc(bytes);
+            uint64_t t = bench_ticks() - start;
+            mallocTicks += t;
+            if (t > mallocMax) mallocMax = t;
+            mallocs++;
+            if (s.p == nullptr) {
+                failed++;
+            } else {
+                s.bytes = bytes;
+                s.p[0] = s.p[bytes - 1] = uint8_t(bytes);
+            }
+        } else {
+            if (s.p[0] != uint8_t(s.bytes)) errors++;
+            uint64_t start = bench_ticks();
+            free(s.p);
+            uint64_t t = bench_ticks() - start;
+            s.p = nullptr;
+            freeTicks += t;
+            if (t > freeMax) freeMax = t;
+            frees++;
+        }
+    }
+
+    bench_report("t3", "malloc", 1, mallocs, mallocTicks);
+    bench_metric("t3", "malloc", "max-ticks", mallocMax);
+    bench_metric("t3", "malloc", "failed", failed);
+    bench_report("t3", "free", 1, frees, freeTicks);
+    bench_metric("t3", "free", "max-ticks", freeMax);
+
+    for (int i = 0; i < SLOTS; i += 2) release(slots[i]);
+    bench_metric("t3", "holes", "largest", largest());
+
+    for (int i = 1; i < SLOTS; i += 2) release(slots[i]);
+    bench_metric("t3", "empty", "largest", largest());
+
+    printf("*** heap churn errors %d\n", errors);
+}
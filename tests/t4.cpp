@@ -0,0 +1,88 @@
+#include "printf.h"
+#include "pages.h"
+#include "bench.h"
+
+/*
+ * Buddy page allocator.
+ *
+ * Core 0 takes one block of every order, checks alignment and that the
+ * blocks don't overlap, frees them and checks every page came back.
+ * Then every core churns single pages (per-core hot lists) and order 2
+ * blocks (buddy lists, locked) for the throughput numbers.
+ */
+
+static constexpr int ROUNDS = 1000;
+static constexpr int DEPTH = 8;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+
+static void orders() {
+    void* blocks[PAGE_MAX_ORDER + 1];
+    size_t before = pageFreeCount();
+
+    for (int o = 1; o <= PAGE_MAX_ORDER; o++) {
+        blocks[o] = pageAlloc(o);
+        uintptr_t a = (uintptr_t) blocks[o];
+        uintptr_t bytes = uintptr_t(4096) << o;
+        if (blocks[o] == nullptr || (a & (bytes - 1)) != 0) {
+            errors.fetch_add(1);
+            continue;
+        }
+        // first and last word of every block, overlaps show up below
+        uint64_t* w = (uint64_t*) a;
+        w[0] = o;
+        w[bytes / 8 - 1] = o;
+    }
+    for (int o = 1; o <= PAGE_MAX_ORDER; o++) {
+        if (blocks[o] == nullptr) continue;
+        uint64_t* w = (uint64_t*) blocks[o];
+        uintptr_t bytes = uintptr_t(4096) << o;
+        if (w[0] != uint64_t(o) || w[bytes / 8 - 1] != uint64_t(o)) errors.fetch_add(1);
+        pageFree(blocks[o]);
+    }
+
+    if (pageFreeCount() != before) errors.fetch_add(1);
+    printf("*** page orders errors %d\n", errors.get());
+}
+
+static void churn(int order) {
+    void* live[DEPTH];
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < DEPTH; i++) {
+            live[i] = pageAlloc(order);
+            if (live[i] == nullptr) errors.fetch_add(1);
+            else *(uint64_t*) live[i] = r;
+        }
+        for (int i = 0; i < DEPTH; i++) {
+            if (live[i] == nullptr) continue;
+            if (*(uint64_t*) live[i] != (uint64_t) r) errors.fetch_add(1);
+            pageFree(live[i]);
+        }
+    }
+}
+
+static void run(const char* what, int order, uint32_t cores) {
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (getCoreID() < cores) churn(order);
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (getCoreID() == 0) {
+        bench_report("t4", what, cores, uint64_t(cores) * ROUNDS * DEPTH * 2, ticks);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() == 0) orders();
+
+    for (uint32_t cores = 1; cores <= 4; cores *= 2) {
+        run("page-order0", 0, cores);
+        run("page-order2", 2, cores);
+    }
+    phase.sync();
+    if (getCoreID() == 0) {
+        printf("*** page churn errors %d\n", errors.get());
+    }
+}
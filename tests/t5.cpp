@@ -0,0 +1,45 @@
+#include "printf.h"
+#include "heap.h"
+#include "utils.h"
+
+/*
+ * heap_stats() bookkeeping on a quiet heap (core 0 only).
+ */
+
+static void check(const char* what, bool ok) {
+    printf("*** %s: %s\n", what, ok ? "ok" : "FAIL");
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() != 0) return;
+
+    heap_checks(true);
+    heap_track_sites(true);
+
+    HeapStats before, during, after;
+    heap_stats(before);
+
+    void* small = malloc(100);
+    void* big = malloc(10000);
+    void* huge = malloc(1 << 22);
+    heap_stats(during);
+
+    check("malloc counted", during.mallocs == before.mallocs + 2);
+    check("failure counted", huge == nullptr && during.failed == before.failed + 1);
+    check("live bytes", during.liveBytes - before.liveBytes >= 10100);
+
+    uint32_t blocks = 0;
+    for (int b = 0; b < HEAP_HIST_BUCKETS; b++) blocks += during.freeHistogram[b];
+    check("histogram", blocks == during.freeBlocks && during.largestFree <= during.freeBytes);
+    check("peak", during.peakBytes >= during.takenBytes);
+
+    free(big);
+    free(small);
+    heap_stats(after);
+    check("free counted", after.frees == before.frees + 2 && after.liveBytes == before.liveBytes);
+
+    heap_stats_print();
+    heap_track_sites(false);
+    heap_checks(false);
+}
@@ -0,0 +1,73 @@
+#include "printf.h"
+#include "heap.h"
+#include "arena.h"
+#include "bench.h"
+
+/*
+ * Arena allocator: nested scopes, marks, placement new, and the cost of
+ * N small allocations released in bulk versus N malloc/free pairs.
+ */
+
+static constexpr int OBJECTS = 1000;
+static constexpr int ROUNDS = 20;
+
+struct Node {
+    Node* next;
+    uint64_t value;
+    Node(Node* next, uint64_t value) : next(next), value(value) {}
+};
+
+static void check(const char* what, bool ok) {
+    printf("*** %s: %s\n", what, ok ? "ok" : "FAIL");
+}
+
+static void scopes() {
+    Arena arena{4096};
+
+    uint64_t* first = (uint64_t*) arena.alloc(24);
+    first[0] = 0x1234;
+    Arena::Mark outer = arena.mark();
+    {
+        Arena::Scope s{arena};
+        // spill over several chunks
+        for (int i = 0; i < 1000; i++) arena.alloc(40);
+        {
+            Arena::Scope inner{arena};
+            arena.alloc(10000);
+        }
+        uint64_t* a = (uint64_t*) arena.alloc(8, 64);
+        check("alignment", ((uintptr_t) a & 63) == 0);
+    }
+    Arena::Mark after = arena.mark();
+    check("scope release", after.chunk == outer.chunk && after.top == outer.top);
+    check("memory before the scope kept", first[0] == 0x1234);
+
+    Node* list = nullptr;
+    for (int i = 0; i < 100; i++) list = new (arena) Node(list, i);
+    uint64_t sum = 0;
+    for (Node* n = list; n != nullptr; n = n->next) sum += n->value;
+    check("placement new", sum == 99 * 100 / 2);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() != 0) return;
+
+    scopes();
+
+    Node* nodes[OBJECTS];
+    uint64_t start = bench_ticks();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < OBJECTS; i++) nodes[i] = new Node(nullptr, i);
+        for (int i = 0; i < OBJECTS; i++) delete nodes[i];
+    }
+    bench_report("t6", "new-delete", 1, ROUNDS * OBJECTS, bench_ticks() - start);
+
+    Arena arena;
+    start = bench_ticks();
+    for (int r = 0; r < ROUNDS; r++) {
+        Arena::Scope s{arena};
+        for (int i = 0; i < OBJECTS; i++) nodes[i] = new (arena) Node(nullptr, i);
+    }
+    bench_report("t6", "arena", 1, ROUNDS * OBJECTS, bench_ticks() - start);
+}
@@ -0,0 +1,90 @@
+#include "printf.h"
+#include "heap.h"
+#include "percpu.h"
+#include "bench.h"
+
+/*
+ * Cache-line alignment: aligned_alloc/memalign, over-aligned new, and
+ * what false sharing costs. Every core bumps its own slot of a packed
+ * PerCPU (all four slots on one line), a PaddedPerCPU (a line each) and
+ * a PerCPUCounter, then all four bump one shared atomic for comparison.
+ */
+
+static constexpr int INCS = 20000;
+
+static BenchSync phase;
+static PerCPU<uint64_t> packed;
+static PaddedPerCPU<uint64_t> padded;
+static PerCPUCounter counter;
+static Atomic<uint32_t> shared{0};
+
+struct alignas(CACHE_LINE) Line {
+    uint64_t words[8];
+};
+
+static void check(const char* what, bool ok) {
+    printf("*** %s: %s\n", what, ok ? "ok" : "FAIL");
+}
+
+static void alignment() {
+    HeapStats before;
+    heap_stats(before);
+
+    bool ok = true;
+    void* blocks[2][10];
+    for (int i = 0; i < 10; i++) {
+        size_t align = 16 << i;
+        blocks[0][i] = aligned_alloc(align, 24 + i * 100);
+        blocks[1][i] = memalign(align, 8);
+        for (int k = 0; k < 2; k++) {
+            if (blocks[k][i] == nullptr || ((uintptr_t) blocks[k][i] & (align - 1)) != 0) ok = false;
+        }
+    }
+    check("aligned_alloc alignment", ok);
+
+    Line* lines = new Line[3];
+    Line* line = new Line;
+    check("aligned new", ((uintptr_t) lines & (CACHE_LINE - 1)) == 0 &&
+                         ((uintptr_t) line & (CACHE_LINE - 1)) == 0);
+    delete line;
+    delete[] lines;
+
+    for (int i = 0; i < 10; i++) {
+        free(blocks[0][i]);
+        free(blocks[1][i]);
+    }
+    HeapStats after;
+    heap_stats(after);
+    check("aligned blocks freed", after.liveBytes == before.liveBytes);
+}
+
+template <typename F>
+static void run(const char* what, F bump) {
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (int i = 0; i < INCS; i++) bump();
+    phase.sync();
+    uint64_t ticks = bench_ticks() - start;
+    if (getCoreID() == 0) bench_report("t7", what, 4, 4 * INCS, ticks);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    if (getCoreID() == 0) alignment();
+
+    volatile uint64_t& p = packed.mine();
+    volatile uint64_t& q = padded.mine();
+    run("packed", [&p] { p = p + 1; });
+    run("padded", [&q] { q = q + 1; });
+    run("percpu-counter", [] { counter.inc(); });
+    run("shared-atomic", [] { shared.fetch_add(1); });
+
+    phase.sync();
+    if (getCoreID() == 0) {
+        bool ok = counter.read() == 4 * INCS && shared.get() == 4 * INCS;
+        for (int i = 0; i < 4; i++) {
+            if (packed.forCPU(i) != INCS || padded.forCPU(i) != INCS) ok = false;
+        }
+        check("per-core counts", ok);
+    }
+}
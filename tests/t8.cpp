@@ -0,0 +1,106 @@
+#include "printf.h"
+#include "heap.h"
+#include "pool.h"
+#include "sched.h"
+#include "bench.h"
+
+/*
+ * Pool<T>: alignment, occupancy, objects handed to another core and freed
+ * there, a pooled Barrier, and pool vs new/delete for task_struct.
+ */
+
+static constexpr int HANDOFF = 100;
+static constexpr int ROUNDS = 500;
+static constexpr int DEPTH = 8;
+
+static BenchSync phase;
+static Pool<task_struct> tasks;
+static Pool<Barrier> barriers;
+static task_struct* handoff[HANDOFF];
+static Barrier* pooled = nullptr;
+
+static void check(const char* what, bool ok) {
+    printf("*** %s: %s\n", what, ok ? "ok" : "FAIL");
+}
+
+static void basics() {
+    bool aligned = true;
+    for (int i = 0; i < HANDOFF; i++) {
+        handoff[i] = tasks.alloc();
+        if (handoff[i] == nullptr || ((uintptr_t) handoff[i] & (CACHE_LINE - 1)) != 0) aligned = false;
+        handoff[i]->counter = i;
+    }
+    check("pooled objects aligned", aligned);
+
+    PoolStats st;
+    tasks.stats(st);
+    check("occupancy", st.inUse == HANDOFF && st.capacity >= HANDOFF &&
+                       st.cached == st.capacity - HANDOFF);
+}
+
+static void bench(const char* what, bool pool) {
+    task_struct* live[DEPTH];
+    phase.sync();
+    uint64_t start = bench_ticks();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < DEPTH; i++) live[i] = pool ? tasks.alloc() : new task_struct;
+        for (int i = 0; i < DEPTH; i++) {
+            if (pool) tasks.free(live[i]); else delete live[i];
+        }
+    }
+    phase.sync();
+    if (getCoreID() == 0) bench_report("t8", what, 4, 4 * ROUNDS * DEPTH * 2, bench_ticks() - start);
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    uint32_t me = getCoreID();
+
+    if (me == 0) {
+        basics();
+        pooled = barriers.alloc();
+        pooled->arm(4);
+    }
+    phase.sync();
+
+    // core 1 frees everything core 0 allocated
+    if (me == 1) {
+        bool intact = true;
+        for (int i = 0; i < HANDOFF; i++) {
+            if (handoff[i]->counter != i) intact = false;
+            tasks.free(handoff[i]);
+        }
+        check("objects intact on another core", intact);
+    }
+    phase.sync();
+
+    if (me == 0) {
+        PoolStats st;
+        tasks.stats(st);
+        bool queued = st.remote == HANDOFF && st.inUse == 0;
+        uint32_t slabs = st.slabs;
+        for (int i = 0; i < HANDOFF; i++) handoff[i] = tasks.alloc();
+        tasks.stats(st);
+        check("cross-core frees reclaimed", queued && st.remote == 0 &&
+                                            st.slabs == slabs && st.remoteFrees == HANDOFF);
+        for (int i = 0; i < HANDOFF; i++) tasks.free(handoff[i]);
+    }
+
+    pooled->sync();
+    phase.sync();
+    if (me == 0) {
+        check("pooled barrier", true);
+        barriers.free(pooled);
+    }
+
+    bench("pool", true);
+    bench("new-delete", false);
+
+    phase.sync();
+    if (me == 0) {
+        PoolStats st;
+        tasks.stats(st);
+        check("pool drained", st.inUse == 0 && st.failed == 0);
+        tasks.print("task_struct");
+    }
+}
@@ -0,0 +1,109 @@
+#include "printf.h"
+#include "heap.h"
+#include "bench.h"
+
+/*
+ * Producer/consumer across two cores: core 0 mallocs, core 1 frees.
+ *
+ * 64 byte blocks go back to core 0 through its remote-free list, 1 KB
+ * blocks are too big for the magazines and take the heap lock both ways.
+ */
+
+static constexpr int ITEMS = 4000;
+static constexpr int HANDOFF = 100;
+static constexpr uint32_t RING = 64;
+
+static BenchSync phase;
+static Atomic<uint32_t> errors{0};
+
+// single producer (core 0), single consumer (core 1)
+static uint64_t* ring[RING];
+static Atomic<uint32_t> head{0};
+static Atomic<uint32_t> tail{0};
+
+static void put(uint64_t* p) {
+    uint32_t h = head.get();
+    while (h - tail.get() == RING) iAmStuckInALoop(false);
+    ring[h % RING] = p;
+    head.set(h + 1);
+}
+
+static uint64_t* take() {
+    uint32_t t = tail.get();
+    while (head.get() == t) iAmStuckInALoop(false);
+    uint64_t* p = ring[t % RING];
+    tail.set(t + 1);
+    return p;
+}
+
+static void check(const char* what, bool ok) {
+    printf("*** %s: %s\n", what, ok ? "ok" : "FAIL");
+}
+
+static void pingPong(const char* what, size_t bytes) {
+    uint32_t me = getCoreID();
+    phase.sync();
+    uint64_t start = bench_ticks();
+    if (me == 0) {
+        for (int i = 0; i < ITEMS; i++) {
+            uint64_t* p = (uint64_t*) malloc(bytes);
+            if (p == nullptr) {
+                errors.fetch_add(1);
+                i--;
+                continue;
+            }
+            p[0] = i;
+            put(p);
+        }
+    } else if (me == 1) {
+        for (int i = 0; i < ITEMS; i++) {
+            uint64_t* p = take();
+            if (p[0] != (uint64_t) i) errors.fetch_add(1);
+            free(p);
+        }
+    }
+    phase.sync();
+    if (me == 0) bench_report("t9", what, 2, ITEMS, bench_ticks() - start);
+}
+
+static void reclaim() {
+    uint32_t me = getCoreID();
+    if (me == 1) {
+        for (int i = 0; i < HANDOFF; i++) free(take());
+    }
+    if (me == 0) {
+        for (int i = 0; i < HANDOFF; i++) put((uint64_t*) malloc(64));
+    }
+    phase.sync();
+
+    if (me == 0) {
+        HeapStats st;
+        heap_stats(st);
+        check("cross-core frees queued for the owner", st.remoteBytes >= HANDOFF * 64);
+
+        // enough to empty the magazine at least once, which reclaims
+        uint64_t* p[HANDOFF];
+        for (int i = 0; i < HANDOFF; i++) p[i] = (uint64_t*) malloc(64);
+        heap_stats(st);
+        check("owner reclaimed them", st.remoteBytes == 0);
+        for (int i = 0; i < HANDOFF; i++) free(p[i]);
+    }
+}
+
+/* Called by all cores */
+void kernelMain(void) {
+    HeapStats before;
+    if (getCoreID() == 0) heap_stats(before);
+
+    reclaim();
+    pingPong("malloc-64", 64);
+    pingPong("malloc-1k", 1024);
+
+    phase.sync();
+    if (getCoreID() == 0) {
+        HeapStats after;
+        heap_stats(after);
+        check("ping-pong", errors.get() == 0);
+        check("nothing lost", after.liveBytes == before.liveBytes);
+    }
+}